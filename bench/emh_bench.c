@@ -0,0 +1,960 @@
+/**
+ *  emh_malloc
+ *  Copyright (C) 2022, Antonio Vitor Grossi Bassi
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * @file    emh_bench.c
+ * @author  Antonio Vitor Grossi Bassi (antoniovitor.gb@gmail.com)
+ * @brief   Multi-threaded benchmark and latency harness. Runs a set of
+ *          workloads over emh_malloc and over the C library malloc for
+ *          a range of thread and heap counts, reporting throughput,
+ *          latency percentiles and peak resident memory.
+ *
+ * @version 1.6
+ * @date    2022-10-12
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "emh_malloc.h"
+
+pthread_mutex_t emh_benchZone = PTHREAD_MUTEX_INITIALIZER;
+pthread_mutex_t emh_benchHeapZone[EMH_MALLOC_N_HEAPS];
+
+#define BENCH_MAX_THREADS   64
+#define BENCH_WINDOW        1024
+#define BENCH_AGING_WINDOW  4096
+#define BENCH_REALLOC_SLOTS 16
+#define BENCH_REALLOC_MAX   65536
+#define BENCH_QUEUE_SIZE    1024
+#define BENCH_CHURN_SIZE    64
+#define BENCH_PRODCONS_SIZE 128
+#define BENCH_SCAN_HOLES    1024
+#define BENCH_SCAN_SPACER   65536
+
+enum
+{
+    BENCH_LAT_MALLOC = 0,
+    BENCH_LAT_FREE,
+    BENCH_LAT_REALLOC,
+    BENCH_LAT_KINDS
+};
+
+/*
+ * Single producer, single consumer ring used by the producer/consumer
+ * workload. Every thread produces into the ring of the next thread and
+ * consumes its own ring, so every block is freed by a different thread
+ * than the one that allocated it (unless a single thread is running).
+ */
+typedef struct bench_queue_t
+{
+    _Atomic size_t  head;
+    char            headPad[64 - sizeof( size_t )];
+    _Atomic size_t  tail;
+    char            tailPad[64 - sizeof( size_t )];
+    void*           slots[BENCH_QUEUE_SIZE];
+}bench_queue_t;
+
+typedef struct bench_thread_t
+{
+    pthread_t       thread;
+    int             idx;
+    int             heap;
+    uint64_t        rng;
+    unsigned int    tick;
+    uint32_t*       lat[BENCH_LAT_KINDS];
+    size_t          nLat[BENCH_LAT_KINDS];
+    size_t          latCap;
+    size_t          ops;
+    size_t          fails;
+    size_t          live;
+    size_t          peakLive;
+    void**          slots;
+    size_t*         sizes;
+}bench_thread_t;
+
+typedef struct bench_workload_t
+{
+    const char*     name;
+    void            (*run)(bench_thread_t *t);
+}bench_workload_t;
+
+static struct
+{
+    int             useEmh;
+    unsigned int    engine;
+    size_t          nOps;
+    size_t          heapSize;
+    unsigned int    latPeriod;
+    int             nThreads;
+    int             nHeaps;
+    int             hugePages;
+    int             localHeaps;
+}bench_cfg;
+
+static const bench_workload_t* bench_workload;
+static emh_heapId_t       bench_heaps[EMH_MALLOC_N_HEAPS];
+static bench_queue_t*     bench_queues;
+static atomic_int         bench_producersDone;
+static pthread_barrier_t  bench_barrier;
+static uint64_t           bench_t0, bench_t1;
+static unsigned int       bench_frag;
+
+static uint64_t bench_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ( (uint64_t) ts.tv_sec * 1000000000u ) + (uint64_t) ts.tv_nsec;
+}
+
+static uint64_t bench_rand(bench_thread_t *t)
+{
+    /* xorshift64* */
+    t->rng ^= t->rng >> 12;
+    t->rng ^= t->rng << 25;
+    t->rng ^= t->rng >> 27;
+    return t->rng * 0x2545F4914F6CDD1DULL;
+}
+
+/* Roughly log-uniform sizes between 16 and (32 << maxShift) - 1 bytes. */
+static size_t bench_randSize(bench_thread_t *t, unsigned int maxShift)
+{
+    size_t base = (size_t) 16 << ( bench_rand(t) % ( maxShift + 1 ) );
+    return base + ( bench_rand(t) % base );
+}
+
+static int bench_sampled(bench_thread_t *t)
+{
+    return 0 == ( t->tick++ % bench_cfg.latPeriod );
+}
+
+static void bench_record(bench_thread_t *t, int kind, uint64_t start)
+{
+    uint64_t elapsed = bench_now() - start;
+    if( t->nLat[kind] < t->latCap )
+    {
+        t->lat[kind][t->nLat[kind]++] = ( elapsed > UINT32_MAX ) ? UINT32_MAX : (uint32_t) elapsed;
+    }
+}
+
+static void* bench_alloc(bench_thread_t *t, size_t size)
+{
+    void     *addr;
+    uint64_t start  = 0;
+    int      sample = bench_sampled(t);
+
+    if( sample )
+    {
+        start = bench_now();
+    }
+    if( bench_cfg.useEmh )
+    {
+        addr = bench_cfg.localHeaps ? emh_malloc_local(size) : emh_malloc(bench_heaps[t->heap], size);
+    }
+    else
+    {
+        addr = malloc(size);
+    }
+    if( sample )
+    {
+        bench_record(t, BENCH_LAT_MALLOC, start);
+    }
+
+    t->ops++;
+    if( NULL == addr )
+    {
+        t->fails++;
+        return NULL;
+    }
+
+    /* Touch the block so its pages count towards the resident set. */
+    ( (volatile uint8_t*) addr )[0]        = 0xA5;
+    ( (volatile uint8_t*) addr )[size - 1] = 0x5A;
+    return addr;
+}
+
+static void bench_release(bench_thread_t *t, void *addr)
+{
+    uint64_t start  = 0;
+    int      sample = bench_sampled(t);
+
+    if( sample )
+    {
+        start = bench_now();
+    }
+    if( bench_cfg.useEmh )
+    {
+        emh_free(addr);
+    }
+    else
+    {
+        free(addr);
+    }
+    if( sample )
+    {
+        bench_record(t, BENCH_LAT_FREE, start);
+    }
+    t->ops++;
+}
+
+static void* bench_resize(bench_thread_t *t, void *addr, size_t size)
+{
+    void     *newAddr;
+    uint64_t start  = 0;
+    int      sample = bench_sampled(t);
+
+    if( sample )
+    {
+        start = bench_now();
+    }
+    newAddr = bench_cfg.useEmh ? emh_realloc(addr, size) : realloc(addr, size);
+    if( sample )
+    {
+        bench_record(t, BENCH_LAT_REALLOC, start);
+    }
+
+    t->ops++;
+    if( NULL == newAddr )
+    {
+        t->fails++;
+        return NULL;
+    }
+    ( (volatile uint8_t*) newAddr )[size - 1] = 0x5A;
+    return newAddr;
+}
+
+static void bench_track(bench_thread_t *t, size_t allocated, size_t released)
+{
+    t->live += allocated;
+    t->live -= released;
+    if( t->live > t->peakLive )
+    {
+        t->peakLive = t->live;
+    }
+}
+
+/*
+ * Marks the end of the timed phase: every thread waits for the others,
+ * the first thread takes the end time and samples the fragmentation of
+ * the first heap while the working sets are still alive.
+ */
+static void bench_phaseEnd(bench_thread_t *t)
+{
+    emh_heapStats_t stats;
+
+    pthread_barrier_wait(&bench_barrier);
+    if( 0 == t->idx )
+    {
+        bench_t1 = bench_now();
+        if( bench_cfg.useEmh && ( 0 == emh_get_stats(bench_heaps[0], &stats) ) )
+        {
+            bench_frag = stats.fragmentation;
+        }
+    }
+    pthread_barrier_wait(&bench_barrier);
+}
+
+static void bench_freeSlots(bench_thread_t *t, size_t nSlots)
+{
+    size_t i;
+    for(i = 0; i < nSlots; i++)
+    {
+        if( NULL != t->slots[i] )
+        {
+            if( bench_cfg.useEmh )
+            {
+                emh_free(t->slots[i]);
+            }
+            else
+            {
+                free(t->slots[i]);
+            }
+            t->slots[i] = NULL;
+        }
+    }
+}
+
+/* Fixed-size blocks allocated and freed in FIFO order over a window. */
+static void bench_churn(bench_thread_t *t)
+{
+    size_t i, slot;
+
+    for(i = 0; i < bench_cfg.nOps; i++)
+    {
+        slot = i % BENCH_WINDOW;
+        if( NULL != t->slots[slot] )
+        {
+            bench_release(t, t->slots[slot]);
+            bench_track(t, 0, BENCH_CHURN_SIZE);
+        }
+        t->slots[slot] = bench_alloc(t, BENCH_CHURN_SIZE);
+        if( NULL != t->slots[slot] )
+        {
+            bench_track(t, BENCH_CHURN_SIZE, 0);
+        }
+    }
+    bench_phaseEnd(t);
+    bench_freeSlots(t, BENCH_WINDOW);
+}
+
+/* Random sizes, random lifetimes over a window. */
+static void bench_random(bench_thread_t *t)
+{
+    size_t i, slot;
+
+    for(i = 0; i < bench_cfg.nOps; i++)
+    {
+        slot = bench_rand(t) % BENCH_WINDOW;
+        if( NULL != t->slots[slot] )
+        {
+            bench_release(t, t->slots[slot]);
+            bench_track(t, 0, t->sizes[slot]);
+        }
+        t->sizes[slot] = bench_randSize(t, 7);
+        t->slots[slot] = bench_alloc(t, t->sizes[slot]);
+        if( NULL != t->slots[slot] )
+        {
+            bench_track(t, t->sizes[slot], 0);
+        }
+    }
+    bench_phaseEnd(t);
+    bench_freeSlots(t, BENCH_WINDOW);
+}
+
+static int bench_push(bench_queue_t *q, void *addr, size_t *depth)
+{
+    size_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&q->head, memory_order_acquire);
+
+    if( BENCH_QUEUE_SIZE == ( tail - head ) )
+    {
+        return 0;
+    }
+    q->slots[tail % BENCH_QUEUE_SIZE] = addr;
+    atomic_store_explicit(&q->tail, tail + 1, memory_order_release);
+    *depth = tail + 1 - head;
+    return 1;
+}
+
+static void* bench_pop(bench_queue_t *q)
+{
+    size_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&q->tail, memory_order_acquire);
+    void   *addr;
+
+    if( head == tail )
+    {
+        return NULL;
+    }
+    addr = q->slots[head % BENCH_QUEUE_SIZE];
+    atomic_store_explicit(&q->head, head + 1, memory_order_release);
+    return addr;
+}
+
+/* Blocks allocated by one thread and freed by the next one. */
+static void bench_prodcons(bench_thread_t *t)
+{
+    bench_queue_t *in  = &bench_queues[t->idx];
+    bench_queue_t *out = &bench_queues[( t->idx + 1 ) % bench_cfg.nThreads];
+    size_t        i, depth;
+    void          *addr;
+
+    for(i = 0; i < bench_cfg.nOps; i++)
+    {
+        addr = bench_alloc(t, BENCH_PRODCONS_SIZE);
+        if( NULL != addr )
+        {
+            while( !bench_push(out, addr, &depth) )
+            {
+                /* The consumer may be waiting on us, keep our own ring moving. */
+                void *other = bench_pop(in);
+                if( NULL != other )
+                {
+                    bench_release(t, other);
+                }
+                else
+                {
+                    sched_yield();
+                }
+            }
+            if( depth * BENCH_PRODCONS_SIZE > t->peakLive )
+            {
+                t->peakLive = depth * BENCH_PRODCONS_SIZE;
+            }
+        }
+        if( NULL != ( addr = bench_pop(in) ) )
+        {
+            bench_release(t, addr);
+        }
+    }
+
+    atomic_fetch_add(&bench_producersDone, 1);
+    for(;;)
+    {
+        int done = ( bench_cfg.nThreads == atomic_load(&bench_producersDone) );
+        while( NULL != ( addr = bench_pop(in) ) )
+        {
+            bench_release(t, addr);
+        }
+        if( done )
+        {
+            break;
+        }
+        sched_yield();
+    }
+    bench_phaseEnd(t);
+}
+
+/* A few buffers grown by realloc until they reach BENCH_REALLOC_MAX bytes. */
+static void bench_realloc(bench_thread_t *t)
+{
+    size_t i, slot, size;
+    void   *addr;
+
+    for(i = 0; i < bench_cfg.nOps; i++)
+    {
+        slot = i % BENCH_REALLOC_SLOTS;
+        if( NULL == t->slots[slot] )
+        {
+            t->sizes[slot] = 16;
+            t->slots[slot] = bench_alloc(t, t->sizes[slot]);
+            if( NULL != t->slots[slot] )
+            {
+                bench_track(t, t->sizes[slot], 0);
+            }
+            continue;
+        }
+
+        size = t->sizes[slot] + ( t->sizes[slot] >> 1 ) + ( bench_rand(t) % 64 );
+        addr = ( size > BENCH_REALLOC_MAX ) ? NULL : bench_resize(t, t->slots[slot], size);
+        if( NULL == addr )
+        {
+            bench_release(t, t->slots[slot]);
+            bench_track(t, 0, t->sizes[slot]);
+            t->slots[slot] = NULL;
+        }
+        else
+        {
+            bench_track(t, size, t->sizes[slot]);
+            t->slots[slot]  = addr;
+            t->sizes[slot]  = size;
+        }
+    }
+    bench_phaseEnd(t);
+    bench_freeSlots(t, BENCH_REALLOC_SLOTS);
+}
+
+/*
+ * Fragmentation aging: a working set of random sizes where one eighth of
+ * the blocks live sixty-four times longer than the rest, leaving long
+ * lived islands scattered through the heap.
+ */
+static void bench_aging(bench_thread_t *t)
+{
+    size_t i, slot;
+
+    for(i = 0; i < bench_cfg.nOps; i++)
+    {
+        slot = bench_rand(t) % BENCH_AGING_WINDOW;
+        if( ( slot < ( BENCH_AGING_WINDOW / 8 ) ) && ( 0 != ( bench_rand(t) % 64 ) ) )
+        {
+            slot = ( BENCH_AGING_WINDOW / 8 ) + ( bench_rand(t) % ( BENCH_AGING_WINDOW - ( BENCH_AGING_WINDOW / 8 ) ) );
+        }
+        if( NULL != t->slots[slot] )
+        {
+            bench_release(t, t->slots[slot]);
+            bench_track(t, 0, t->sizes[slot]);
+        }
+        t->sizes[slot] = bench_randSize(t, 8);
+        t->slots[slot] = bench_alloc(t, t->sizes[slot]);
+        if( NULL != t->slots[slot] )
+        {
+            bench_track(t, t->sizes[slot], 0);
+        }
+    }
+    bench_phaseEnd(t);
+    bench_freeSlots(t, BENCH_AGING_WINDOW);
+}
+
+/*
+ * First-fit scan: small holes left between large spacers, so every request
+ * too large for the holes walks a long free list spread over the heap. The
+ * scan touches one page per hole unless the small blocks are packed together.
+ */
+static void bench_scan(bench_thread_t *t)
+{
+    size_t i, slot;
+    void   *addr;
+
+    for(slot = 0; slot < ( BENCH_SCAN_HOLES << 1 ); slot++)
+    {
+        t->sizes[slot] = ( 0 == ( slot & 1 ) ) ? BENCH_CHURN_SIZE : BENCH_SCAN_SPACER;
+        t->slots[slot] = bench_alloc(t, t->sizes[slot]);
+        if( NULL != t->slots[slot] )
+        {
+            bench_track(t, t->sizes[slot], 0);
+        }
+    }
+    for(slot = 0; slot < ( BENCH_SCAN_HOLES << 1 ); slot += 2)
+    {
+        if( NULL != t->slots[slot] )
+        {
+            bench_release(t, t->slots[slot]);
+            bench_track(t, 0, t->sizes[slot]);
+            t->slots[slot] = NULL;
+        }
+    }
+
+    for(i = 0; i < bench_cfg.nOps; i++)
+    {
+        addr = bench_alloc(t, BENCH_CHURN_SIZE << 1);
+        if( NULL != addr )
+        {
+            bench_release(t, addr);
+        }
+    }
+    bench_phaseEnd(t);
+    bench_freeSlots(t, BENCH_SCAN_HOLES << 1);
+}
+
+static const bench_workload_t bench_workloads[] =
+{
+    { "churn",    bench_churn    },
+    { "random",   bench_random   },
+    { "prodcons", bench_prodcons },
+    { "realloc",  bench_realloc  },
+    { "aging",    bench_aging    },
+    { "scan",     bench_scan     },
+};
+
+#define BENCH_N_WORKLOADS ( sizeof( bench_workloads ) / sizeof( bench_workloads[0] ) )
+
+static void* bench_thread(void *arg)
+{
+    bench_thread_t *t = arg;
+
+    /* The first thread of each heap owns it, frees from the other threads go remote. */
+    if( bench_cfg.useEmh && ( t->idx < bench_cfg.nHeaps ) )
+    {
+        emh_set_owner(bench_heaps[t->heap]);
+    }
+
+    pthread_barrier_wait(&bench_barrier);
+    if( 0 == t->idx )
+    {
+        bench_t0 = bench_now();
+    }
+    bench_workload->run(t);
+
+#if defined(EMH_MALLOC_USE_TCACHE)
+    if( bench_cfg.useEmh )
+    {
+        emh_tcache_flush();
+    }
+#endif /* EMH_MALLOC_USE_TCACHE */
+    return NULL;
+}
+
+/* Reads a "Name:   value kB" line of /proc/self/status, in kB. */
+static size_t bench_procStatus(const char *key)
+{
+    char   line[256];
+    size_t value = 0;
+    size_t keyLen = strlen(key);
+    FILE   *file = fopen("/proc/self/status", "r");
+
+    if( NULL == file )
+    {
+        return 0;
+    }
+    while( NULL != fgets(line, sizeof( line ), file) )
+    {
+        if( 0 == strncmp(line, key, keyLen) )
+        {
+            value = (size_t) strtoull(line + keyLen, NULL, 10);
+            break;
+        }
+    }
+    fclose(file);
+    return value;
+}
+
+static int bench_cmpU32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t*) a;
+    uint32_t y = *(const uint32_t*) b;
+    return ( x > y ) - ( x < y );
+}
+
+/* Merges the samples of every thread and prints the p50/p99/p999 latencies in ns. */
+static void bench_printLatency(bench_thread_t *threads, int kind)
+{
+    uint32_t *all;
+    size_t   n = 0, i;
+    int      th;
+
+    for(th = 0; th < bench_cfg.nThreads; th++)
+    {
+        n += threads[th].nLat[kind];
+    }
+    if( 0 == n )
+    {
+        printf(" %7s %7s %7s", "-", "-", "-");
+        return;
+    }
+
+    all = malloc(n * sizeof( uint32_t ));
+    n   = 0;
+    for(th = 0; th < bench_cfg.nThreads; th++)
+    {
+        memcpy(&all[n], threads[th].lat[kind], threads[th].nLat[kind] * sizeof( uint32_t ));
+        n += threads[th].nLat[kind];
+    }
+    qsort(all, n, sizeof( uint32_t ), bench_cmpU32);
+
+    i = ( ( n - 1 ) * 500 ) / 1000;
+    printf(" %7u", all[i]);
+    i = ( ( n - 1 ) * 990 ) / 1000;
+    printf(" %7u", all[i]);
+    i = ( ( n - 1 ) * 999 ) / 1000;
+    printf(" %7u", all[i]);
+    free(all);
+}
+
+/*
+ * Opens a counter of the data TLB load misses of the calling process and the
+ * threads it creates afterwards, returns -1 when performance counters are not
+ * available (perf_event_paranoid, virtual machines without a PMU).
+ */
+static int bench_tlbOpen(void)
+{
+    struct perf_event_attr attr;
+    long                   fd;
+
+    memset(&attr, 0x00, sizeof( attr ));
+    attr.type           = PERF_TYPE_HW_CACHE;
+    attr.size           = sizeof( attr );
+    attr.config         = PERF_COUNT_HW_CACHE_DTLB | ( PERF_COUNT_HW_CACHE_OP_READ << 8 ) | ( PERF_COUNT_HW_CACHE_RESULT_MISS << 16 );
+    attr.disabled       = 1;
+    attr.inherit        = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv     = 1;
+    fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    return ( 0 > fd ) ? -1 : (int) fd;
+}
+
+/* Runs one configuration, meant to be called on a freshly forked process. */
+static int bench_run(const bench_workload_t *workload)
+{
+    bench_thread_t *threads;
+    size_t         rssBefore, rssPeak, peakLive = 0, ops = 0, fails = 0;
+    uint64_t       tlbMisses = 0;
+    double         seconds;
+    int            th, kind, heap, tlbFd;
+
+    threads = calloc((size_t) bench_cfg.nThreads, sizeof( bench_thread_t ));
+    bench_queues = aligned_alloc(64, (size_t) bench_cfg.nThreads * sizeof( bench_queue_t ));
+    if( ( NULL == threads ) || ( NULL == bench_queues ) )
+    {
+        return -1;
+    }
+    memset(bench_queues, 0x00, (size_t) bench_cfg.nThreads * sizeof( bench_queue_t ));
+
+    if( bench_cfg.useEmh )
+    {
+        for(heap = 0; heap < bench_cfg.nHeaps; heap++)
+        {
+            void *region;
+
+            if( 0 != bench_cfg.hugePages )
+            {
+                bench_heaps[heap] = emh_create_huge(bench_cfg.heapSize, bench_cfg.engine);
+                if( 0 > bench_heaps[heap] )
+                {
+                    return -1;
+                }
+                continue;
+            }
+
+            region = mmap(NULL, bench_cfg.heapSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+            if( MAP_FAILED == region )
+            {
+                return -1;
+            }
+            bench_heaps[heap] = emh_create_ex(region, bench_cfg.heapSize, bench_cfg.engine);
+            if( 0 > bench_heaps[heap] )
+            {
+                return -1;
+            }
+        }
+
+        /* CPUs are spread round-robin over the heaps, emh_malloc_local picks the heap. */
+        if( 0 != bench_cfg.localHeaps )
+        {
+            long cpu, nCpus = sysconf(_SC_NPROCESSORS_CONF);
+
+            for(cpu = 0; ( cpu < nCpus ) && ( cpu < EMH_MALLOC_MAX_CPUS ); cpu++)
+            {
+                emh_set_local((int) cpu, bench_heaps[cpu % bench_cfg.nHeaps]);
+            }
+            emh_set_local(-1, bench_heaps[0]);
+        }
+    }
+
+    for(th = 0; th < bench_cfg.nThreads; th++)
+    {
+        bench_thread_t *t = &threads[th];
+        t->idx    = th;
+        t->heap   = th % bench_cfg.nHeaps;
+        t->rng    = 0x9E3779B97F4A7C15ULL * (uint64_t)( th + 1 );
+        t->latCap = ( bench_cfg.nOps / bench_cfg.latPeriod ) + BENCH_AGING_WINDOW + 1;
+        for(kind = 0; kind < BENCH_LAT_KINDS; kind++)
+        {
+            t->lat[kind] = calloc(t->latCap, sizeof( uint32_t ));
+        }
+        t->slots = calloc(BENCH_AGING_WINDOW, sizeof( void* ));
+        t->sizes = calloc(BENCH_AGING_WINDOW, sizeof( size_t ));
+    }
+    bench_workload = workload;
+
+    rssBefore = bench_procStatus("VmRSS:");
+    tlbFd     = bench_tlbOpen();
+    if( 0 <= tlbFd )
+    {
+        ioctl(tlbFd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+    pthread_barrier_init(&bench_barrier, NULL, (unsigned int) bench_cfg.nThreads);
+    for(th = 0; th < bench_cfg.nThreads; th++)
+    {
+        pthread_create(&threads[th].thread, NULL, bench_thread, &threads[th]);
+    }
+    for(th = 0; th < bench_cfg.nThreads; th++)
+    {
+        pthread_join(threads[th].thread, NULL);
+        ops      += threads[th].ops;
+        fails    += threads[th].fails;
+        peakLive += threads[th].peakLive;
+    }
+    if( ( 0 <= tlbFd ) && ( sizeof( tlbMisses ) != read(tlbFd, &tlbMisses, sizeof( tlbMisses )) ) )
+    {
+        close(tlbFd);
+        tlbFd = -1;
+    }
+    rssPeak = bench_procStatus("VmHWM:");
+    seconds = (double)( bench_t1 - bench_t0 ) / 1e9;
+
+    printf("%-5s %-8s %3d %3d %9.2f", bench_cfg.useEmh ? "emh" : "libc", workload->name, bench_cfg.nThreads, bench_cfg.useEmh ? bench_cfg.nHeaps : 0, (double) ops / seconds / 1e6);
+    for(kind = 0; kind < BENCH_LAT_KINDS; kind++)
+    {
+        bench_printLatency(threads, kind);
+    }
+    printf(" %9.1f %9.1f %7.2f", (double)( rssPeak - rssBefore ) / 1024.0, (double) peakLive / 1048576.0, ( 0 != peakLive ) ? ( (double)( rssPeak - rssBefore ) * 1024.0 ) / (double) peakLive : 0.0);
+    if( bench_cfg.useEmh )
+    {
+        printf(" %6u", bench_frag);
+    }
+    else
+    {
+        printf(" %6s", "-");
+    }
+    if( 0 <= tlbFd )
+    {
+        printf(" %8.3f", (double) tlbMisses / (double) ops);
+        close(tlbFd);
+    }
+    else
+    {
+        printf(" %8s", "-");
+    }
+    printf(" %zu\n", fails);
+    fflush(stdout);
+    return 0;
+}
+
+static void bench_usage(const char *prog)
+{
+    fprintf(stderr,
+        "usage: %s [-a emh|libc|both] [-e first|tlsf|tags|compact] [-P first|next|best|split]\n"
+        "          [-w workload|all]"
+        " [-t max threads] [-H max heaps] [-n ops per thread]\n"
+        "          [-s heap size in MiB] [-p latency sampling period] [-g] [-R] [-L] [-C]\n"
+        "          [-S heap profiler sampling rate in bytes]\n"
+        "workloads: churn random prodcons realloc aging scan\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+    const char *alloc    = "both";
+    const char *engine   = "first";
+    const char *policy   = "first";
+    const char *wlName   = "all";
+    int        maxThreads = 4;
+    int        maxHeaps   = 4;
+    int        growable   = 0;
+    int        release    = 0;
+    int        opt, pass, threads, heaps;
+    size_t     w;
+
+    bench_cfg.nOps      = 200000;
+    bench_cfg.heapSize  = (size_t) 256 << 20;
+    bench_cfg.latPeriod = 1;
+
+    while( -1 != ( opt = getopt(argc, argv, "a:e:P:w:t:H:n:s:p:gRLCS:h") ) )
+    {
+        switch( opt )
+        {
+            case 'a': alloc      = optarg; break;
+            case 'e': engine     = optarg; break;
+            case 'P': policy     = optarg; break;
+            case 'w': wlName     = optarg; break;
+            case 't': maxThreads = atoi(optarg); break;
+            case 'H': maxHeaps   = atoi(optarg); break;
+            case 'n': bench_cfg.nOps      = (size_t) strtoull(optarg, NULL, 10); break;
+            case 's': bench_cfg.heapSize  = (size_t) strtoull(optarg, NULL, 10) << 20; break;
+            case 'p': bench_cfg.latPeriod = (unsigned int) atoi(optarg); break;
+            case 'g': growable   = 1; break;
+            case 'R': release    = 1; break;
+            case 'L': bench_cfg.hugePages = 1; break;
+            case 'C': bench_cfg.localHeaps = 1; break;
+#if defined(EMH_MALLOC_USE_PROFILE)
+            case 'S': emh_profile_set_rate((size_t) strtoull(optarg, NULL, 10)); break;
+#endif /* EMH_MALLOC_USE_PROFILE */
+            default:  bench_usage(argv[0]); return 1;
+        }
+    }
+
+    if( 0 == strcmp(engine, "tlsf") )
+    {
+        bench_cfg.engine = EMH_HEAP_TLSF;
+    }
+    else if( 0 == strcmp(engine, "tags") )
+    {
+        bench_cfg.engine = EMH_HEAP_FIRST_FIT | EMH_HEAP_BOUNDARY_TAGS;
+    }
+    else if( 0 == strcmp(engine, "compact") )
+    {
+        bench_cfg.engine = EMH_HEAP_COMPACT;
+    }
+    else
+    {
+        bench_cfg.engine = EMH_HEAP_FIRST_FIT;
+    }
+
+    /* Placement policies only apply to the first-fit engine. */
+    if( 0 == strcmp(policy, "next") )
+    {
+        bench_cfg.engine |= EMH_HEAP_POLICY_NEXT;
+    }
+    else if( 0 == strcmp(policy, "best") )
+    {
+        bench_cfg.engine |= EMH_HEAP_POLICY_BEST;
+    }
+    else if( 0 == strcmp(policy, "split") )
+    {
+        bench_cfg.engine |= EMH_HEAP_POLICY_SPLIT;
+    }
+    /* Growable heaps start with -s MiB and map more regions on demand. */
+    if( 0 != growable )
+    {
+        bench_cfg.engine |= EMH_HEAP_GROWABLE;
+    }
+
+    /* Free pages go back to the OS, large blocks get their own mapping. */
+    if( 0 != release )
+    {
+        bench_cfg.engine |= EMH_HEAP_PURGE | EMH_HEAP_DIRECT_MAP;
+    }
+
+    if( ( 1 > maxThreads ) || ( BENCH_MAX_THREADS < maxThreads ) || ( 1 > maxHeaps ) || ( 0 == bench_cfg.latPeriod ) || ( 0 == bench_cfg.nOps ) )
+    {
+        bench_usage(argv[0]);
+        return 1;
+    }
+    if( EMH_MALLOC_N_HEAPS < maxHeaps )
+    {
+        maxHeaps = EMH_MALLOC_N_HEAPS;
+    }
+
+    printf("# engine %s, policy %s, %zu ops per thread, latencies in ns, memory in MiB\n", engine, policy, bench_cfg.nOps);
+    printf("%-5s %-8s %3s %3s %9s %7s %7s %7s %7s %7s %7s %7s %7s %7s %9s %9s %7s %6s %8s %s\n",
+           "alloc", "workload", "thr", "hp", "Mops/s",
+           "m.p50", "m.p99", "m.p999", "f.p50", "f.p99", "f.p999", "r.p50", "r.p99", "r.p999",
+           "rss", "live", "rss/lv", "frag", "dtlb/op", "fails");
+
+    for(w = 0; w < BENCH_N_WORKLOADS; w++)
+    {
+        if( ( 0 != strcmp(wlName, "all") ) && ( 0 != strcmp(wlName, bench_workloads[w].name) ) )
+        {
+            continue;
+        }
+        for(pass = 0; pass < 2; pass++)
+        {
+            bench_cfg.useEmh = ( 0 == pass );
+            if( ( bench_cfg.useEmh && ( 0 == strcmp(alloc, "libc") ) ) || ( !bench_cfg.useEmh && ( 0 == strcmp(alloc, "emh") ) ) )
+            {
+                continue;
+            }
+            /* Powers of two up to maxThreads, plus maxThreads itself. */
+            for(threads = 1; threads <= maxThreads; threads = ( threads < maxThreads && ( threads << 1 ) > maxThreads ) ? maxThreads : threads << 1)
+            {
+                for(heaps = 1; heaps <= maxHeaps && heaps <= threads; heaps <<= 1)
+                {
+                    pid_t pid;
+                    int   status;
+
+                    bench_cfg.nThreads = threads;
+                    bench_cfg.nHeaps   = heaps;
+
+                    /* Every run gets a fresh process, so heap ids and the peak RSS start clean. */
+                    fflush(stdout);
+                    pid = fork();
+                    if( 0 == pid )
+                    {
+                        _exit(( 0 == bench_run(&bench_workloads[w]) ) ? 0 : 1);
+                    }
+                    if( ( 0 > pid ) || ( pid != waitpid(pid, &status, 0) ) || !WIFEXITED(status) || ( 0 != WEXITSTATUS(status) ) )
+                    {
+                        fprintf(stderr, "%s: run %s/%d threads/%d heaps failed\n", argv[0], bench_workloads[w].name, threads, heaps);
+                    }
+
+                    if( !bench_cfg.useEmh )
+                    {
+                        /* Heaps mean nothing to the C library. */
+                        break;
+                    }
+                }
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,100 @@
+/**
+ *  emh_malloc
+ *  Copyright (C) 2022, Antonio Vitor Grossi Bassi
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * @file    emh_portenv.h
+ * @author  Antonio Vitor Grossi Bassi (antoniovitor.gb@gmail.com)
+ * @brief   Linux/pthread port environment used by the benchmark suite.
+ *          Every heap is guarded by its own mutex, the global critical
+ *          zone only guards heap creation.
+ *
+ * @version 1.6
+ * @date    2022-10-12
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#ifndef EMH_PORTENV_H
+#define EMH_PORTENV_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <execinfo.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#if !defined(EMH_MALLOC_N_HEAPS)
+#define EMH_MALLOC_N_HEAPS        16
+#endif /* EMH_MALLOC_N_HEAPS */
+#define EMH_MALLOC_BYTE_ALIGNMENT 16
+#define EMH_MALLOC_USE_MMAP
+
+extern pthread_mutex_t emh_benchZone;
+extern pthread_mutex_t emh_benchHeapZone[EMH_MALLOC_N_HEAPS];
+
+#define __emh_thread_id__()     \
+( (size_t) pthread_self() )
+
+#define __emh_clock_ns__()      \
+emh_benchClock()
+
+/* Monotonic clock in nanoseconds, used by the trace recorder. Strict ISO C builds fall back to the C11 calendar clock. */
+static inline uint64_t emh_benchClock(void)
+{
+    struct timespec ts;
+#if defined(CLOCK_MONOTONIC)
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#else
+    timespec_get(&ts, TIME_UTC);
+#endif /* CLOCK_MONOTONIC */
+    return ( (uint64_t) ts.tv_sec * 1000000000ULL ) + (uint64_t) ts.tv_nsec;
+}
+
+#define __emh_backtrace__(frames, depth)    \
+backtrace((frames), (int)(depth))
+
+#define __emh_cpu_id__()        \
+( (unsigned int) sched_getcpu() )
+
+/* Preferred rather than strict binding (MPOL_PREFERRED), a full node falls back to the others. */
+#define __emh_bind_node__(addr, size, node)     \
+( ( (node) < ( sizeof( unsigned long ) * 8 ) ) ?  \
+  (int) syscall(SYS_mbind, (addr), (size), 1, &(unsigned long){ 1UL << (node) }, sizeof( unsigned long ) * 8 + 1, 0U) : -1 )
+
+#define __emh_create_zone__()   \
+do                              \
+{                               \
+}while(0)
+
+#define __emh_lock_zone__()     \
+pthread_mutex_lock(&emh_benchZone)
+
+#define __emh_unlock_zone__()   \
+pthread_mutex_unlock(&emh_benchZone)
+
+#define __emh_create_heap_zone__(heapId)    \
+pthread_mutex_init(&emh_benchHeapZone[(heapId)], NULL)
+
+#define __emh_lock_heap_zone__(heapId)      \
+pthread_mutex_lock(&emh_benchHeapZone[(heapId)])
+
+#define __emh_unlock_heap_zone__(heapId)    \
+pthread_mutex_unlock(&emh_benchHeapZone[(heapId)])
+
+#endif /* EMH_PORTENV_H */
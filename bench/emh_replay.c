@@ -0,0 +1,496 @@
+/**
+ *  emh_malloc
+ *  Copyright (C) 2022, Antonio Vitor Grossi Bassi
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * @file    emh_replay.c
+ * @author  Antonio Vitor Grossi Bassi (antoniovitor.gb@gmail.com)
+ * @brief   Trace replay tool. Re-executes a trace recorded with
+ *          emh_trace_open over heaps of any engine, policy and size,
+ *          in call order on a single thread, and reports the replay
+ *          time, the allocation failures and the fragmentation of
+ *          every heap.
+ *
+ * @version 1.6
+ * @date    2022-10-12
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "emh_malloc.h"
+
+pthread_mutex_t emh_benchZone = PTHREAD_MUTEX_INITIALIZER;
+pthread_mutex_t emh_benchHeapZone[EMH_MALLOC_N_HEAPS];
+
+#define REPLAY_MAX_HEAPS    128
+#define REPLAY_STATS_PERIOD 4096
+
+/*
+ * Open addressing map from the addresses of the trace to the blocks of the
+ * replay, linear probing with backward shift deletion.
+ */
+typedef struct replay_slot_t
+{
+    uint64_t        key;
+    void*           addr;
+    size_t          size;
+    int             heap;
+}replay_slot_t;
+
+typedef struct replay_heap_t
+{
+    emh_heapId_t    heapId;
+    size_t          nEvents;
+    size_t          nFailures;
+    size_t          live;
+    size_t          peakLive;
+    unsigned int    peakFrag;
+}replay_heap_t;
+
+static struct
+{
+    unsigned int    engine;
+    size_t          heapSize;
+    int             hugePages;
+}replay_cfg;
+
+static emh_traceEvent_t* replay_events;
+static replay_slot_t*   replay_map;
+static size_t           replay_mapMask;
+static replay_heap_t    replay_heaps[REPLAY_MAX_HEAPS];
+static size_t           replay_unmatched;
+
+static uint64_t replay_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ( (uint64_t) ts.tv_sec * 1000000000ULL ) + (uint64_t) ts.tv_nsec;
+}
+
+static size_t replay_hash(uint64_t key)
+{
+    key ^= key >> 33;
+    key *= 0xFF51AFD7ED558CCDULL;
+    key ^= key >> 33;
+    return (size_t) key & replay_mapMask;
+}
+
+/*
+ * Maps a block of the trace to its replay block. A key already mapped is not
+ * replaced: timestamps are taken outside the heap locks, so a thread may log
+ * getting a block back just before the owner logs freeing it. Entries of a key
+ * stay in insertion order along the probe sequence and the oldest goes first.
+ */
+static void replay_mapPut(uint64_t key, void *addr, size_t size, int heap)
+{
+    size_t idx = replay_hash(key);
+
+    while( 0 != replay_map[idx].key )
+    {
+        idx = ( idx + 1 ) & replay_mapMask;
+    }
+    replay_map[idx].key  = key;
+    replay_map[idx].addr = addr;
+    replay_map[idx].size = size;
+    replay_map[idx].heap = heap;
+}
+
+/* Removes the oldest entry of the key and returns it, its block is NULL if the key is not mapped. */
+static replay_slot_t replay_mapTake(uint64_t key)
+{
+    size_t        idx = replay_hash(key);
+    size_t        next, home;
+    replay_slot_t slot = { 0, NULL, 0, -1 };
+
+    while( key != replay_map[idx].key )
+    {
+        if( 0 == replay_map[idx].key )
+        {
+            return slot;
+        }
+        idx = ( idx + 1 ) & replay_mapMask;
+    }
+    slot = replay_map[idx];
+
+    /* Shift back the entries of the cluster that may no longer be reached. */
+    for(next = ( idx + 1 ) & replay_mapMask; 0 != replay_map[next].key; next = ( next + 1 ) & replay_mapMask)
+    {
+        home = replay_hash(replay_map[next].key);
+        if( ( ( next - home ) & replay_mapMask ) >= ( ( next - idx ) & replay_mapMask ) )
+        {
+            replay_map[idx] = replay_map[next];
+            idx = next;
+        }
+    }
+    replay_map[idx].key  = 0;
+    replay_map[idx].addr = NULL;
+    return slot;
+}
+
+/* Returns the replay heap standing for a heap of the trace, creating it on first use. */
+static replay_heap_t* replay_heapOf(int16_t traceHeap)
+{
+    replay_heap_t *heap;
+    void          *region;
+
+    if( 0 > traceHeap )
+    {
+        return NULL;
+    }
+    if( REPLAY_MAX_HEAPS <= traceHeap )
+    {
+        fprintf(stderr, "replay: trace heap %d is beyond the %d heaps replayed\n", traceHeap, REPLAY_MAX_HEAPS);
+        exit(1);
+    }
+    heap = &replay_heaps[traceHeap];
+    if( 0 <= heap->heapId )
+    {
+        return heap;
+    }
+
+    if( 0 != replay_cfg.hugePages )
+    {
+        heap->heapId = emh_create_huge(replay_cfg.heapSize, replay_cfg.engine);
+    }
+    else
+    {
+        region = mmap(NULL, replay_cfg.heapSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if( MAP_FAILED != region )
+        {
+            heap->heapId = emh_create_ex(region, replay_cfg.heapSize, replay_cfg.engine | EMH_HEAP_ZEROED);
+        }
+    }
+    if( 0 > heap->heapId )
+    {
+        fprintf(stderr, "replay: could not create a heap for trace heap %d\n", traceHeap);
+        exit(1);
+    }
+    return heap;
+}
+
+/*
+ * Orders event indexes by the time the calls returned, so a block is always
+ * released before another thread gets it back, even when that thread entered
+ * emh_malloc first. Events returning at the same time keep their file order.
+ */
+static int replay_cmpEvent(const void *a, const void *b)
+{
+    size_t   i = *(const size_t*) a;
+    size_t   j = *(const size_t*) b;
+    uint64_t x = replay_events[i].time + replay_events[i].latency;
+    uint64_t y = replay_events[j].time + replay_events[j].latency;
+
+    if( x != y )
+    {
+        return ( x > y ) ? 1 : -1;
+    }
+    return ( i > j ) - ( i < j );
+}
+
+/* Reads a whole trace file, returns the number of events. */
+static size_t replay_load(const char *path, emh_traceEvent_t **events)
+{
+    emh_traceHeader_t header;
+    FILE              *file = fopen(path, "rb");
+    long              length;
+    size_t            nEvents;
+
+    if( NULL == file )
+    {
+        return 0;
+    }
+    if( ( 1 != fread(&header, sizeof( header ), 1, file) ) || ( EMH_TRACE_MAGIC != header.magic ) ||
+        ( EMH_TRACE_VERSION != header.version ) || ( sizeof( emh_traceEvent_t ) != header.eventSize ) )
+    {
+        fprintf(stderr, "replay: %s is not a trace of this emh_malloc version\n", path);
+        fclose(file);
+        return 0;
+    }
+
+    fseek(file, 0, SEEK_END);
+    length = ftell(file);
+    fseek(file, (long) sizeof( header ), SEEK_SET);
+    nEvents = ( (size_t) length - sizeof( header ) ) / sizeof( emh_traceEvent_t );
+
+    *events = malloc(( nEvents + 1 ) * sizeof( emh_traceEvent_t ));
+    if( ( NULL == *events ) || ( nEvents != fread(*events, sizeof( emh_traceEvent_t ), nEvents, file) ) )
+    {
+        fclose(file);
+        return 0;
+    }
+    fclose(file);
+    return nEvents;
+}
+
+/* Samples the fragmentation of a heap, keeping the worst value seen while the heap is in use. */
+static void replay_sample(replay_heap_t *heap)
+{
+    emh_heapStats_t stats;
+
+    if( ( 0 <= heap->heapId ) && ( 0 == emh_get_stats(heap->heapId, &stats) ) && ( stats.fragmentation > heap->peakFrag ) )
+    {
+        heap->peakFrag = stats.fragmentation;
+    }
+}
+
+static void replay_alloc(const emh_traceEvent_t *event)
+{
+    replay_heap_t *heap = replay_heapOf(event->heapId);
+    void          *addr;
+
+    /* Allocations that failed on the traced run are not replayed. */
+    if( ( NULL == heap ) || ( 0 == event->addr ) )
+    {
+        return;
+    }
+
+    heap->nEvents++;
+    if( EMH_TRACE_CALLOC == event->op )
+    {
+        addr = emh_calloc(heap->heapId, 1, (size_t) event->size);
+    }
+    else
+    {
+        addr = emh_malloc(heap->heapId, (size_t) event->size);
+    }
+    if( NULL == addr )
+    {
+        heap->nFailures++;
+        return;
+    }
+
+    heap->live += (size_t) event->size;
+    if( heap->live > heap->peakLive )
+    {
+        heap->peakLive = heap->live;
+    }
+    replay_mapPut(event->addr, addr, (size_t) event->size, event->heapId);
+    if( 0 == ( heap->nEvents % REPLAY_STATS_PERIOD ) )
+    {
+        replay_sample(heap);
+    }
+}
+
+/* Releases the replay block standing for a block of the trace. */
+static void replay_releaseKey(uint64_t key)
+{
+    replay_slot_t slot = replay_mapTake(key);
+
+    if( NULL == slot.addr )
+    {
+        /* Blocks from untraced entry points, from failed replays or from before the trace. */
+        replay_unmatched++;
+        return;
+    }
+    replay_heaps[slot.heap].live -= slot.size;
+    emh_free(slot.addr);
+}
+
+static void replay_release(const emh_traceEvent_t *event)
+{
+    if( 0 != event->addr )
+    {
+        replay_releaseKey(event->addr);
+    }
+}
+
+static void replay_resize(const emh_traceEvent_t *event)
+{
+    replay_slot_t slot;
+    replay_heap_t *heap;
+    void          *newAddr;
+
+    /* Reallocations to a size of zero free the block, a failed one leaves it in place. */
+    if( ( 0 == event->prev ) || ( ( 0 != event->size ) && ( 0 == event->addr ) ) )
+    {
+        return;
+    }
+    if( 0 == event->size )
+    {
+        replay_releaseKey(event->prev);
+        return;
+    }
+
+    slot = replay_mapTake(event->prev);
+    if( NULL == slot.addr )
+    {
+        replay_unmatched++;
+        return;
+    }
+    heap = &replay_heaps[slot.heap];
+    heap->nEvents++;
+    newAddr = emh_realloc(slot.addr, (size_t) event->size);
+    if( NULL == newAddr )
+    {
+        heap->nFailures++;
+        replay_mapPut(event->addr, slot.addr, slot.size, slot.heap);
+        return;
+    }
+
+    heap->live += (size_t) event->size - slot.size;
+    if( heap->live > heap->peakLive )
+    {
+        heap->peakLive = heap->live;
+    }
+    replay_mapPut(event->addr, newAddr, (size_t) event->size, slot.heap);
+}
+
+static void replay_usage(const char *prog)
+{
+    fprintf(stderr,
+        "usage: %s [-e first|tlsf|tags|compact] [-P first|next|best|split]\n"
+        "          [-s heap size in MiB] [-g] [-R] [-L] trace\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+    const char       *engine = "first";
+    const char       *policy = "first";
+    size_t           *order;
+    size_t           nEvents, i, mapSize;
+    uint64_t         t0, t1;
+    emh_heapStats_t  stats;
+    replay_heap_t    *heap;
+    int              opt, idx;
+
+    replay_cfg.heapSize = (size_t) 256 << 20;
+    while( -1 != ( opt = getopt(argc, argv, "e:P:s:gRLh") ) )
+    {
+        switch( opt )
+        {
+            case 'e': engine = optarg; break;
+            case 'P': policy = optarg; break;
+            case 's': replay_cfg.heapSize = (size_t) strtoull(optarg, NULL, 10) << 20; break;
+            case 'g': replay_cfg.engine |= EMH_HEAP_GROWABLE; break;
+            case 'R': replay_cfg.engine |= EMH_HEAP_PURGE | EMH_HEAP_DIRECT_MAP; break;
+            case 'L': replay_cfg.hugePages = 1; break;
+            default:  replay_usage(argv[0]); return 1;
+        }
+    }
+    if( ( optind >= argc ) || ( 0 == replay_cfg.heapSize ) )
+    {
+        replay_usage(argv[0]);
+        return 1;
+    }
+
+    if( 0 == strcmp(engine, "tlsf") )
+    {
+        replay_cfg.engine |= EMH_HEAP_TLSF;
+    }
+    else if( 0 == strcmp(engine, "tags") )
+    {
+        replay_cfg.engine |= EMH_HEAP_FIRST_FIT | EMH_HEAP_BOUNDARY_TAGS;
+    }
+    else if( 0 == strcmp(engine, "compact") )
+    {
+        replay_cfg.engine |= EMH_HEAP_COMPACT;
+    }
+
+    if( 0 == strcmp(policy, "next") )
+    {
+        replay_cfg.engine |= EMH_HEAP_POLICY_NEXT;
+    }
+    else if( 0 == strcmp(policy, "best") )
+    {
+        replay_cfg.engine |= EMH_HEAP_POLICY_BEST;
+    }
+    else if( 0 == strcmp(policy, "split") )
+    {
+        replay_cfg.engine |= EMH_HEAP_POLICY_SPLIT;
+    }
+
+    if( ( 0 != strcmp(policy, "first") ) && ( EMH_HEAP_FIRST_FIT != ( replay_cfg.engine & EMH_HEAP_ENGINE_MASK ) ) )
+    {
+        fprintf(stderr, "replay: placement policies only apply to the first fit engine\n");
+        return 1;
+    }
+
+    nEvents = replay_load(argv[optind], &replay_events);
+    if( 0 == nEvents )
+    {
+        fprintf(stderr, "replay: no events read from %s\n", argv[optind]);
+        return 1;
+    }
+
+    /* Rings are written per thread, put the events back in call order. */
+    order = malloc(nEvents * sizeof( size_t ));
+    if( NULL == order )
+    {
+        return 1;
+    }
+    for(i = 0; i < nEvents; i++)
+    {
+        order[i] = i;
+    }
+    qsort(order, nEvents, sizeof( size_t ), replay_cmpEvent);
+
+    /* Twice as many slots as events keeps the probe sequences short. */
+    for(mapSize = 1; mapSize < ( nEvents << 1 ); mapSize <<= 1);
+    replay_map     = calloc(mapSize, sizeof( replay_slot_t ));
+    replay_mapMask = mapSize - 1;
+    if( NULL == replay_map )
+    {
+        return 1;
+    }
+    for(idx = 0; idx < REPLAY_MAX_HEAPS; idx++)
+    {
+        replay_heaps[idx].heapId = -1;
+    }
+
+    t0 = replay_now();
+    for(i = 0; i < nEvents; i++)
+    {
+        switch( replay_events[order[i]].op )
+        {
+            case EMH_TRACE_MALLOC:
+            case EMH_TRACE_CALLOC:  replay_alloc(&replay_events[order[i]]);   break;
+            case EMH_TRACE_FREE:    replay_release(&replay_events[order[i]]); break;
+            case EMH_TRACE_REALLOC: replay_resize(&replay_events[order[i]]);  break;
+            default: break;
+        }
+    }
+    t1 = replay_now();
+
+    printf("# %zu events replayed in %.3f ms (%.2f Mops/s), %zu frees of unknown blocks, engine %s, policy %s\n",
+           nEvents, (double)( t1 - t0 ) / 1e6, (double) nEvents / ( (double)( t1 - t0 ) / 1e3 ), replay_unmatched, engine, policy);
+    printf("%4s %9s %7s %9s %9s %9s %9s %6s %6s\n", "heap", "allocs", "fails", "peak", "live", "free", "largest", "frag", "peakfr");
+    for(idx = 0; idx < REPLAY_MAX_HEAPS; idx++)
+    {
+        heap = &replay_heaps[idx];
+        if( ( 0 > heap->heapId ) || ( 0 != emh_get_stats(heap->heapId, &stats) ) )
+        {
+            continue;
+        }
+        replay_sample(heap);
+        printf("%4d %9zu %7zu %9.1f %9.1f %9.1f %9.1f %6u %6u\n", idx, heap->nEvents, heap->nFailures,
+               (double) heap->peakLive / 1048576.0, (double) stats.allocBytes / 1048576.0, (double) stats.freeBytes / 1048576.0,
+               (double) stats.largestFree / 1048576.0, stats.fragmentation, heap->peakFrag);
+    }
+    free(order);
+    free(replay_events);
+    free(replay_map);
+    return 0;
+}
@@ -0,0 +1,512 @@
+/**
+ *  emh_malloc
+ *  Copyright (C) 2022, Antonio Vitor Grossi Bassi
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * @file    emh_test.c
+ * @author  Antonio Vitor Grossi Bassi (antoniovitor.gb@gmail.com)
+ * @brief   Self-checking test program. Exercises double free rejection
+ *          on every engine, nested heaps, heap id reuse after
+ *          emh_destroy and persistent heaps attached at another
+ *          address, reports every failed check and exits with a
+ *          non-zero status if any failed.
+ *
+ * @version 1.6
+ * @date    2022-10-12
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "emh_malloc.h"
+
+pthread_mutex_t emh_benchZone = PTHREAD_MUTEX_INITIALIZER;
+pthread_mutex_t emh_benchHeapZone[EMH_MALLOC_N_HEAPS];
+
+#define TEST_REGION_SIZE    ( (size_t) 256 << 10 )
+#define TEST_PAGE_SIZE      4096
+#define TEST_FILLER_SIZE    256
+
+#define TEST_CHECK(cond)                                                        \
+do                                                                              \
+{                                                                               \
+    test_nChecks++;                                                             \
+    if( !( cond ) )                                                             \
+    {                                                                           \
+        test_nFailed++;                                                         \
+        fprintf(stderr, "%s:%d: %s: check failed: %s\n", __FILE__, __LINE__,    \
+                test_name, #cond);                                              \
+    }                                                                           \
+}while(0)
+
+static _Alignas(TEST_PAGE_SIZE) uint8_t test_region[TEST_REGION_SIZE];
+static _Alignas(TEST_PAGE_SIZE) uint8_t test_copy[TEST_REGION_SIZE];
+static _Alignas(TEST_PAGE_SIZE) uint8_t test_page[TEST_PAGE_SIZE];
+#if ( EMH_MALLOC_N_HEAPS > EMH_MALLOC_TAGGED_HEAPS )
+static _Alignas(64) uint8_t test_fillers[EMH_MALLOC_TAGGED_HEAPS + 1][TEST_FILLER_SIZE];
+#endif /* EMH_MALLOC_N_HEAPS */
+
+static const char *test_name;
+static size_t     test_nChecks;
+static size_t     test_nFailed;
+
+static emh_heapStats_t test_stats(emh_heapId_t heapId)
+{
+    emh_heapStats_t stats;
+
+    memset(&stats, 0, sizeof( stats ));
+#if defined(EMH_MALLOC_USE_TCACHE)
+    /* Blocks held by the thread cache are counted as allocated. */
+    emh_tcache_flush();
+#endif /* EMH_MALLOC_USE_TCACHE */
+    TEST_CHECK(0 == emh_get_stats(heapId, &stats));
+    return stats;
+}
+
+/*
+ * Frees a block twice, the second free must leave the heap untouched, and
+ * checks the heap never hands the block out twice afterwards.
+ */
+static void test_doubleFree(const char *name, emh_heapId_t heapId, size_t size)
+{
+    emh_heapStats_t before, after;
+    void            *a, *b, *c, *d;
+
+    test_name = name;
+    TEST_CHECK(0 <= heapId);
+    if( 0 > heapId )
+    {
+        return;
+    }
+
+    a = emh_malloc(heapId, size);
+    b = emh_malloc(heapId, size);
+    TEST_CHECK(( NULL != a ) && ( NULL != b ) && ( a != b ));
+
+    emh_free(a);
+    before = test_stats(heapId);
+    emh_free(a);
+    after  = test_stats(heapId);
+    TEST_CHECK(before.nFrees == after.nFrees);
+    TEST_CHECK(before.freeBytes == after.freeBytes);
+
+    /* Freeing the next block merges it on coalescing engines, its stale header is refused too. */
+    emh_free(b);
+    before = test_stats(heapId);
+    emh_free(b);
+    emh_free(a);
+    after  = test_stats(heapId);
+    TEST_CHECK(before.nFrees == after.nFrees);
+    TEST_CHECK(before.freeBytes == after.freeBytes);
+
+    c = emh_malloc(heapId, size);
+    d = emh_malloc(heapId, size);
+    TEST_CHECK(( NULL != c ) && ( NULL != d ) && ( c != d ));
+    emh_free(c);
+    emh_free(d);
+    after = test_stats(heapId);
+    TEST_CHECK(0 == after.allocBytes);
+    TEST_CHECK(0 == emh_destroy(heapId));
+}
+
+static void test_engines(void)
+{
+    test_doubleFree("first-fit", emh_create(test_region, TEST_REGION_SIZE), 48);
+    test_doubleFree("boundary tags", emh_create_ex(test_region, TEST_REGION_SIZE, EMH_HEAP_BOUNDARY_TAGS), 48);
+    test_doubleFree("tlsf", emh_create_ex(test_region, TEST_REGION_SIZE, EMH_HEAP_TLSF), 48);
+    test_doubleFree("pool", emh_create_pool(test_region, TEST_REGION_SIZE, 48), 48);
+    test_doubleFree("compact", emh_create_ex(test_region, TEST_REGION_SIZE, EMH_HEAP_COMPACT), 48);
+    test_doubleFree("persistent", emh_create_ex(test_region, TEST_REGION_SIZE, EMH_HEAP_COMPACT | EMH_HEAP_PERSISTENT), 48);
+}
+
+/* Frees a block and checks that the given heap counted it and the other heap, if any, did not. */
+static void test_freeTo(void *addr, emh_heapId_t heapId, emh_heapId_t otherId)
+{
+    emh_heapStats_t heap, other;
+
+    heap = test_stats(heapId);
+    if( 0 <= otherId )
+    {
+        other = test_stats(otherId);
+    }
+    emh_free(addr);
+    TEST_CHECK(( heap.nFrees + 1 ) == test_stats(heapId).nFrees);
+    if( 0 <= otherId )
+    {
+        TEST_CHECK(other.nFrees == test_stats(otherId).nFrees);
+    }
+}
+
+/*
+ * A compact heap within a block of a first-fit heap, a pool within a block of
+ * the compact heap, and two pools sharing a page. Every free must reach the
+ * innermost heap holding the block, also once the inner heaps are destroyed.
+ */
+static void test_nested(void)
+{
+    emh_heapId_t outer, middle, inner, left, right;
+    uint8_t      *outerBlock, *middleBlock, *slot, *block, *spare;
+
+    test_name = "nested";
+    outer = emh_create(test_region, TEST_REGION_SIZE);
+    TEST_CHECK(0 <= outer);
+    if( 0 > outer )
+    {
+        return;
+    }
+
+    outerBlock = emh_malloc(outer, TEST_REGION_SIZE / 2);
+    spare      = emh_malloc(outer, 64);
+    middle     = emh_create_ex(outerBlock, TEST_REGION_SIZE / 2, EMH_HEAP_COMPACT);
+    TEST_CHECK(( NULL != spare ) && ( 0 <= middle ));
+    if( 0 > middle )
+    {
+        return;
+    }
+
+    middleBlock = emh_malloc(middle, TEST_REGION_SIZE / 8);
+    block       = emh_malloc(middle, 64);
+    inner       = emh_create_pool(middleBlock, TEST_REGION_SIZE / 8, 32);
+    TEST_CHECK(( NULL != block ) && ( 0 <= inner ));
+    if( 0 > inner )
+    {
+        return;
+    }
+
+    slot = emh_malloc(inner, 32);
+    TEST_CHECK(NULL != slot);
+    test_freeTo(slot, inner, middle);
+    test_freeTo(block, middle, inner);
+    test_freeTo(spare, outer, middle);
+
+    /* Destroyed heaps give their pages back to the heap around them. */
+    TEST_CHECK(0 == emh_destroy(inner));
+    test_freeTo(middleBlock, middle, outer);
+    TEST_CHECK(0 == emh_destroy(middle));
+    test_freeTo(outerBlock, outer, -1);
+
+    left  = emh_create_pool(test_page, TEST_PAGE_SIZE / 2, 32);
+    right = emh_create_pool(test_page + ( TEST_PAGE_SIZE / 2 ), TEST_PAGE_SIZE / 2, 32);
+    TEST_CHECK(( 0 <= left ) && ( 0 <= right ));
+    if( ( 0 <= left ) && ( 0 <= right ) )
+    {
+        slot  = emh_malloc(right, 32);
+        block = emh_malloc(left, 32);
+        TEST_CHECK(( NULL != slot ) && ( NULL != block ));
+        test_freeTo(slot, right, left);
+        test_freeTo(block, left, right);
+        TEST_CHECK(0 == emh_destroy(left));
+        TEST_CHECK(0 == emh_destroy(right));
+    }
+    TEST_CHECK(0 == emh_destroy(outer));
+}
+
+#if ( EMH_MALLOC_N_HEAPS > EMH_MALLOC_TAGGED_HEAPS )
+/*
+ * Page map builds: a first-fit heap nested within a block of another heap
+ * whose id carries the same seven bits on the block links.
+ */
+static void test_nestedTag(void)
+{
+    emh_heapId_t fillers[EMH_MALLOC_TAGGED_HEAPS + 1];
+    emh_heapId_t outer, inner = -1;
+    uint8_t      *outerBlock, *block, *spare;
+    size_t       nFillers = 0, i;
+
+    test_name = "nested tag";
+    outer = emh_create(test_region, TEST_REGION_SIZE);
+    TEST_CHECK(0 <= outer);
+    if( 0 > outer )
+    {
+        return;
+    }
+    outerBlock = emh_malloc(outer, TEST_REGION_SIZE / 2);
+    spare      = emh_malloc(outer, 64);
+
+    /* Arenas on small buffers take the ids in between. */
+    while( nFillers <= EMH_MALLOC_TAGGED_HEAPS )
+    {
+        inner = emh_create(outerBlock, TEST_REGION_SIZE / 2);
+        if( ( 0 > inner ) || ( ( inner & EMH_MALLOC_HEAP_ID_BITMASK ) == ( outer & EMH_MALLOC_HEAP_ID_BITMASK ) ) )
+        {
+            break;
+        }
+        TEST_CHECK(0 == emh_destroy(inner));
+        inner = -1;
+        fillers[nFillers] = emh_create_arena(test_fillers[nFillers], TEST_FILLER_SIZE);
+        if( 0 > fillers[nFillers] )
+        {
+            break;
+        }
+        nFillers++;
+    }
+
+    TEST_CHECK(0 <= inner);
+    if( 0 <= inner )
+    {
+        block = emh_malloc(inner, 64);
+        TEST_CHECK(NULL != block);
+        test_freeTo(block, inner, outer);
+        test_freeTo(spare, outer, inner);
+        TEST_CHECK(0 == emh_destroy(inner));
+    }
+    test_freeTo(outerBlock, outer, -1);
+    for(i = 0; i < nFillers; i++)
+    {
+        TEST_CHECK(0 == emh_destroy(fillers[i]));
+    }
+    TEST_CHECK(0 == emh_destroy(outer));
+}
+#endif /* EMH_MALLOC_N_HEAPS */
+
+/* A destroyed heap id is handed out again, with clean counters and a working heap. */
+static void test_reuse(void)
+{
+    emh_heapStats_t stats;
+    emh_heapId_t    first, again;
+    void            *a, *b;
+
+    test_name = "reuse";
+    first = emh_create_ex(test_region, TEST_REGION_SIZE, EMH_HEAP_TLSF);
+    TEST_CHECK(0 <= first);
+    if( 0 > first )
+    {
+        return;
+    }
+    a = emh_malloc(first, 100);
+    TEST_CHECK(NULL != a);
+    TEST_CHECK(0 == emh_destroy(first));
+    TEST_CHECK(-1 == emh_destroy(first));
+    TEST_CHECK(NULL == emh_malloc(first, 100));
+
+    again = emh_create_pool(test_copy, TEST_REGION_SIZE, 64);
+    TEST_CHECK(first == again);
+    if( 0 > again )
+    {
+        return;
+    }
+    stats = test_stats(again);
+    TEST_CHECK(( 0 == stats.nMallocs ) && ( 0 == stats.nFrees ) && ( 0 == stats.allocBytes ));
+
+    /* A block of the destroyed heap is not a block of the new one. */
+    emh_free(a);
+    TEST_CHECK(0 == test_stats(again).nFrees);
+
+    b = emh_malloc(again, 64);
+    TEST_CHECK(( NULL != b ) && ( (uint8_t*) b >= test_copy ) && ( (uint8_t*) b < ( test_copy + TEST_REGION_SIZE ) ));
+    test_freeTo(b, again, -1);
+    TEST_CHECK(0 == emh_destroy(again));
+}
+
+#if defined(EMH_MALLOC_USE_MMAP)
+/*
+ * emh_heap_free releases blocks a compact heap maps on their own, which lie
+ * outside the heap region, as well as the blocks of the region.
+ */
+static void test_heapFree(void)
+{
+    emh_heapStats_t stats;
+    emh_heapId_t    heapId;
+    void            *large, *small;
+
+    test_name = "heap free";
+    heapId = emh_create_ex(test_region, TEST_REGION_SIZE, EMH_HEAP_COMPACT | EMH_HEAP_DIRECT_MAP);
+    TEST_CHECK(0 <= heapId);
+    if( 0 > heapId )
+    {
+        return;
+    }
+
+    large = emh_malloc(heapId, EMH_MALLOC_MMAP_THRESHOLD * 2);
+    small = emh_malloc(heapId, 64);
+    TEST_CHECK(( NULL != large ) && ( NULL != small ));
+    stats = test_stats(heapId);
+    TEST_CHECK(1 == stats.mappedBlocks);
+
+    emh_heap_free(heapId, large);
+    emh_heap_free(heapId, small);
+    stats = test_stats(heapId);
+    TEST_CHECK(( 0 == stats.mappedBlocks ) && ( 0 == stats.mappedBytes ));
+    TEST_CHECK(0 == stats.allocBytes);
+    TEST_CHECK(0 == emh_destroy(heapId));
+}
+#endif /* EMH_MALLOC_USE_MMAP */
+
+#if defined(EMH_MALLOC_USE_MMAP)
+/* Checks the first bytes of a block still hold the pattern written by test_mapRealloc. */
+static int test_pattern(const uint8_t *addr, size_t size)
+{
+    size_t i;
+
+    for(i = 0; ( i < size ) && ( (uint8_t)( i * 7 ) == addr[i] ); i++);
+    return ( i == size );
+}
+
+/*
+ * Blocks mapped on their own give their pages back when shrunk: they move into
+ * the heap below EMH_MALLOC_MMAP_THRESHOLD, or their mapping is trimmed when the
+ * heap is too small to take them.
+ */
+static void test_mapRealloc(void)
+{
+    emh_heapStats_t stats;
+    emh_heapId_t    heapId, small;
+    size_t          size = EMH_MALLOC_MMAP_THRESHOLD * 16;
+    size_t          i;
+    uint8_t         *addr, *newAddr;
+
+    test_name = "mapped realloc";
+    heapId = emh_create_ex(test_region, TEST_REGION_SIZE, EMH_HEAP_DIRECT_MAP);
+    small  = emh_create_ex(test_page, TEST_PAGE_SIZE, EMH_HEAP_DIRECT_MAP);
+    TEST_CHECK(( 0 <= heapId ) && ( 0 <= small ));
+    if( ( 0 > heapId ) || ( 0 > small ) )
+    {
+        return;
+    }
+
+    addr = emh_malloc(heapId, size);
+    TEST_CHECK(NULL != addr);
+    for(i = 0; ( NULL != addr ) && ( i < size ); i++)
+    {
+        addr[i] = (uint8_t)( i * 7 );
+    }
+    TEST_CHECK(test_stats(heapId).mappedBytes > size);
+
+    newAddr = emh_realloc(addr, size / 4);
+    stats   = test_stats(heapId);
+    TEST_CHECK(( addr == newAddr ) && ( 1 == stats.mappedBlocks ));
+    TEST_CHECK(( stats.mappedBytes > ( size / 4 ) ) && ( stats.mappedBytes < ( ( size / 4 ) + EMH_MALLOC_MMAP_THRESHOLD ) ));
+    TEST_CHECK(test_pattern(newAddr, size / 4));
+
+    newAddr = emh_realloc(newAddr, 100);
+    stats   = test_stats(heapId);
+    TEST_CHECK(( newAddr >= test_region ) && ( newAddr < ( test_region + TEST_REGION_SIZE ) ));
+    TEST_CHECK(( 0 == stats.mappedBlocks ) && ( 0 == stats.mappedBytes ));
+    TEST_CHECK(test_pattern(newAddr, 100));
+    emh_free(newAddr);
+
+    addr = emh_malloc(small, size);
+    TEST_CHECK(NULL != addr);
+    for(i = 0; ( NULL != addr ) && ( i < TEST_PAGE_SIZE * 2 ); i++)
+    {
+        addr[i] = (uint8_t)( i * 7 );
+    }
+    newAddr = emh_realloc(addr, TEST_PAGE_SIZE * 2);
+    stats   = test_stats(small);
+    TEST_CHECK(( addr == newAddr ) && ( 1 == stats.mappedBlocks ) && ( stats.mappedBytes < EMH_MALLOC_MMAP_THRESHOLD ));
+    TEST_CHECK(test_pattern(newAddr, TEST_PAGE_SIZE * 2));
+    emh_free(newAddr);
+    TEST_CHECK(0 == test_stats(small).mappedBlocks);
+
+    TEST_CHECK(0 == emh_destroy(small));
+    TEST_CHECK(0 == emh_destroy(heapId));
+}
+#endif /* EMH_MALLOC_USE_MMAP */
+
+/* A persistent heap is destroyed, copied to another address and attached there. */
+static void test_attach(void)
+{
+    emh_heapStats_t before, after;
+    emh_heapId_t    heapId;
+    uint32_t        *root, *data;
+    uint8_t         *hole;
+    size_t          rootOff, i;
+
+    test_name = "attach";
+    heapId = emh_create_ex(test_region, TEST_REGION_SIZE, EMH_HEAP_COMPACT | EMH_HEAP_PERSISTENT);
+    TEST_CHECK(0 <= heapId);
+    if( 0 > heapId )
+    {
+        return;
+    }
+
+    root = emh_malloc(heapId, 4 * sizeof( uint32_t ));
+    hole = emh_malloc(heapId, 200);
+    data = emh_malloc(heapId, 1000 * sizeof( uint32_t ));
+    TEST_CHECK(( NULL != root ) && ( NULL != hole ) && ( NULL != data ));
+    if( ( NULL == root ) || ( NULL == data ) )
+    {
+        return;
+    }
+    emh_free(hole);
+
+    /* Blocks refer to each other through offsets from the region. */
+    root[0] = (uint32_t)( (uint8_t*) data - test_region );
+    root[1] = 1000;
+    for(i = 0; i < 1000; i++)
+    {
+        data[i] = (uint32_t)( i * 2654435761UL );
+    }
+    TEST_CHECK(0 == emh_set_root(heapId, root));
+    TEST_CHECK(-1 == emh_set_root(heapId, (uint8_t*) root + 4));
+    rootOff = (size_t)( (uint8_t*) root - test_region );
+    before  = test_stats(heapId);
+    TEST_CHECK(0 == emh_destroy(heapId));
+
+    memcpy(test_copy, test_region, TEST_REGION_SIZE);
+    memset(test_region, 0, TEST_REGION_SIZE);
+    TEST_CHECK(-1 == emh_attach(test_region, TEST_REGION_SIZE));
+
+    heapId = emh_attach(test_copy, TEST_REGION_SIZE);
+    TEST_CHECK(0 <= heapId);
+    if( 0 > heapId )
+    {
+        return;
+    }
+    root = emh_get_root(heapId);
+    TEST_CHECK(( test_copy + rootOff ) == (uint8_t*) root);
+    TEST_CHECK(( NULL != root ) && ( 1000 == root[1] ));
+    if( NULL != root )
+    {
+        data = (uint32_t*)( test_copy + root[0] );
+        for(i = 0; ( i < 1000 ) && ( data[i] == (uint32_t)( i * 2654435761UL ) ); i++);
+        TEST_CHECK(1000 == i);
+
+        after = test_stats(heapId);
+        TEST_CHECK(before.freeBytes == after.freeBytes);
+        TEST_CHECK(before.allocBytes == after.allocBytes);
+
+        test_freeTo(data, heapId, -1);
+        emh_free(data);
+        TEST_CHECK(1 == test_stats(heapId).nFrees);
+    }
+    TEST_CHECK(0 == emh_destroy(heapId));
+}
+
+int main(void)
+{
+    test_engines();
+    test_nested();
+#if ( EMH_MALLOC_N_HEAPS > EMH_MALLOC_TAGGED_HEAPS )
+    test_nestedTag();
+#endif /* EMH_MALLOC_N_HEAPS */
+    test_reuse();
+#if defined(EMH_MALLOC_USE_MMAP)
+    test_heapFree();
+    test_mapRealloc();
+#endif /* EMH_MALLOC_USE_MMAP */
+    test_attach();
+
+    printf("emh_test: %zu checks, %zu failed (%d heaps%s)\n", test_nChecks, test_nFailed, EMH_MALLOC_N_HEAPS,
+           ( EMH_MALLOC_N_HEAPS > EMH_MALLOC_TAGGED_HEAPS ) ? ", page map" : "");
+    return ( 0 == test_nFailed ) ? 0 : 1;
+}
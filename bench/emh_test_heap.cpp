@@ -0,0 +1,196 @@
+/**
+ *  emh_malloc
+ *  Copyright (C) 2022, Antonio Vitor Grossi Bassi
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * @file    emh_test_heap.cpp
+ * @author  Antonio Vitor Grossi Bassi (antoniovitor.gb@gmail.com)
+ * @brief   Self-checking test program of emh::basic_heap. Exercises
+ *          coalescing, double deallocation, placement policies, size
+ *          classes and heap_allocator, reports every failed check and
+ *          exits with a non-zero status if any failed.
+ *
+ * @version 1.6
+ * @date    2022-10-13
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include <cstdio>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "emh_heap.hpp"
+
+#define TEST_CHECK(cond)                                                        \
+do                                                                              \
+{                                                                               \
+    test_nChecks++;                                                             \
+    if( !( cond ) )                                                             \
+    {                                                                           \
+        test_nFailed++;                                                         \
+        std::fprintf(stderr, "%s:%d: %s: check failed: %s\n", __FILE__,         \
+                     __LINE__, test_name, #cond);                               \
+    }                                                                           \
+}while(0)
+
+static constexpr std::size_t test_region_size = 64 << 10;
+
+alignas(64) static std::uint8_t test_region[test_region_size];
+
+static const char  *test_name;
+static std::size_t test_nChecks;
+static std::size_t test_nFailed;
+
+/*
+ * Frees three neighbouring blocks in an order that merges on both sides, the
+ * heap must end up as a single free block able to serve nearly the whole region.
+ */
+static void test_coalesce()
+{
+    emh::basic_heap<16> heap(test_region, test_region_size);
+    std::size_t         full;
+    void                *a, *b, *c, *whole;
+
+    test_name = "coalesce";
+    TEST_CHECK(static_cast<bool>(heap));
+    full = heap.free_bytes();
+
+    a = heap.allocate(1000);
+    b = heap.allocate(1000);
+    c = heap.allocate(1000);
+    TEST_CHECK(( nullptr != a ) && ( nullptr != b ) && ( nullptr != c ));
+    TEST_CHECK(heap.free_bytes() < full);
+    TEST_CHECK(nullptr == heap.allocate(full));
+
+    heap.deallocate(b);
+    heap.deallocate(a);
+    heap.deallocate(c);
+    TEST_CHECK(full == heap.free_bytes());
+
+    /* Only a merged block fits a request this large. */
+    whole = heap.allocate(full - ( 2 * decltype(heap)::alignment ));
+    TEST_CHECK(a == whole);
+    heap.deallocate(whole);
+    TEST_CHECK(full == heap.free_bytes());
+}
+
+/* Blocks already free and addresses beyond the region are ignored. */
+static void test_doubleFree()
+{
+    emh::basic_heap<16> heap(test_region, test_region_size);
+    std::size_t         freeBytes;
+    void                *a, *b;
+
+    test_name = "double free";
+    a = heap.allocate(200);
+    b = heap.allocate(200);
+    heap.deallocate(a);
+    freeBytes = heap.free_bytes();
+    heap.deallocate(a);
+    heap.deallocate(static_cast<std::uint8_t*>(b) + 16);
+    heap.deallocate(test_region + test_region_size);
+    TEST_CHECK(freeBytes == heap.free_bytes());
+
+    /* b merges into a, the stale header of b is refused. */
+    heap.deallocate(b);
+    freeBytes = heap.free_bytes();
+    heap.deallocate(b);
+    TEST_CHECK(freeBytes == heap.free_bytes());
+    TEST_CHECK(heap.allocate(200) != heap.allocate(200));
+}
+
+/* Best fit takes the smallest hole, first fit the lowest one. */
+static void test_placement()
+{
+    emh::basic_heap<16, std::mutex, emh::best_fit> best(test_region, test_region_size / 2);
+    emh::basic_heap<16, std::mutex, emh::first_fit> first(test_region + ( test_region_size / 2 ), test_region_size / 2);
+    void *large, *small;
+
+    test_name = "placement";
+    large = best.allocate(2000);
+    (void) best.allocate(64);
+    small = best.allocate(500);
+    (void) best.allocate(64);
+    best.deallocate(large);
+    best.deallocate(small);
+    TEST_CHECK(small == best.allocate(400));
+
+    large = first.allocate(2000);
+    (void) first.allocate(64);
+    small = first.allocate(500);
+    (void) first.allocate(64);
+    first.deallocate(large);
+    first.deallocate(small);
+    TEST_CHECK(large == first.allocate(400));
+}
+
+/* Size classes recycle their blocks without merging them until reset. */
+static void test_classes()
+{
+    emh::basic_heap<16, emh::no_lock, emh::first_fit, 16, 32, 64> heap(test_region, test_region_size);
+    std::size_t full = heap.free_bytes();
+    void        *a, *b;
+
+    test_name = "size classes";
+    a = heap.allocate(20);
+    b = heap.allocate(20);
+    heap.deallocate(a);
+    TEST_CHECK(a == heap.allocate(24));
+    heap.deallocate(a);
+    heap.deallocate(b);
+    TEST_CHECK(full == heap.free_bytes());
+    TEST_CHECK(nullptr == heap.allocate(full - 32));
+
+    heap.reset();
+    TEST_CHECK(full == heap.free_bytes());
+    TEST_CHECK(nullptr != heap.allocate(full - 32));
+}
+
+/* A vector grown through heap_allocator gives every block back to the heap. */
+static void test_allocator()
+{
+    typedef emh::basic_heap<16> heap_t;
+
+    heap_t      heap(test_region, test_region_size);
+    std::size_t full = heap.free_bytes();
+
+    test_name = "allocator";
+    {
+        std::vector<std::uint64_t, emh::heap_allocator<std::uint64_t, heap_t>> values{emh::heap_allocator<std::uint64_t, heap_t>(heap)};
+
+        for(std::uint64_t idx = 0; idx < 1000; idx++)
+        {
+            values.push_back(idx);
+        }
+        TEST_CHECK(( 1000 == values.size() ) && ( 999 == values.back() ));
+        TEST_CHECK(heap.free_bytes() < full);
+    }
+    TEST_CHECK(full == heap.free_bytes());
+}
+
+int main()
+{
+    test_coalesce();
+    test_doubleFree();
+    test_placement();
+    test_classes();
+    test_allocator();
+
+    std::printf("emh_test_heap: %zu checks, %zu failed\n", test_nChecks, test_nFailed);
+    return ( 0 == test_nFailed ) ? 0 : 1;
+}
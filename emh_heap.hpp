@@ -0,0 +1,499 @@
+/**
+ *  emh_malloc
+ *  Copyright (C) 2022, Antonio Vitor Grossi Bassi
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * @file    emh_heap.hpp
+ * @author  Antonio Vitor Grossi Bassi (antoniovitor.gb@gmail.com)
+ * @brief   Header-only heaps for C++17. emh::basic_heap takes its alignment,
+ *          locking, placement policy and size classes as template arguments,
+ *          so heaps configured differently live side by side in one binary,
+ *          apart from the heap links of emh_malloc.c.
+ *
+ * @version 1.6
+ * @date    2022-10-13
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#ifndef EMH_HEAP_HPP
+#define EMH_HEAP_HPP
+
+#if ( __cplusplus < 201703L )
+#error emh_malloc: ERROR! emh_heap.hpp requires C++17.
+#endif /* __cplusplus */
+
+#include <array>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+
+#include "emh_malloc.h"
+
+namespace emh
+{
+
+/**
+ * @brief Lock policy of heaps used by a single thread, every lock is compiled out.
+ *        Any other type providing lock() and unlock(), such as std::mutex, guards
+ *        the heap with one of its objects.
+ */
+struct no_lock
+{
+    void lock() noexcept {}
+    void unlock() noexcept {}
+};
+
+/**
+ * @brief Placement policies: the lowest free block that fits, or the smallest one.
+ */
+struct first_fit {};
+struct best_fit {};
+
+/**
+ * @brief Heap laid over a region given at construction, using the block format of
+ *        the first-fit engine: every block starts with an emh_blockLink_t holding its
+ *        size, allocated bit and heap id, free blocks are kept in address order and
+ *        merged with their free neighbours. Blocks carry the heap id
+ *        EMH_MALLOC_HEAP_ID_BITMASK, whose bits no heap id handed out by emh_create
+ *        ends with, so emh_free refuses them.
+ *
+ *        Requests of up to one of SizeClasses bytes are rounded up to the smallest
+ *        such class and recycled on a free list of that class, without searching nor
+ *        merging. Blocks of a class stay on its list until the heap is reset.
+ *
+ * @tparam Alignment   Alignment of every block, a power of two.
+ * @tparam LockPolicy  emh::no_lock or a type providing lock() and unlock().
+ * @tparam FitPolicy   emh::first_fit or emh::best_fit.
+ * @tparam SizeClasses Payload sizes of the size classes, in increasing order.
+ */
+template <std::size_t Alignment, class LockPolicy = no_lock, class FitPolicy = first_fit, std::size_t... SizeClasses>
+class basic_heap
+{
+    static_assert(( 0 != Alignment ) && ( 0 == ( Alignment & ( Alignment - 1 ) ) ), "Alignment must be a power of two");
+    static_assert(Alignment >= alignof( emh_blockLink_t ), "Alignment must hold a block link");
+    static_assert(std::is_same<FitPolicy, first_fit>::value || std::is_same<FitPolicy, best_fit>::value, "Unknown placement policy");
+
+public:
+    static constexpr std::size_t alignment   = Alignment;
+    static constexpr std::size_t n_classes   = sizeof...( SizeClasses );
+    static constexpr bool        is_threaded = !std::is_same<LockPolicy, no_lock>::value;
+
+    /**
+     * @brief Lays the heap over a region, which must outlive the heap.
+     * @param heapAddr Start address of the heap region.
+     * @param heapSize Size of the heap region.
+     */
+    basic_heap(void *heapAddr, std::size_t heapSize) noexcept
+    {
+        std::uintptr_t first = ( reinterpret_cast<std::uintptr_t>(heapAddr) + Alignment - 1 ) & ~( Alignment - 1 );
+        std::uintptr_t last  = reinterpret_cast<std::uintptr_t>(heapAddr) + heapSize;
+
+        base_ = nullptr;
+        end_  = nullptr;
+        if( ( nullptr != heapAddr ) && ( last > first ) && ( ( ( last - first ) & ~( Alignment - 1 ) ) >= ( link_size + min_block ) ) )
+        {
+            base_ = reinterpret_cast<emh_blockLink_t*>(first);
+            end_  = reinterpret_cast<emh_blockLink_t*>(first + ( ( last - first ) & ~( Alignment - 1 ) ) - link_size);
+        }
+        init();
+    }
+
+    basic_heap(const basic_heap&) = delete;
+    basic_heap& operator=(const basic_heap&) = delete;
+
+    explicit operator bool() const noexcept
+    {
+        return nullptr != base_;
+    }
+
+    /**
+     * @brief Allocates a block of Alignment aligned memory.
+     * @param size Size of memory to be allocated.
+     * @return void* payload of the block or nullptr if the heap is exhausted.
+     */
+    void* allocate(std::size_t size) noexcept
+    {
+        guard           lock(lock_);
+        emh_blockLink_t *block = nullptr;
+        std::size_t     blockSize;
+
+        if( ( 0 == size ) || ( size > max_size ) )
+        {
+            return nullptr;
+        }
+
+        if constexpr ( 0 != n_classes )
+        {
+            std::size_t idx = class_of(size);
+
+            if( n_classes != idx )
+            {
+                block = classHeads_[idx];
+                if( nullptr != block )
+                {
+                    classHeads_[idx] = block->nextFree;
+                    block->blockSize = class_blocks[idx] | alloc_bit | heap_tag;
+                    freeBytes_      -= class_blocks[idx];
+                    return reinterpret_cast<std::uint8_t*>(block) + link_size;
+                }
+                size = class_sizes[idx];
+            }
+        }
+
+        blockSize = block_size(size);
+        block     = take(blockSize);
+        if( nullptr == block )
+        {
+            return nullptr;
+        }
+        return reinterpret_cast<std::uint8_t*>(block) + link_size;
+    }
+
+    /**
+     * @brief Returns a block to the heap, blocks of other heaps and blocks already
+     *        free are ignored.
+     * @param addr Payload of the block, nullptr is ignored.
+     */
+    void deallocate(void *addr) noexcept
+    {
+        guard           lock(lock_);
+        emh_blockLink_t *block;
+        std::size_t     blockSize;
+
+        if( !owns(addr) )
+        {
+            return;
+        }
+
+        block = reinterpret_cast<emh_blockLink_t*>(static_cast<std::uint8_t*>(addr) - link_size);
+        if( ( alloc_bit | heap_tag ) != ( block->blockSize & ~size_mask ) )
+        {
+            return;
+        }
+        blockSize        = block->blockSize & size_mask;
+        block->blockSize = blockSize;
+        freeBytes_      += blockSize;
+
+        if constexpr ( 0 != n_classes )
+        {
+            for(std::size_t idx = 0; idx < n_classes; idx++)
+            {
+                if( class_blocks[idx] == blockSize )
+                {
+                    block->nextFree  = classHeads_[idx];
+                    classHeads_[idx] = block;
+                    return;
+                }
+            }
+        }
+        link(block);
+        return;
+    }
+
+    /**
+     * @brief Releases every block at once, including the blocks kept by size classes.
+     */
+    void reset() noexcept
+    {
+        guard lock(lock_);
+
+        init();
+        return;
+    }
+
+    /**
+     * @brief Tells whether an address lies on the heap region.
+     */
+    bool owns(const void *addr) const noexcept
+    {
+        const std::uint8_t *byteAddr = static_cast<const std::uint8_t*>(addr);
+
+        return ( nullptr != base_ ) && ( byteAddr >= ( reinterpret_cast<const std::uint8_t*>(base_) + link_size ) ) &&
+               ( byteAddr < reinterpret_cast<const std::uint8_t*>(end_) );
+    }
+
+    /**
+     * @brief Returns the bytes of the free blocks, including the blocks kept by size classes.
+     */
+    std::size_t free_bytes() const noexcept
+    {
+        guard lock(lock_);
+
+        return freeBytes_;
+    }
+
+private:
+    /* Same layout as the block size of emh_malloc.c: size below the allocated bit, heap id above it. */
+    static constexpr std::size_t size_bits = ( sizeof( std::size_t ) * CHAR_BIT ) - 16;
+    static constexpr std::size_t alloc_bit = std::size_t(1) << size_bits;
+    static constexpr std::size_t size_mask = alloc_bit - 1;
+    static constexpr std::size_t heap_tag  = std::size_t(EMH_MALLOC_HEAP_ID_BITMASK) << ( size_bits + 1 );
+    static constexpr std::size_t link_size = ( sizeof( emh_blockLink_t ) + Alignment - 1 ) & ~( Alignment - 1 );
+    static constexpr std::size_t min_block = link_size << 1;
+    static constexpr std::size_t max_size  = size_mask - link_size - Alignment;
+
+    static constexpr std::size_t block_size(std::size_t size) noexcept
+    {
+        std::size_t blockSize = ( size + link_size + Alignment - 1 ) & ~( Alignment - 1 );
+
+        return ( blockSize < min_block ) ? min_block : blockSize;
+    }
+
+    static constexpr bool ascending() noexcept
+    {
+        std::size_t sizes[] = { 0, SizeClasses... };
+
+        for(std::size_t idx = 1; idx <= n_classes; idx++)
+        {
+            if( ( sizes[idx] <= sizes[idx - 1] ) || ( sizes[idx] > max_size ) )
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    static_assert(ascending(), "Size classes must be given in increasing order");
+
+    static constexpr std::array<std::size_t, n_classes> class_sizes  = {{ SizeClasses... }};
+    static constexpr std::array<std::size_t, n_classes> class_blocks = {{ block_size(SizeClasses)... }};
+
+    /* Index of the smallest class holding size, n_classes when there is none. */
+    static constexpr std::size_t class_of(std::size_t size) noexcept
+    {
+        std::size_t idx = 0;
+
+        while( ( idx < n_classes ) && ( class_sizes[idx] < size ) )
+        {
+            idx++;
+        }
+        return idx;
+    }
+
+    class guard
+    {
+    public:
+        explicit guard(LockPolicy &lock) noexcept : lock_(lock)
+        {
+            if constexpr ( is_threaded )
+            {
+                lock_.lock();
+            }
+        }
+
+        ~guard()
+        {
+            if constexpr ( is_threaded )
+            {
+                lock_.unlock();
+            }
+        }
+
+    private:
+        LockPolicy &lock_;
+    };
+
+    void init() noexcept
+    {
+        start_.blockSize = 0;
+        start_.nextFree  = end_;
+        freeBytes_       = 0;
+        classHeads_.fill(nullptr);
+        if( nullptr != base_ )
+        {
+            end_->blockSize   = 0;
+            end_->nextFree    = nullptr;
+            base_->blockSize  = static_cast<std::size_t>(reinterpret_cast<std::uint8_t*>(end_) - reinterpret_cast<std::uint8_t*>(base_));
+            base_->nextFree   = end_;
+            start_.nextFree   = base_;
+            freeBytes_        = base_->blockSize;
+        }
+        return;
+    }
+
+    /* Takes a free block of at least blockSize bytes and splits off the rest. */
+    emh_blockLink_t* take(std::size_t blockSize) noexcept
+    {
+        emh_blockLink_t *prev  = &start_;
+        emh_blockLink_t *block = nullptr;
+        emh_blockLink_t *split;
+
+        for(emh_blockLink_t *iterator = &start_; end_ != iterator->nextFree; iterator = iterator->nextFree)
+        {
+            if( iterator->nextFree->blockSize < blockSize )
+            {
+                continue;
+            }
+            if constexpr ( std::is_same<FitPolicy, first_fit>::value )
+            {
+                prev  = iterator;
+                block = iterator->nextFree;
+                break;
+            }
+            else
+            {
+                if( ( nullptr == block ) || ( iterator->nextFree->blockSize < block->blockSize ) )
+                {
+                    prev  = iterator;
+                    block = iterator->nextFree;
+                    if( blockSize == block->blockSize )
+                    {
+                        break;
+                    }
+                }
+            }
+        }
+        if( nullptr == block )
+        {
+            return nullptr;
+        }
+
+        if( ( block->blockSize - blockSize ) >= min_block )
+        {
+            split            = reinterpret_cast<emh_blockLink_t*>(reinterpret_cast<std::uint8_t*>(block) + blockSize);
+            split->blockSize = block->blockSize - blockSize;
+            split->nextFree  = block->nextFree;
+            prev->nextFree   = split;
+            block->blockSize = blockSize;
+        }
+        else
+        {
+            prev->nextFree = block->nextFree;
+        }
+        freeBytes_      -= block->blockSize;
+        block->blockSize |= alloc_bit | heap_tag;
+        block->nextFree   = nullptr;
+        return block;
+    }
+
+    /* Links a free block in address order, merging it with its free neighbours. */
+    void link(emh_blockLink_t *block) noexcept
+    {
+        emh_blockLink_t *iterator;
+
+        for(iterator = &start_; iterator->nextFree < block; iterator = iterator->nextFree);
+
+        if( ( iterator != &start_ ) && ( ( reinterpret_cast<std::uint8_t*>(iterator) + iterator->blockSize ) == reinterpret_cast<std::uint8_t*>(block) ) )
+        {
+            iterator->blockSize += block->blockSize;
+            block = iterator;
+        }
+
+        if( ( end_ != iterator->nextFree ) &&
+            ( ( reinterpret_cast<std::uint8_t*>(block) + block->blockSize ) == reinterpret_cast<std::uint8_t*>(iterator->nextFree) ) )
+        {
+            block->blockSize += iterator->nextFree->blockSize;
+            block->nextFree   = iterator->nextFree->nextFree;
+        }
+        else
+        {
+            block->nextFree = iterator->nextFree;
+        }
+
+        if( iterator != block )
+        {
+            iterator->nextFree = block;
+        }
+        return;
+    }
+
+    emh_blockLink_t                          start_;
+    emh_blockLink_t                          *base_;
+    emh_blockLink_t                          *end_;
+    std::size_t                              freeBytes_;
+    std::array<emh_blockLink_t*, n_classes>  classHeads_;
+    mutable LockPolicy                       lock_;
+};
+
+/**
+ * @brief Allocator placing the objects of a container on a basic_heap. Allocators
+ *        compare equal when they share the heap. Types aligned beyond the heap
+ *        alignment are refused at compile time.
+ * @tparam T    Type of the allocated objects.
+ * @tparam Heap An instance of emh::basic_heap.
+ */
+template <class T, class Heap>
+class heap_allocator
+{
+    static_assert(alignof( T ) <= Heap::alignment, "Type aligned beyond the heap alignment");
+
+public:
+    typedef T                 value_type;
+    typedef std::size_t       size_type;
+    typedef std::ptrdiff_t    difference_type;
+    typedef std::false_type   is_always_equal;
+    typedef std::true_type    propagate_on_container_move_assignment;
+    typedef std::true_type    propagate_on_container_swap;
+
+    template <class U>
+    struct rebind
+    {
+        typedef heap_allocator<U, Heap> other;
+    };
+
+    explicit heap_allocator(Heap &heap) noexcept : heap_(&heap) {}
+
+    template <class U>
+    heap_allocator(const heap_allocator<U, Heap> &other) noexcept : heap_(other.heap()) {}
+
+    T* allocate(std::size_t n)
+    {
+        void *addr;
+
+        if( n > ( SIZE_MAX / sizeof( T ) ) )
+        {
+            throw std::bad_array_new_length();
+        }
+        addr = heap_->allocate(( 0 != n ) ? n * sizeof( T ) : 1);
+        if( nullptr == addr )
+        {
+            throw std::bad_alloc();
+        }
+        return static_cast<T*>(addr);
+    }
+
+    void deallocate(T *addr, std::size_t) noexcept
+    {
+        heap_->deallocate(addr);
+    }
+
+    Heap* heap() const noexcept
+    {
+        return heap_;
+    }
+
+private:
+    Heap *heap_;
+};
+
+template <class T, class U, class Heap>
+inline bool operator==(const heap_allocator<T, Heap> &lhs, const heap_allocator<U, Heap> &rhs) noexcept
+{
+    return lhs.heap() == rhs.heap();
+}
+
+template <class T, class U, class Heap>
+inline bool operator!=(const heap_allocator<T, Heap> &lhs, const heap_allocator<U, Heap> &rhs) noexcept
+{
+    return lhs.heap() != rhs.heap();
+}
+
+} /* namespace emh */
+
+#endif /* EMH_HEAP_HPP */
@@ -26,6 +26,17 @@
  *
  */
 
+/* 
+ * The optional mmap backend relies on definitions outside of strict ISO C, the
+ * GNU ones let port hooks such as __emh_cpu_id__ rely on sched_getcpu.
+ */
+#if !defined(_DEFAULT_SOURCE)
+#define _DEFAULT_SOURCE
+#endif /* _DEFAULT_SOURCE */
+#if !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif /* _GNU_SOURCE */
+
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -36,15 +47,184 @@
 #include "emh_malloc.h"
 #include "emh_port.h"
 
+#if defined(EMH_MALLOC_HAS_ATOMICS)
+#include <stdatomic.h>
+#endif /* EMH_MALLOC_HAS_ATOMICS */
+
+#if defined(EMH_MALLOC_USE_MMAP)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif /* EMH_MALLOC_USE_MMAP */
+
 static const size_t emh_blockLinkSize = ( ( sizeof(emh_blockLink_t) + (size_t)( EMH_MALLOC_BYTE_ALIGNMENT - 1 ) ) ) & ~( ( size_t ) EMH_MALLOC_BYTE_ALIGN_MASK );
 
+static const size_t emh_regionSize = ( ( sizeof(emh_region_t) + (size_t)( EMH_MALLOC_BYTE_ALIGNMENT - 1 ) ) ) & ~( ( size_t ) EMH_MALLOC_BYTE_ALIGN_MASK );
+
 static emh_heapLink_t emh_heapLinks[EMH_MALLOC_N_HEAPS] = {0};
+static int            emh_heapZoneInit[EMH_MALLOC_N_HEAPS] = {0};
+
+/*
+ * Heap id registry, guarded by the global critical zone. Ids are handed out in
+ * creation order, emh_destroy stacks the id of the heap on emh_freeIds and the
+ * next heap created takes it back. Heap links are looked up by id without lock.
+ */
+static emh_heapId_t   emh_freeIds[EMH_MALLOC_N_HEAPS];
+static int            emh_nFreeIds = 0;
+static int            emh_nUsedIds = 0;
+
+/*
+ * Heaps served by emh_malloc_local, one per CPU and a default one on the last
+ * entry. Entries hold the heap id plus one, so zero stands for no heap. They are
+ * written under the global critical zone and read without it, a heap id is a
+ * single aligned word.
+ */
+static emh_heapId_t   emh_localHeaps[EMH_MALLOC_MAX_CPUS + 1] = {0};
+
+#if defined(EMH_MALLOC_REMOTE_FREE)
+/*
+ * Remote free lists. Blocks freed by a thread that does not own their heap are
+ * pushed here, chained through nextFree with the last block pointing to the heap
+ * end, so they keep failing the emh_free validity check until they are drained.
+ */
+static _Atomic(emh_blockLink_t*) emh_remoteFree[EMH_MALLOC_N_HEAPS];
+static _Atomic size_t            emh_heapOwner[EMH_MALLOC_N_HEAPS];
+#endif /* EMH_MALLOC_REMOTE_FREE */
 
 static size_t emh_allocBit  = ( (size_t) 1 ) << ( ( sizeof( size_t ) * EMH_MALLOC_BITS_PER_BYTE ) - 16 );
 static size_t emh_heapIdMsk = ( (size_t) EMH_MALLOC_HEAP_ID_BITMASK ) << ( ( sizeof( size_t ) * EMH_MALLOC_BITS_PER_BYTE ) - 15 );
+static size_t emh_prevFreeBit = ( (size_t) 1 ) << ( ( sizeof( size_t ) * EMH_MALLOC_BITS_PER_BYTE ) - 8 );
+static size_t emh_sizeMsk     = ( ( (size_t) 1 ) << ( ( sizeof( size_t ) * EMH_MALLOC_BITS_PER_BYTE ) - 16 ) ) - 1;
+
+#if defined(EMH_MALLOC_USE_MMAP)
+static const size_t emh_mappedSize = ( ( sizeof(emh_mapped_t) + (size_t)( EMH_MALLOC_BYTE_ALIGNMENT - 1 ) ) ) & ~( ( size_t ) EMH_MALLOC_BYTE_ALIGN_MASK );
+static size_t       emh_mappedBit  = ( (size_t) 1 ) << ( ( sizeof( size_t ) * EMH_MALLOC_BITS_PER_BYTE ) - 7 );
+#endif /* EMH_MALLOC_USE_MMAP */
+
+#if defined(EMH_MALLOC_USE_PROFILE)
+static size_t       emh_sampledBit = ( (size_t) 1 ) << ( ( sizeof( size_t ) * EMH_MALLOC_BITS_PER_BYTE ) - 6 );
+#endif /* EMH_MALLOC_USE_PROFILE */
 
 #define EMH_MALLOC_MIN_BLOCK_SIZE  ( ( size_t )( emh_blockLinkSize << 1 ) )
 
+/*
+ * Two-level segregated fit (TLSF) engine parameters. Each power of two size 
+ * range (first level) is split into EMH_TLSF_SL_COUNT linear ranges (second
+ * level), blocks smaller than 1 << EMH_TLSF_FL_SHIFT bytes are all kept
+ * on the first level index 0.
+ */
+#define EMH_TLSF_SL_LOG2   4
+#define EMH_TLSF_SL_COUNT  ( 1 << EMH_TLSF_SL_LOG2 )
+#define EMH_TLSF_FL_SHIFT  ( EMH_TLSF_SL_LOG2 + 3 )
+#define EMH_TLSF_FL_COUNT  ( ( sizeof( size_t ) * EMH_MALLOC_BITS_PER_BYTE ) - 16 - EMH_TLSF_FL_SHIFT + 1 )
+
+/*
+ * TLSF control structure, placed at the beginning of the heap region.
+ * A set bit in flBitmap means that slBitmap[fl] is not empty, a set bit
+ * in slBitmap[fl] means that heads[fl][sl] holds at least one free block.
+ */
+typedef struct emh_tlsf_t
+{
+    size_t           flBitmap;
+    unsigned int     slBitmap[EMH_TLSF_FL_COUNT];
+    emh_blockLink_t* heads[EMH_TLSF_FL_COUNT][EMH_TLSF_SL_COUNT];
+}emh_tlsf_t;
+
+/*
+ * Pool heap control structure, placed at the beginning of the heap region.
+ * Free slots form a stack, each free slot holding the index (plus one) of
+ * the slot below it. The stack head packs the index (plus one) of the top
+ * slot on its lower half and a modification tag on its upper half, the
+ * tag prevents the ABA problem on the lock-free path. The used bitmap, placed
+ * right after the control structure, holds a bit per slot set while the slot
+ * is allocated, so frees of a slot already on the stack are refused.
+ */
+#define EMH_POOL_TAG_SHIFT  ( sizeof( size_t ) * ( EMH_MALLOC_BITS_PER_BYTE >> 1 ) )
+#define EMH_POOL_IDX_MASK   ( ( ( (size_t) 1 ) << EMH_POOL_TAG_SHIFT ) - 1 )
+#define EMH_POOL_WORD_BITS  ( sizeof( size_t ) * EMH_MALLOC_BITS_PER_BYTE )
+
+typedef struct emh_pool_t
+{
+    uint8_t*        slots;
+    size_t          slotSize;
+    size_t          nSlots;
+#if defined(EMH_MALLOC_HAS_ATOMICS)
+    _Atomic size_t  head;
+    _Atomic size_t* used;
+    _Atomic size_t  nMallocs;
+    _Atomic size_t  nFrees;
+#else
+    size_t          head;
+    size_t*         used;
+    size_t          nMallocs;
+    size_t          nFrees;
+#endif /* EMH_MALLOC_HAS_ATOMICS */
+}emh_pool_t;
+
+/*
+ * Arena heap control structure, placed at the beginning of the heap region.
+ * Objects are carved by bumping top towards the heap end and carry no block
+ * link, last is the most recent object, which may be resized in place.
+ */
+typedef struct emh_arena_t
+{
+    uint8_t*        top;
+    uint8_t*        last;
+}emh_arena_t;
+
+/*
+ * Compact heap parameters. Every block carries a single 32-bit header placed
+ * right before its payload, holding the block size in EMH_COMPACT_UNIT units
+ * on its lower bits, the heap id above them and the allocated bit on the top
+ * bit. Free blocks hold the offset of the next free block from the heap base
+ * on their first payload word, the last one pointing to the heap end.
+ */
+#define EMH_COMPACT_UNIT       ( ( EMH_MALLOC_BYTE_ALIGNMENT < 8 ) ? (size_t) 8 : (size_t) EMH_MALLOC_BYTE_ALIGNMENT )
+#define EMH_COMPACT_HDR_SIZE   ( sizeof( uint32_t ) )
+#define EMH_COMPACT_SIZE_BITS  24
+#define EMH_COMPACT_SIZE_MASK  ( ( ( (uint32_t) 1 ) << EMH_COMPACT_SIZE_BITS ) - 1 )
+#define EMH_COMPACT_ALLOC_BIT  ( ( (uint32_t) 1 ) << 31 )
+#define EMH_COMPACT_MAX_HEAP   ( (size_t) 0xFFFFFFFFUL )
+
+/*
+ * Compact heap control structure, placed at the beginning of the heap region.
+ * head is the offset of the lowest free block, or of the heap end when the
+ * heap is full. The remaining fields describe the region to emh_attach: the
+ * heap base and heap end offsets, from the control structure and from the heap
+ * base respectively, and the payload offset of the root block, 0 for none.
+ * Persistent heaps carry EMH_PERSIST_MAGIC, written last when formatted.
+ */
+typedef struct emh_compact_t
+{
+    uint32_t        head;
+    uint32_t        magic;
+    uint32_t        layout;
+    uint32_t        baseOff;
+    uint32_t        endOff;
+    uint32_t        root;
+}emh_compact_t;
+
+/*
+ * Persistent heap parameters. The layout word changes along with the block format,
+ * so regions formatted by an incompatible build are refused. Blocks of persistent
+ * heaps are tagged with EMH_MALLOC_HEAP_ID_BITMASK, which no heap id ends with, as
+ * the heap id may differ every time the region is attached.
+ */
+#define EMH_PERSIST_MAGIC      ( (uint32_t) 0x50484D45UL )
+#define EMH_PERSIST_LAYOUT     ( ( ( (uint32_t) 1 ) << 24 ) | ( ( (uint32_t) EMH_COMPACT_UNIT ) << 8 ) | ( (uint32_t) EMH_COMPACT_HDR_SIZE ) )
+
+/* Number of pool, arena and compact heaps, whose blocks are found through their address range. */
+static int emh_nRangeHeaps = 0;
+
+/* Entry points behind emh_malloc and emh_free, also used internally so the trace only holds API calls. */
+static void* emh_mallocImpl(emh_heapId_t heapId, size_t size);
+static void  emh_freeImpl(void* addr);
+
+#if defined(EMH_MALLOC_USE_PROFILE)
+static void  emh_profileDropHeap(emh_heapId_t heapId);
+#endif /* EMH_MALLOC_USE_PROFILE */
+
 /**
  * @brief Packs heap id information by casting it into a size_t and shifting bits
  *        to the appropriate region.
@@ -68,20 +248,250 @@ static emh_heapId_t emh_unpackHeapId(size_t emh_blockSize)
 }
 
 /**
- * @brief Performs memory block coalescing by linking a free block to the rest of the heap.
+ * @brief Finds the index of the most significant set bit.
+ * @param value Non-zero value to be scanned.
+ * @return unsigned int 
+ */
+static unsigned int emh_fls(size_t value)
+{
+#if defined(__GNUC__)
+    return (unsigned int)( ( sizeof( unsigned long long ) * EMH_MALLOC_BITS_PER_BYTE ) - 1 - __builtin_clzll( (unsigned long long) value ) );
+#else
+    unsigned int bit = 0;
+    while( 0 != ( value >>= 1 ) )
+    {
+        bit++;
+    }
+    return bit;
+#endif /* __GNUC__ */
+}
+
+/**
+ * @brief Finds the index of the least significant set bit.
+ * @param value Non-zero value to be scanned.
+ * @return unsigned int 
+ */
+static unsigned int emh_ffs(size_t value)
+{
+#if defined(__GNUC__)
+    return (unsigned int) __builtin_ctzll( (unsigned long long) value );
+#else
+    unsigned int bit = 0;
+    while( 0 == ( value & 1 ) )
+    {
+        value >>= 1;
+        bit++;
+    }
+    return bit;
+#endif /* __GNUC__ */
+}
+
+/**
+ * @brief Returns the block physically placed right after the given one.
+ * @param emh_block Pointer to a block link.
+ * @return emh_blockLink_t* 
+ */
+static emh_blockLink_t* emh_nextPhysBlock(emh_blockLink_t *emh_block)
+{
+    return (void*)( ( (uint8_t*) emh_block ) + ( emh_block->blockSize & emh_sizeMsk ) );
+}
+
+/**
+ * @brief Returns the location of the previous free block pointer of a free block,
+ *        which is stored right after the block link.
+ * @param emh_block Pointer to a free block link.
+ * @return emh_blockLink_t** 
+ */
+static emh_blockLink_t** emh_prevFreeLink(emh_blockLink_t *emh_block)
+{
+    return (emh_blockLink_t**)( ( (uint8_t*) emh_block ) + emh_blockLinkSize );
+}
+
+/**
+ * @brief Writes the boundary tag (footer) of a free block, i.e. its size on the
+ *        last word of the block, so the next physical block can find it.
+ * @param emh_block Pointer to a free block link.
+ */
+static void emh_writeFooter(emh_blockLink_t *emh_block)
+{
+    size_t *footer = (size_t*)( ( (uint8_t*) emh_nextPhysBlock(emh_block) ) - sizeof( size_t ) );
+    *footer = emh_block->blockSize & emh_sizeMsk;
+}
+
+/**
+ * @brief Maps a block size into its TLSF first and second level indexes.
+ * @param size Block size.
+ * @param fl   First level index output.
+ * @param sl   Second level index output.
+ */
+static void emh_tlsfMapping(size_t size, unsigned int *fl, unsigned int *sl)
+{
+    unsigned int msb;
+
+    if( size < ( (size_t) 1 << EMH_TLSF_FL_SHIFT ) )
+    {
+        *fl = 0;
+        *sl = (unsigned int)( size >> ( EMH_TLSF_FL_SHIFT - EMH_TLSF_SL_LOG2 ) );
+    }
+    else
+    {
+        msb = emh_fls(size);
+        *fl = msb - EMH_TLSF_FL_SHIFT + 1;
+        *sl = (unsigned int)( size >> ( msb - EMH_TLSF_SL_LOG2 ) ) ^ EMH_TLSF_SL_COUNT;
+    }
+    return;
+}
+
+/**
+ * @brief Inserts a free block at the head of its TLSF segregated list.
+ * @param tlsf      Pointer to the TLSF control structure.
+ * @param emh_block Pointer to the free block.
+ */
+static void emh_tlsfInsert(emh_tlsf_t *tlsf, emh_blockLink_t *emh_block)
+{
+    unsigned int fl, sl;
+
+    emh_tlsfMapping(emh_block->blockSize & emh_sizeMsk, &fl, &sl);
+    emh_block->nextFree = tlsf->heads[fl][sl];
+    *emh_prevFreeLink(emh_block) = NULL;
+    if( NULL != emh_block->nextFree )
+    {
+        *emh_prevFreeLink(emh_block->nextFree) = emh_block;
+    }
+    tlsf->heads[fl][sl] = emh_block;
+    tlsf->flBitmap     |= ( (size_t) 1 ) << fl;
+    tlsf->slBitmap[fl] |= 1U << sl;
+    return;
+}
+
+/**
+ * @brief Removes a free block from its TLSF segregated list.
+ * @param tlsf      Pointer to the TLSF control structure.
+ * @param emh_block Pointer to the free block.
+ */
+static void emh_tlsfRemove(emh_tlsf_t *tlsf, emh_blockLink_t *emh_block)
+{
+    unsigned int fl, sl;
+    emh_blockLink_t *prev = *emh_prevFreeLink(emh_block);
+    emh_blockLink_t *next = emh_block->nextFree;
+
+    if( NULL != next )
+    {
+        *emh_prevFreeLink(next) = prev;
+    }
+
+    if( NULL != prev )
+    {
+        prev->nextFree = next;
+    }
+    else
+    {
+        emh_tlsfMapping(emh_block->blockSize & emh_sizeMsk, &fl, &sl);
+        tlsf->heads[fl][sl] = next;
+        if( NULL == next )
+        {
+            tlsf->slBitmap[fl] &= ~( 1U << sl );
+            if( 0 == tlsf->slBitmap[fl] )
+            {
+                tlsf->flBitmap &= ~( ( (size_t) 1 ) << fl );
+            }
+        }
+    }
+    return;
+}
+
+/**
+ * @brief Finds a free block with at least the requested size. The size is rounded
+ *        up to the next list boundary so any block in the found list fits.
+ * @param tlsf Pointer to the TLSF control structure.
+ * @param size Requested block size.
+ * @return emh_blockLink_t* suitable free block or NULL if there is none.
+ */
+static emh_blockLink_t* emh_tlsfFind(emh_tlsf_t *tlsf, size_t size)
+{
+    unsigned int    fl, sl;
+    size_t          flMap;
+    unsigned int    slMap;
+    size_t          roundSize = size;
+    emh_blockLink_t *block;
+
+    if( size >= ( (size_t) 1 << EMH_TLSF_FL_SHIFT ) )
+    {
+        roundSize += ( ( (size_t) 1 ) << ( emh_fls(size) - EMH_TLSF_SL_LOG2 ) ) - 1;
+    }
+    emh_tlsfMapping(roundSize, &fl, &sl);
+
+    slMap = 0;
+    if( fl < EMH_TLSF_FL_COUNT )
+    {
+        slMap = tlsf->slBitmap[fl] & ( ~0U << sl );
+        if( 0 == slMap )
+        {
+            flMap = tlsf->flBitmap & ( ~( (size_t) 0 ) << ( fl + 1 ) );
+            if( 0 != flMap )
+            {
+                fl    = emh_ffs(flMap);
+                slMap = tlsf->slBitmap[fl];
+            }
+        }
+    }
+
+    if( 0 != slMap )
+    {
+        sl = emh_ffs(slMap);
+        return tlsf->heads[fl][sl];
+    }
+
+    /*
+     * Nothing is available above the rounded size, however the list the
+     * requested size belongs to may still hold a block that fits. This is
+     * only reached when the heap is about to be exhausted.
+     */
+    emh_tlsfMapping(size, &fl, &sl);
+    for( block = tlsf->heads[fl][sl]; NULL != block; block = block->nextFree )
+    {
+        if( ( block->blockSize & emh_sizeMsk ) >= size )
+        {
+            break;
+        }
+    }
+    return block;
+}
+
+/**
+ * @brief Moves the next-fit roving pointer away from a free block that is leaving
+ *        the free list of a first-fit heap.
+ * @param emh_link    Pointer to a heap link.
+ * @param emh_block   Pointer to the free block leaving the list.
+ * @param replacement Free list node taking its place, placed before it on the list.
+ */
+static void emh_roverReplace(emh_heapLink_t *emh_link, emh_blockLink_t *emh_block, emh_blockLink_t *replacement)
+{
+    if( emh_link->rover == emh_block )
+    {
+        emh_link->rover = replacement;
+    }
+    return;
+}
+
+/**
+ * @brief Performs memory block coalescing by linking a free block to the rest of the heap,
+ *        searching for its place from the given free block onwards.
  * @param emh_heap  Pointer to a heap link.
+ * @param iterator  Pointer to the heap start or to a free block placed before emh_block.
  * @param emh_block Pointer of a free block to be linked.
+ * @return emh_blockLink_t* free block holding emh_block after coalescing, every block
+ *         placed after emh_block may be linked starting from it.
  */
-static void emh_linkFreeBlock(emh_heapLink_t *emh_heap, emh_blockLink_t *emh_block)
+static emh_blockLink_t* emh_linkFreeBlockFrom(emh_heapLink_t *emh_heap, emh_blockLink_t *iterator, emh_blockLink_t *emh_block)
 {
-    emh_blockLink_t *iterator;
     uint8_t *addr;
 
     /*
      * Iterate through the links until an address higher than the one of the 
      * given block is found. 
      */
-    for(iterator = &emh_heap->start; iterator->nextFree < emh_block; iterator = iterator->nextFree );
+    for( ; iterator->nextFree < emh_block; iterator = iterator->nextFree );
 
     /* Is the block being linked and the block linked after contiguous? */
     addr = (uint8_t *) iterator;
@@ -102,6 +512,7 @@ static void emh_linkFreeBlock(emh_heapLink_t *emh_heap, emh_blockLink_t *emh_blo
         }
         else
         {
+            emh_roverReplace(emh_heap, iterator->nextFree, emh_block);
             emh_block->blockSize += iterator->nextFree->blockSize;
             emh_block->nextFree  = iterator->nextFree->nextFree;
         }
@@ -115,263 +526,5222 @@ static void emh_linkFreeBlock(emh_heapLink_t *emh_heap, emh_blockLink_t *emh_blo
     {
         iterator->nextFree = emh_block;
     }
+    return emh_block;
+}
+
+/**
+ * @brief Performs memory block coalescing by linking a free block to the rest of the heap.
+ * @param emh_heap  Pointer to a heap link.
+ * @param emh_block Pointer of a free block to be linked.
+ */
+static void emh_linkFreeBlock(emh_heapLink_t *emh_heap, emh_blockLink_t *emh_block)
+{
+    (void) emh_linkFreeBlockFrom(emh_heap, &emh_heap->start, emh_block);
     return;
 }
 
 /**
- * @brief Initialises heap space and links it into static links array.
- * @param heapAddr First memory address from the heap region.
- * @param heapSize Size of the heap memory region.
- * @return emh_heapId_t heap identifier, which is an index from emh_heapLinks array.
+ * @brief Tells whether the blocks of a heap carry boundary tags, i.e. a footer on
+ *        free blocks and the previous free bit on the block size.
+ * @param emh_link Pointer to a heap link.
+ * @return int 
  */
-emh_heapId_t emh_create(void* heapAddr, size_t heapSize)
+static int emh_isTagged(emh_heapLink_t *emh_link)
 {
-    static int      emh_critZoneInit = 0;
-    emh_heapId_t    emh_heapIdx = 0;
-    emh_heapLink_t  *emh_stFreeLink = emh_heapLinks;
-    emh_blockLink_t *emh_stFreeBlock;
-    uint8_t         *alignedAddr;
-    size_t          unsLongAddr;
-    size_t          totHeapSize = heapSize;
+    return ( EMH_HEAP_TLSF == ( emh_link->flags & EMH_HEAP_ENGINE_MASK ) ) ||
+           ( 0 != ( emh_link->flags & EMH_HEAP_BOUNDARY_TAGS ) );
+}
 
-    /* Initialises mutex */
-    if( 0 == emh_critZoneInit )
+/**
+ * @brief Inserts a free block into the free lists of a boundary tagged heap. First-fit
+ *        heaps keep a doubly linked list and the block is placed at its head.
+ * @param emh_link  Pointer to a heap link.
+ * @param emh_block Pointer to the free block.
+ */
+static void emh_tagInsert(emh_heapLink_t *emh_link, emh_blockLink_t *emh_block)
+{
+    if( EMH_HEAP_TLSF == ( emh_link->flags & EMH_HEAP_ENGINE_MASK ) )
     {
-    	__emh_create_zone__();
-    	emh_critZoneInit = 1;
+        emh_tlsfInsert(emh_link->ctrl, emh_block);
     }
-    
-    __emh_lock_zone__();
-    /* Search for available links */
-    for(emh_heapIdx = 0; emh_heapIdx < EMH_MALLOC_N_HEAPS; emh_heapIdx++)
+    else
     {
-        if( NULL == emh_stFreeLink[emh_heapIdx].end )
+        emh_block->nextFree = emh_link->start.nextFree;
+        *emh_prevFreeLink(emh_block) = &emh_link->start;
+        if( emh_link->end != emh_block->nextFree )
         {
-            break;   
+            *emh_prevFreeLink(emh_block->nextFree) = emh_block;
         }
+        emh_link->start.nextFree = emh_block;
     }
-    
-    /*
-     * No links are available at the moment.
-     * This means the maximum number of manageable heaps was reached.
-     * Therefore return an invalid heap id.
-     */
-    if( emh_heapIdx >= EMH_MALLOC_N_HEAPS )
+    return;
+}
+
+/**
+ * @brief Removes a free block from the free lists of a boundary tagged heap.
+ * @param emh_link  Pointer to a heap link.
+ * @param emh_block Pointer to the free block.
+ */
+static void emh_tagRemove(emh_heapLink_t *emh_link, emh_blockLink_t *emh_block)
+{
+    emh_blockLink_t *prev;
+
+    if( EMH_HEAP_TLSF == ( emh_link->flags & EMH_HEAP_ENGINE_MASK ) )
     {
-        emh_heapIdx = -1;
-        return emh_heapIdx;
+        emh_tlsfRemove(emh_link->ctrl, emh_block);
     }
-
-    /*
-     * The address must be aligned. 
-     * Perform necessary corrections.
-     */
-    unsLongAddr = (size_t)( heapAddr );
-    if( 0 != ( unsLongAddr & EMH_MALLOC_BYTE_ALIGN_MASK ) )
+    else
     {
-        unsLongAddr += (EMH_MALLOC_BYTE_ALIGNMENT - 1);
-        unsLongAddr &= ~( (size_t) EMH_MALLOC_BYTE_ALIGN_MASK );
-        totHeapSize -= unsLongAddr - ( (size_t) heapAddr ); 
+        prev = *emh_prevFreeLink(emh_block);
+        emh_roverReplace(emh_link, emh_block, prev);
+        prev->nextFree = emh_block->nextFree;
+        if( emh_link->end != emh_block->nextFree )
+        {
+            *emh_prevFreeLink(emh_block->nextFree) = prev;
+        }
     }
-    alignedAddr = (uint8_t*) unsLongAddr;
+    return;
+}
 
-    emh_stFreeLink[emh_heapIdx].start.nextFree   = (void*) alignedAddr;
-    emh_stFreeLink[emh_heapIdx].start.blockSize  = (size_t) 0;
+/**
+ * @brief Splits off the space of an unlinked free block exceeding the requested size
+ *        and links it back as a free block of a boundary tagged heap.
+ * @param emh_link  Pointer to a heap link.
+ * @param emh_block Pointer to the block being allocated, already unlinked.
+ * @param size      Aligned block size, including the block link.
+ */
+static void emh_tagSplit(emh_heapLink_t *emh_link, emh_blockLink_t *emh_block, size_t size)
+{
+    emh_blockLink_t *newBlock;
+    size_t          blockSize = emh_block->blockSize & emh_sizeMsk;
 
-    unsLongAddr = ( (size_t) alignedAddr ) + totHeapSize;
-    unsLongAddr -= emh_blockLinkSize;
-    unsLongAddr &= ~( (size_t) EMH_MALLOC_BYTE_ALIGN_MASK );
+    if( EMH_MALLOC_MIN_BLOCK_SIZE < ( blockSize - size ) )
+    {
+        newBlock = ( void* )( ( ( uint8_t* ) emh_block ) + size );
+        newBlock->blockSize = blockSize - size;
+        emh_block->blockSize = size | ( emh_block->blockSize & ~emh_sizeMsk );
+        emh_writeFooter(newBlock);
+        emh_tagInsert(emh_link, newBlock);
+    }
+    else
+    {
+        emh_nextPhysBlock(emh_block)->blockSize &= ~emh_prevFreeBit;
+    }
+    return;
+}
 
-    emh_stFreeLink[emh_heapIdx].end = (void*) unsLongAddr;
-    emh_stFreeLink[emh_heapIdx].end->blockSize = 0;
-    emh_stFreeLink[emh_heapIdx].end->nextFree = NULL;
+/**
+ * @brief Returns a block to the free lists of a boundary tagged heap, merging it
+ *        with its free physical neighbours in constant time.
+ * @param emh_link  Pointer to a heap link.
+ * @param emh_block Pointer of a free block to be linked.
+ */
+static void emh_tagLinkFreeBlock(emh_heapLink_t *emh_link, emh_blockLink_t *emh_block)
+{
+    emh_blockLink_t *prev, *next;
+    size_t          prevSize;
 
-    emh_stFreeBlock             = (void*) alignedAddr;
-    emh_stFreeBlock->blockSize  = unsLongAddr - ( (size_t) emh_stFreeBlock );
-    emh_stFreeBlock->nextFree   = emh_stFreeLink[emh_heapIdx].end;
+    /* Is the previous physical block free? */
+    if( 0 != ( emh_block->blockSize & emh_prevFreeBit ) )
+    {
+        prevSize = *( (size_t*)( ( (uint8_t*) emh_block ) - sizeof( size_t ) ) );
+        prev = (void*)( ( (uint8_t*) emh_block ) - prevSize );
+        emh_tagRemove(emh_link, prev);
+        prev->blockSize += emh_block->blockSize & emh_sizeMsk;
+        emh_block = prev;
+    }
 
-    emh_stFreeLink[emh_heapIdx].freeBytes      = emh_stFreeBlock->blockSize;
-    emh_stFreeLink[emh_heapIdx].remainBytes    = emh_stFreeBlock->blockSize;
-    __emh_unlock_zone__();
+    /* Is the next physical block free? The heap end has a size of zero. */
+    next = emh_nextPhysBlock(emh_block);
+    if( ( 0 != ( next->blockSize & emh_sizeMsk ) ) && ( 0 == ( next->blockSize & emh_allocBit ) ) )
+    {
+        emh_tagRemove(emh_link, next);
+        emh_block->blockSize += next->blockSize & emh_sizeMsk;
+        next = emh_nextPhysBlock(emh_block);
+    }
 
-    return emh_heapIdx;
+    emh_writeFooter(emh_block);
+    if( 0 != ( next->blockSize & emh_sizeMsk ) )
+    {
+        next->blockSize |= emh_prevFreeBit;
+    }
+    emh_tagInsert(emh_link, emh_block);
+    return;
 }
 
 /**
- * @brief Allocates memory region into designated heap space specified by heapId
- *        and returns a memory aligned pointer to allocated memory area.
- * 
- * @param heapId Id number of the heap memory region to be used.
- * @param size    Size of memory to be allocated from the heap.
- * @return void* 
+ * @brief Adds the free list nodes visited by an allocation to the scan counters of
+ *        a heap link.
+ * @param emh_link Pointer to a heap link.
+ * @param scanned  Pointer to the number of nodes visited, cleared on return.
  */
-void* emh_malloc(emh_heapId_t heapId, size_t size)
+static void emh_countScanned(emh_heapLink_t *emh_link, size_t *scanned)
 {
-    __emh_lock_zone__();
-    void* addr = NULL;
-
-    /* Is heap ID not valid? */
-    if( ( 0 > heapId ) || ( EMH_MALLOC_MAX_HEAPS < heapId ) )
+    emh_link->nScanned += *scanned;
+    if( *scanned > emh_link->maxScanned )
     {
-        return addr;
+        emh_link->maxScanned = *scanned;
     }
+    *scanned = 0;
+    return;
+}
 
-    emh_heapLink_t  *emh_link = &emh_heapLinks[heapId];
+/**
+ * @brief Searches the free list for a block that fits the requested size according
+ *        to the heap placement policy, unlinks it and splits off the remaining space.
+ *        First-fit takes the first block that fits, next-fit the first one after the
+ *        roving pointer, best-fit the smallest one and split the first one for small
+ *        requests and the one placed at the highest address for large requests, which
+ *        are carved from the end of the block.
+ * @param emh_link Pointer to a heap link.
+ * @param size     Aligned block size, including the block link.
+ * @return emh_blockLink_t* allocated block or NULL if there is none.
+ */
+static emh_blockLink_t* emh_firstFitAlloc(emh_heapLink_t *emh_link, size_t size)
+{
     emh_blockLink_t *block, *prevBlock, *newBlock;
+    emh_blockLink_t *fitBlock = NULL, *fitPrev = NULL;
+    unsigned int    policy  = emh_link->flags & EMH_HEAP_POLICY_MASK;
+    int             high    = ( EMH_HEAP_POLICY_SPLIT == policy ) && ( size >= EMH_MALLOC_SPLIT_THRESHOLD );
+    int             wrapped = 0;
+    size_t          scanned = 0;
+    size_t          blockSize;
 
-    /*
-     * Check if the requested size is valid and can fit the
-     * allocation control bit.
-     */
-    if( ( 0 == ( size & emh_allocBit ) ) && ( 0 < size ) )
-    {   
-        /* Perform necessary corrections on requested size. */
-        size += emh_blockLinkSize;
-        if( 0 != ( size & EMH_MALLOC_BYTE_ALIGN_MASK ) )
-        {
-            size += ( EMH_MALLOC_BYTE_ALIGNMENT - ( size & EMH_MALLOC_BYTE_ALIGN_MASK ) );
-        }
+    prevBlock = ( EMH_HEAP_POLICY_NEXT == policy ) ? emh_link->rover : &emh_link->start;
+    block     = prevBlock->nextFree;
 
-        /* Is requested size possible to fit in ? */
-        if( size <= emh_link->freeBytes )
+    for(;;)
+    {
+        if( emh_link->end == block )
         {
+            /* Next-fit wraps around once, up to the roving pointer. */
+            if( ( EMH_HEAP_POLICY_NEXT != policy ) || ( 0 != wrapped ) || ( &emh_link->start == emh_link->rover ) )
+            {
+                break;
+            }
+            wrapped   = 1;
             prevBlock = &emh_link->start;
             block     = emh_link->start.nextFree;
+            continue;
+        }
+        if( ( 0 != wrapped ) && ( prevBlock == emh_link->rover ) )
+        {
+            break;
+        }
 
-            while( ( block->blockSize < size ) && ( NULL != block->nextFree ) )
+        scanned++;
+        blockSize = block->blockSize & emh_sizeMsk;
+        if( blockSize >= size )
+        {
+            if( EMH_HEAP_POLICY_BEST == policy )
+            {
+                if( ( NULL == fitBlock ) || ( blockSize < ( fitBlock->blockSize & emh_sizeMsk ) ) )
+                {
+                    fitBlock = block;
+                    fitPrev  = prevBlock;
+                }
+                /* Nothing fits better than a block that can not be split. */
+                if( EMH_MALLOC_MIN_BLOCK_SIZE >= ( blockSize - size ) )
+                {
+                    break;
+                }
+            }
+            else if( 0 != high )
+            {
+                if( ( NULL == fitBlock ) || ( block > fitBlock ) )
+                {
+                    fitBlock = block;
+                    fitPrev  = prevBlock;
+                }
+            }
+            else
+            {
+                fitBlock = block;
+                fitPrev  = prevBlock;
+                break;
+            }
+        }
+        prevBlock = block;
+        block     = block->nextFree;
+    }
+
+    emh_countScanned(emh_link, &scanned);
+
+    /* Have we cycled through the entire list? */
+    if( NULL == fitBlock )
+    {
+        return NULL;
+    }
+    block     = fitBlock;
+    blockSize = block->blockSize & emh_sizeMsk;
+
+    /* Large blocks of the split policy are carved from the end, the front stays on the list. */
+    if( ( 0 != high ) && ( EMH_MALLOC_MIN_BLOCK_SIZE < ( blockSize - size ) ) )
+    {
+        newBlock = ( void* )( ( ( uint8_t* ) block ) + ( blockSize - size ) );
+        block->blockSize -= size;
+        newBlock->blockSize = size;
+        if( emh_isTagged(emh_link) )
+        {
+            emh_writeFooter(block);
+            newBlock->blockSize |= emh_prevFreeBit;
+            emh_nextPhysBlock(newBlock)->blockSize &= ~emh_prevFreeBit;
+        }
+        return newBlock;
+    }
+
+    if( EMH_HEAP_POLICY_NEXT == policy )
+    {
+        emh_link->rover = fitPrev;
+    }
+
+    /* If we are here it means a suitable block has been found. */
+    if( emh_isTagged(emh_link) )
+    {
+        emh_tagRemove(emh_link, block);
+        emh_tagSplit(emh_link, block, size);
+        return block;
+    }
+
+    emh_roverReplace(emh_link, block, fitPrev);
+    fitPrev->nextFree = block->nextFree;
+
+    if(  EMH_MALLOC_MIN_BLOCK_SIZE < ( block->blockSize - size ) )
+    {
+        newBlock = ( void* )( ( ( uint8_t* ) block ) + size );
+        newBlock->blockSize = block->blockSize - size;
+        block->blockSize = size;
+
+        /* Insert block into list of free links, right after the previous free block. */
+        (void) emh_linkFreeBlockFrom(emh_link, fitPrev, newBlock);
+    }
+    return block;
+}
+
+/**
+ * @brief Takes a block from the TLSF segregated lists and splits off the 
+ *        remaining space, which is inserted back as a free block.
+ * @param emh_link Pointer to a heap link.
+ * @param size     Aligned block size, including the block link.
+ * @return emh_blockLink_t* allocated block or NULL if there is none.
+ */
+static emh_blockLink_t* emh_tlsfAlloc(emh_heapLink_t *emh_link, size_t size)
+{
+    emh_blockLink_t *block;
+
+    emh_link->nScanned++;
+    if( 0 == emh_link->maxScanned )
+    {
+        emh_link->maxScanned = 1;
+    }
+
+    block = emh_tlsfFind(emh_link->ctrl, size);
+    if( NULL != block )
+    {
+        emh_tlsfRemove(emh_link->ctrl, block);
+        emh_tagSplit(emh_link, block, size);
+    }
+    return block;
+}
+
+/**
+ * @brief Returns the address of a pool slot.
+ * @param pool Pointer to the pool control structure.
+ * @param idx  Slot index.
+ * @return size_t* 
+ */
+static size_t* emh_poolSlot(emh_pool_t *pool, size_t idx)
+{
+    return (size_t*)( pool->slots + ( idx * pool->slotSize ) );
+}
+
+/**
+ * @brief Pops a slot from the pool free stack.
+ * @param heapId Id number of the pool heap.
+ * @param pool   Pointer to the pool control structure.
+ * @return void* slot address or NULL if the pool is exhausted.
+ */
+static void* emh_poolAlloc(emh_heapId_t heapId, emh_pool_t *pool)
+{
+    size_t head, idx;
+
+#if defined(EMH_MALLOC_HAS_ATOMICS)
+    size_t next;
+
+    (void) heapId;
+    head = atomic_load_explicit(&pool->head, memory_order_acquire);
+    do
+    {
+        idx = head & EMH_POOL_IDX_MASK;
+        if( 0 == idx )
+        {
+            return NULL;
+        }
+        /* The slot may be popped concurrently, in which case the tag changes and the exchange fails. */
+        next  = ( head & ~EMH_POOL_IDX_MASK ) + ( ( (size_t) 1 ) << EMH_POOL_TAG_SHIFT );
+        next |= *emh_poolSlot(pool, idx - 1) & EMH_POOL_IDX_MASK;
+    } while( !atomic_compare_exchange_weak_explicit(&pool->head, &head, next, memory_order_acq_rel, memory_order_acquire) );
+    atomic_fetch_or_explicit(&pool->used[( idx - 1 ) / EMH_POOL_WORD_BITS], ( (size_t) 1 ) << ( ( idx - 1 ) % EMH_POOL_WORD_BITS ), memory_order_relaxed);
+    atomic_fetch_add_explicit(&pool->nMallocs, 1, memory_order_relaxed);
+#else
+    __emh_lock_heap_zone__(heapId);
+    head = pool->head;
+    idx  = head & EMH_POOL_IDX_MASK;
+    if( 0 != idx )
+    {
+        pool->head = *emh_poolSlot(pool, idx - 1);
+        pool->used[( idx - 1 ) / EMH_POOL_WORD_BITS] |= ( (size_t) 1 ) << ( ( idx - 1 ) % EMH_POOL_WORD_BITS );
+        pool->nMallocs++;
+    }
+    __emh_unlock_heap_zone__(heapId);
+    if( 0 == idx )
+    {
+        return NULL;
+    }
+#endif /* EMH_MALLOC_HAS_ATOMICS */
+
+    return (void*) emh_poolSlot(pool, idx - 1);
+}
+
+/**
+ * @brief Pushes a slot back to the pool free stack, unless the slot is not allocated.
+ * @param heapId Id number of the pool heap.
+ * @param pool   Pointer to the pool control structure.
+ * @param idx    Slot index.
+ */
+static void emh_poolFree(emh_heapId_t heapId, emh_pool_t *pool, size_t idx)
+{
+    size_t *slot = emh_poolSlot(pool, idx);
+    size_t bit   = ( (size_t) 1 ) << ( idx % EMH_POOL_WORD_BITS );
+
+#if defined(EMH_MALLOC_HAS_ATOMICS)
+    size_t head, next;
+
+    (void) heapId;
+    /* Only the free clearing the used bit pushes the slot, so a double free is refused even when raced. */
+    if( 0 == ( atomic_fetch_and_explicit(&pool->used[idx / EMH_POOL_WORD_BITS], ~bit, memory_order_relaxed) & bit ) )
+    {
+        return;
+    }
+    atomic_fetch_add_explicit(&pool->nFrees, 1, memory_order_relaxed);
+    head = atomic_load_explicit(&pool->head, memory_order_relaxed);
+    do
+    {
+        *slot = head & EMH_POOL_IDX_MASK;
+        next  = ( ( head & ~EMH_POOL_IDX_MASK ) + ( ( (size_t) 1 ) << EMH_POOL_TAG_SHIFT ) ) | ( idx + 1 );
+    } while( !atomic_compare_exchange_weak_explicit(&pool->head, &head, next, memory_order_release, memory_order_relaxed) );
+#else
+    __emh_lock_heap_zone__(heapId);
+    if( 0 != ( pool->used[idx / EMH_POOL_WORD_BITS] & bit ) )
+    {
+        pool->used[idx / EMH_POOL_WORD_BITS] &= ~bit;
+        pool->nFrees++;
+        *slot = pool->head;
+        pool->head = idx + 1;
+    }
+    __emh_unlock_heap_zone__(heapId);
+#endif /* EMH_MALLOC_HAS_ATOMICS */
+    return;
+}
+
+#if defined(EMH_MALLOC_PAGE_MAP)
+/*
+ * Page map. A three level radix tree over the address space holds an entry for every
+ * page of 1 << EMH_MALLOC_MAP_SHIFT bytes spanned by a heap region. Heaps may be
+ * created within a block of another heap, so regions nest, and regions placed by the
+ * caller may share their first and last pages with other heaps. An entry holds the
+ * id plus one of the innermost heap whose regions cover the whole page, or of the only
+ * heap on the page, zero for no heap. Pages shared by several heaps also carry 
+ * EMH_MAP_SHARED and are resolved through the edge table. Nodes are mapped on first
+ * use, published through CAS and never released, so lookups of pages not shared take
+ * no lock.
+ */
+#define EMH_MAP_ADDR_BITS   ( ( sizeof( void* ) > 4 ) ? 48 : 32 )
+#define EMH_MAP_LEAF_BITS   12
+#define EMH_MAP_MID_BITS    ( ( EMH_MAP_ADDR_BITS - EMH_MALLOC_MAP_SHIFT - EMH_MAP_LEAF_BITS ) / 2 )
+#define EMH_MAP_ROOT_BITS   ( EMH_MAP_ADDR_BITS - EMH_MALLOC_MAP_SHIFT - EMH_MAP_LEAF_BITS - EMH_MAP_MID_BITS )
+#define EMH_MAP_SHARED      ( (uint16_t) 0x8000 )
+#define EMH_MAP_COVER_MASK  ( (uint16_t) 0x7FFF )
+#define EMH_MAP_EDGES_MIN   1024
+
+typedef struct emh_mapLeaf_t
+{
+    _Atomic uint16_t heaps[1 << EMH_MAP_LEAF_BITS];
+}emh_mapLeaf_t;
+
+typedef struct emh_mapNode_t
+{
+    _Atomic(void*)   leaves[1 << EMH_MAP_MID_BITS];
+}emh_mapNode_t;
+
+/*
+ * Edge of a region placed by the caller, kept for its first and for its last page.
+ * parent holds the id plus one of the innermost heap around the region when it was
+ * recorded, whose entries the pages of the region take back once it is cleared.
+ */
+typedef struct emh_mapEdge_t
+{
+    size_t       page;
+    uint8_t*     start;
+    uint8_t*     end;
+    emh_heapId_t heapId;
+    uint16_t     parent;
+}emh_mapEdge_t;
+
+static _Atomic(void*) emh_pageMap[1 << EMH_MAP_ROOT_BITS];
+
+/*
+ * Edge table, an open addressing table keyed by page number, mapped and grown by the
+ * page map itself. Updates of the page map take emh_mapLock, a spin lock rather than a
+ * critical zone since regions are recorded under the heap critical zone as well, and so
+ * do lookups of shared pages: the edge table is never read while a heap is destroyed.
+ */
+static emh_mapEdge_t* emh_mapEdges    = NULL;
+static size_t         emh_mapEdgeMask = 0;
+static size_t         emh_mapNEdges   = 0;
+static atomic_flag    emh_mapLock     = ATOMIC_FLAG_INIT;
+
+/**
+ * @brief Takes the page map lock.
+ */
+static void emh_mapLockTake(void)
+{
+    while( atomic_flag_test_and_set_explicit(&emh_mapLock, memory_order_acquire) )
+    {
+    }
+    return;
+}
+
+/**
+ * @brief Gives the page map lock back.
+ */
+static void emh_mapLockGive(void)
+{
+    atomic_flag_clear_explicit(&emh_mapLock, memory_order_release);
+    return;
+}
+
+/**
+ * @brief Returns a node of the page map, mapping it when it is missing. Nodes raced
+ *        for by several threads are published once, the losers unmap their own.
+ * @param slot Pointer to the slot of the node on its parent.
+ * @param size Size of the node.
+ * @return void* node or NULL if it could not be mapped.
+ */
+static void* emh_pageMapNode(_Atomic(void*) *slot, size_t size)
+{
+    void *node = atomic_load_explicit(slot, memory_order_acquire);
+    void *expected = NULL;
+
+    if( NULL == node )
+    {
+        /* Fresh mappings are zero filled, every entry of a new node is empty. */
+        node = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if( MAP_FAILED == node )
+        {
+            return NULL;
+        }
+        if( !atomic_compare_exchange_strong_explicit(slot, &expected, node, memory_order_acq_rel, memory_order_acquire) )
+        {
+            (void) munmap(node, size);
+            node = expected;
+        }
+    }
+    return node;
+}
+
+/**
+ * @brief Returns the page map entry of a page.
+ * @param page   Page number, an address shifted right by EMH_MALLOC_MAP_SHIFT.
+ * @param create Maps the missing nodes on the way when not zero.
+ * @return _Atomic uint16_t* entry or NULL if the page lies beyond the map or its
+ *         nodes are missing.
+ */
+static _Atomic uint16_t* emh_pageMapEntry(size_t page, int create)
+{
+    size_t        rootIdx = page >> ( EMH_MAP_LEAF_BITS + EMH_MAP_MID_BITS );
+    size_t        midIdx  = ( page >> EMH_MAP_LEAF_BITS ) & ( ( ( (size_t) 1 ) << EMH_MAP_MID_BITS ) - 1 );
+    emh_mapNode_t *node;
+    emh_mapLeaf_t *leaf;
+
+    if( rootIdx >= ( ( (size_t) 1 ) << EMH_MAP_ROOT_BITS ) )
+    {
+        return NULL;
+    }
+    node = ( 0 != create ) ? emh_pageMapNode(&emh_pageMap[rootIdx], sizeof( emh_mapNode_t )) :
+                             atomic_load_explicit(&emh_pageMap[rootIdx], memory_order_acquire);
+    if( NULL == node )
+    {
+        return NULL;
+    }
+    leaf = ( 0 != create ) ? emh_pageMapNode(&node->leaves[midIdx], sizeof( emh_mapLeaf_t )) :
+                             atomic_load_explicit(&node->leaves[midIdx], memory_order_acquire);
+    if( NULL == leaf )
+    {
+        return NULL;
+    }
+    return &leaf->heaps[page & ( ( ( (size_t) 1 ) << EMH_MAP_LEAF_BITS ) - 1 )];
+}
+
+/**
+ * @brief Returns the home slot of a page on the edge table.
+ * @param page Page number.
+ * @return size_t slot index.
+ */
+static size_t emh_mapEdgeSlot(size_t page)
+{
+    return (size_t)( ( ( (uint64_t) page ) * 0x9E3779B97F4A7C15ULL ) >> 32 ) & emh_mapEdgeMask;
+}
+
+/**
+ * @brief Tells whether the region of an edge leaves part of its page uncovered.
+ * @param edge Pointer to the edge.
+ * @return int non-zero if the region covers part of the page only.
+ */
+static int emh_mapEdgePartial(const emh_mapEdge_t *edge)
+{
+    return ( ( (size_t) edge->start ) > ( edge->page << EMH_MALLOC_MAP_SHIFT ) ) ||
+           ( ( (size_t) edge->end ) < ( ( edge->page + 1 ) << EMH_MALLOC_MAP_SHIFT ) );
+}
+
+/**
+ * @brief Adds an edge to the edge table, which must have room for it.
+ * @param edge Pointer to the edge.
+ */
+static void emh_mapEdgeInsert(const emh_mapEdge_t *edge)
+{
+    size_t idx;
+
+    for(idx = emh_mapEdgeSlot(edge->page); NULL != emh_mapEdges[idx].start; idx = ( idx + 1 ) & emh_mapEdgeMask)
+    {
+    }
+    emh_mapEdges[idx] = *edge;
+    emh_mapNEdges++;
+    return;
+}
+
+/**
+ * @brief Removes an edge from the edge table.
+ * @param idx Slot index of the edge.
+ */
+static void emh_mapEdgeRemove(size_t idx)
+{
+    size_t next, home;
+
+    emh_mapNEdges--;
+
+    /* Shift back the entries of the cluster that may no longer be reached. */
+    for(next = ( idx + 1 ) & emh_mapEdgeMask; NULL != emh_mapEdges[next].start; next = ( next + 1 ) & emh_mapEdgeMask)
+    {
+        home = emh_mapEdgeSlot(emh_mapEdges[next].page);
+        if( ( ( next - home ) & emh_mapEdgeMask ) >= ( ( next - idx ) & emh_mapEdgeMask ) )
+        {
+            emh_mapEdges[idx] = emh_mapEdges[next];
+            idx = next;
+        }
+    }
+    emh_mapEdges[idx].start = NULL;
+    return;
+}
+
+/**
+ * @brief Makes room on the edge table for a number of new edges, the table is mapped
+ *        again twice as large when it would become more than three quarters full.
+ * @param count Number of new edges.
+ * @return int 0 on success, -1 if the table could not be mapped.
+ */
+static int emh_mapEdgeReserve(size_t count)
+{
+    emh_mapEdge_t *edges = emh_mapEdges;
+    size_t        size   = ( NULL != edges ) ? ( emh_mapEdgeMask + 1 ) : 0;
+    size_t        newSize, idx;
+    void          *mapped;
+
+    if( ( ( emh_mapNEdges + count ) * 4 ) <= ( size * 3 ) )
+    {
+        return 0;
+    }
+    for(newSize = ( 0 != size ) ? ( size << 1 ) : EMH_MAP_EDGES_MIN; ( ( emh_mapNEdges + count ) * 4 ) > ( newSize * 3 ); newSize <<= 1)
+    {
+    }
+    mapped = mmap(NULL, newSize * sizeof( emh_mapEdge_t ), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if( MAP_FAILED == mapped )
+    {
+        return -1;
+    }
+    emh_mapEdges    = mapped;
+    emh_mapEdgeMask = newSize - 1;
+    emh_mapNEdges   = 0;
+    for(idx = 0; idx < size; idx++)
+    {
+        if( NULL != edges[idx].start )
+        {
+            emh_mapEdgeInsert(&edges[idx]);
+        }
+    }
+    if( NULL != edges )
+    {
+        (void) munmap(edges, size * sizeof( emh_mapEdge_t ));
+    }
+    return 0;
+}
+
+/**
+ * @brief Counts the regions placed by the caller that cover part of a page, the page
+ *        map lock must be held.
+ * @param page   Page number.
+ * @param heapId Receives the heap of the last region counted.
+ * @return size_t number of regions, counting stops at two.
+ */
+static size_t emh_mapPartials(size_t page, emh_heapId_t *heapId)
+{
+    size_t idx, count = 0;
+
+    for(idx = emh_mapEdgeSlot(page); ( NULL != emh_mapEdges ) && ( NULL != emh_mapEdges[idx].start ) && ( count < 2 ); idx = ( idx + 1 ) & emh_mapEdgeMask)
+    {
+        if( ( page == emh_mapEdges[idx].page ) && emh_mapEdgePartial(&emh_mapEdges[idx]) )
+        {
+            *heapId = emh_mapEdges[idx].heapId;
+            count++;
+        }
+    }
+    return count;
+}
+
+/**
+ * @brief Returns the id plus one of the innermost heap covering a whole page out of
+ *        its page map entry, the page map lock must be held.
+ * @param page  Page number.
+ * @param value Page map entry of the page.
+ * @return uint16_t heap id plus one, zero if no heap covers the whole page.
+ */
+static uint16_t emh_mapCover(size_t page, uint16_t value)
+{
+    emh_heapId_t heapId;
+
+    if( 0 != ( value & EMH_MAP_SHARED ) )
+    {
+        return value & EMH_MAP_COVER_MASK;
+    }
+    /* An entry not shared names the only heap on the page, which may not cover it. */
+    return ( 0 == emh_mapPartials(page, &heapId) ) ? value : (uint16_t) 0;
+}
+
+/**
+ * @brief Builds the page map entry of a page out of the innermost heap covering the
+ *        whole page and the edges on the page, the page map lock must be held.
+ * @param page  Page number.
+ * @param cover Id plus one of the innermost heap covering the whole page, 0 for none.
+ * @return uint16_t page map entry.
+ */
+static uint16_t emh_mapValue(size_t page, uint16_t cover)
+{
+    emh_heapId_t heapId = -1;
+    size_t       count  = emh_mapPartials(page, &heapId);
+
+    if( 0 == count )
+    {
+        return cover;
+    }
+    if( ( 1 == count ) && ( 0 == cover ) )
+    {
+        return (uint16_t)( heapId + 1 );
+    }
+    return EMH_MAP_SHARED | cover;
+}
+
+/**
+ * @brief Finds the innermost heap holding an address, the page map lock must be held.
+ *        Regions covering part of a page lie within the heap covering the whole page,
+ *        so the smallest of them holding the address wins over it.
+ * @param addr Address of a memory region.
+ * @return emh_heapId_t id of the heap or -1 if no heap holds the address.
+ */
+static emh_heapId_t emh_mapLookup(uint8_t *addr)
+{
+    size_t           page  = ( (size_t) addr ) >> EMH_MALLOC_MAP_SHIFT;
+    _Atomic uint16_t *entry = emh_pageMapEntry(page, 0);
+    uint16_t         value = ( NULL != entry ) ? atomic_load_explicit(entry, memory_order_relaxed) : (uint16_t) 0;
+    emh_mapEdge_t    *best = NULL;
+    size_t           idx;
+
+    for(idx = emh_mapEdgeSlot(page); ( NULL != emh_mapEdges ) && ( NULL != emh_mapEdges[idx].start ); idx = ( idx + 1 ) & emh_mapEdgeMask)
+    {
+        if( ( page == emh_mapEdges[idx].page ) && emh_mapEdgePartial(&emh_mapEdges[idx]) &&
+            ( emh_mapEdges[idx].start <= addr ) && ( emh_mapEdges[idx].end > addr ) &&
+            ( ( NULL == best ) || ( ( emh_mapEdges[idx].end - emh_mapEdges[idx].start ) < ( best->end - best->start ) ) ) )
+        {
+            best = &emh_mapEdges[idx];
+        }
+    }
+    if( NULL != best )
+    {
+        return best->heapId;
+    }
+    return (emh_heapId_t)( (int) emh_mapCover(page, value) - 1 );
+}
+
+/**
+ * @brief Drops the edge of a region from a page, the page map lock must be held.
+ * @param page   Page number.
+ * @param heapId Id number of the heap of the region.
+ * @param start  First address of the region.
+ * @param end    Address past the end of the region.
+ * @param parent Receives the parent of the edge when found.
+ * @return int non-zero if the page holds edges of regions nested within the region.
+ */
+static int emh_mapEdgeDrop(size_t page, emh_heapId_t heapId, uint8_t *start, uint8_t *end, uint16_t *parent)
+{
+    emh_mapEdge_t *edge;
+    size_t        idx    = emh_mapEdgeSlot(page);
+    int           nested = 0;
+
+    while( ( NULL != emh_mapEdges ) && ( NULL != emh_mapEdges[idx].start ) )
+    {
+        edge = &emh_mapEdges[idx];
+        if( ( page == edge->page ) && ( heapId == edge->heapId ) && ( start == edge->start ) )
+        {
+            /* The slot takes the next edge of the cluster, if any. */
+            *parent = edge->parent;
+            emh_mapEdgeRemove(idx);
+            continue;
+        }
+        if( ( page == edge->page ) && ( edge->start >= start ) && ( edge->start < end ) )
+        {
+            nested = 1;
+        }
+        idx = ( idx + 1 ) & emh_mapEdgeMask;
+    }
+    return nested;
+}
+
+/**
+ * @brief Removes a region from the page map. Pages covered by the region alone go
+ *        back to the heap around it, pages also holding nested heaps are kept for them.
+ * @param heapId Id number of the heap.
+ * @param addr   First address of the region.
+ * @param size   Size of the region.
+ */
+static void emh_pageMapClear(emh_heapId_t heapId, void *addr, size_t size)
+{
+    uint8_t          *start = (uint8_t*) addr;
+    uint8_t          *end   = start + size;
+    size_t           first  = ( (size_t) start ) >> EMH_MALLOC_MAP_SHIFT;
+    size_t           last   = ( ( (size_t) end ) - 1 ) >> EMH_MALLOC_MAP_SHIFT;
+    uint16_t         self   = (uint16_t)( heapId + 1 );
+    uint16_t         parent = 0;
+    uint16_t         firstCover, lastCover, value;
+    _Atomic uint16_t *entry;
+    size_t           page, idx;
+    int              nested;
+
+    if( 0 == size )
+    {
+        return;
+    }
+
+    emh_mapLockTake();
+    /* Covers are read while the edges of the region still tell its pages apart. */
+    entry      = emh_pageMapEntry(first, 0);
+    firstCover = ( NULL != entry ) ? emh_mapCover(first, atomic_load_explicit(entry, memory_order_relaxed)) : (uint16_t) 0;
+    entry      = emh_pageMapEntry(last, 0);
+    lastCover  = ( NULL != entry ) ? emh_mapCover(last, atomic_load_explicit(entry, memory_order_relaxed)) : (uint16_t) 0;
+    nested     = emh_mapEdgeDrop(first, heapId, start, end, &parent);
+    nested    |= emh_mapEdgeDrop(last, heapId, start, end, &parent);
+    firstCover = ( self == firstCover ) ? parent : firstCover;
+    lastCover  = ( self == lastCover ) ? parent : lastCover;
+
+    for(page = first + 1; page < last; page++)
+    {
+        entry = emh_pageMapEntry(page, 0);
+        value = ( NULL != entry ) ? atomic_load_explicit(entry, memory_order_relaxed) : (uint16_t) 0;
+        if( self == value )
+        {
+            atomic_store_explicit(entry, parent, memory_order_release);
+        }
+        else if( 0 != value )
+        {
+            if( self == ( value & EMH_MAP_COVER_MASK ) )
+            {
+                atomic_store_explicit(entry, emh_mapValue(page, parent), memory_order_release);
+            }
+            nested = 1;
+        }
+    }
+
+    /* Heaps nested within the region now lie within the heap around it. */
+    for(idx = 0; ( 0 != nested ) && ( NULL != emh_mapEdges ) && ( idx <= emh_mapEdgeMask ); idx++)
+    {
+        if( ( self == emh_mapEdges[idx].parent ) && ( emh_mapEdges[idx].start >= start ) && ( emh_mapEdges[idx].start < end ) )
+        {
+            emh_mapEdges[idx].parent = parent;
+        }
+    }
+
+    entry = emh_pageMapEntry(first, 0);
+    if( NULL != entry )
+    {
+        atomic_store_explicit(entry, emh_mapValue(first, firstCover), memory_order_release);
+    }
+    entry = emh_pageMapEntry(last, 0);
+    if( ( last != first ) && ( NULL != entry ) )
+    {
+        atomic_store_explicit(entry, emh_mapValue(last, lastCover), memory_order_release);
+    }
+    emh_mapLockGive();
+    return;
+}
+
+/**
+ * @brief Records a region on the page map. Pages covered by the whole region are
+ *        taken by its heap, its first and last pages are resolved against the heaps
+ *        already there.
+ * @param heapId Id number of the heap.
+ * @param addr   First address of the region.
+ * @param size   Size of the region.
+ * @param placed Non-zero if the region was placed by the caller, zero for mappings
+ *               of the heap, which share no page and lie within no other heap.
+ * @return int 0 on success, -1 if the range lies beyond the map or a node could not
+ *         be mapped, the region is left unrecorded.
+ */
+static int emh_pageMapSet(emh_heapId_t heapId, void *addr, size_t size, int placed)
+{
+    uint8_t          *start = (uint8_t*) addr;
+    uint8_t          *end   = start + size;
+    size_t           first  = ( (size_t) start ) >> EMH_MALLOC_MAP_SHIFT;
+    size_t           last   = ( ( (size_t) end ) - 1 ) >> EMH_MALLOC_MAP_SHIFT;
+    uint16_t         self   = (uint16_t)( heapId + 1 );
+    uint16_t         firstCover, lastCover;
+    _Atomic uint16_t *entry;
+    emh_mapEdge_t    edge;
+    size_t           page;
+
+    if( 0 == size )
+    {
+        return 0;
+    }
+
+    emh_mapLockTake();
+    /* Every node and edge slot is taken beforehand, the region is recorded whole or not at all. */
+    for(page = first; page <= last; page = ( page | ( ( ( (size_t) 1 ) << EMH_MAP_LEAF_BITS ) - 1 ) ) + 1)
+    {
+        if( NULL == emh_pageMapEntry(page, 1) )
+        {
+            emh_mapLockGive();
+            return -1;
+        }
+    }
+    if( ( NULL == emh_pageMapEntry(last, 1) ) || ( placed && ( 0 != emh_mapEdgeReserve(2) ) ) )
+    {
+        emh_mapLockGive();
+        return -1;
+    }
+
+    firstCover = emh_mapCover(first, atomic_load_explicit(emh_pageMapEntry(first, 0), memory_order_relaxed));
+    lastCover  = emh_mapCover(last, atomic_load_explicit(emh_pageMapEntry(last, 0), memory_order_relaxed));
+    if( placed )
+    {
+        edge.page   = first;
+        edge.start  = start;
+        edge.end    = end;
+        edge.heapId = heapId;
+        edge.parent = (uint16_t)( emh_mapLookup(start) + 1 );
+        emh_mapEdgeInsert(&edge);
+        if( last != first )
+        {
+            edge.page = last;
+            emh_mapEdgeInsert(&edge);
+        }
+    }
+
+    /* Regions nest, heaps already on pages covered by the whole region lie around it. */
+    for(page = first + 1; page < last; page++)
+    {
+        entry = emh_pageMapEntry(page, 0);
+        atomic_store_explicit(entry, self, memory_order_release);
+    }
+    if( ( ( (size_t) start ) == ( first << EMH_MALLOC_MAP_SHIFT ) ) && 
+        ( ( last != first ) || ( ( (size_t) end ) == ( ( last + 1 ) << EMH_MALLOC_MAP_SHIFT ) ) ) )
+    {
+        firstCover = self;
+    }
+    if( ( ( (size_t) end ) == ( ( last + 1 ) << EMH_MALLOC_MAP_SHIFT ) ) && 
+        ( ( last != first ) || ( ( (size_t) start ) == ( first << EMH_MALLOC_MAP_SHIFT ) ) ) )
+    {
+        lastCover = self;
+    }
+    atomic_store_explicit(emh_pageMapEntry(first, 0), emh_mapValue(first, firstCover), memory_order_release);
+    if( last != first )
+    {
+        atomic_store_explicit(emh_pageMapEntry(last, 0), emh_mapValue(last, lastCover), memory_order_release);
+    }
+    emh_mapLockGive();
+    return 0;
+}
+
+/**
+ * @brief Finds the heap holding an address through the page map.
+ * @param addr Address of a memory region.
+ * @return emh_heapId_t id of the heap or -1 if no heap holds the address.
+ */
+static emh_heapId_t emh_pageMapFind(void *addr)
+{
+    _Atomic uint16_t *entry = emh_pageMapEntry(( (size_t) addr ) >> EMH_MALLOC_MAP_SHIFT, 0);
+    uint16_t         value  = ( NULL != entry ) ? atomic_load_explicit(entry, memory_order_acquire) : (uint16_t) 0;
+    emh_heapId_t     heapId;
+
+    if( 0 != ( value & EMH_MAP_SHARED ) )
+    {
+        emh_mapLockTake();
+        heapId = emh_mapLookup(addr);
+        emh_mapLockGive();
+        return heapId;
+    }
+    return (emh_heapId_t)( (int) value - 1 );
+}
+#else
+/* Heap ids fit the block links, there is no page map to keep. */
+static void emh_pageMapClear(emh_heapId_t heapId, void *addr, size_t size)
+{
+    (void) heapId;
+    (void) addr;
+    (void) size;
+    return;
+}
+
+static int emh_pageMapSet(emh_heapId_t heapId, void *addr, size_t size, int placed)
+{
+    (void) heapId;
+    (void) addr;
+    (void) size;
+    (void) placed;
+    return 0;
+}
+#endif /* EMH_MALLOC_PAGE_MAP */
+
+/**
+ * @brief Returns the heap of a block carrying a block link. Block links keep the
+ *        lowest bits of the heap id, builds with a page map take the heap id from
+ *        the page map and check it against those bits.
+ * @param emh_block Pointer to the block link.
+ * @return emh_heapId_t id of the heap, negative or beyond EMH_MALLOC_N_HEAPS if the
+ *         block belongs to no heap.
+ */
+static emh_heapId_t emh_heapOfBlock(emh_blockLink_t *emh_block)
+{
+#if defined(EMH_MALLOC_PAGE_MAP)
+    emh_heapId_t heapId = emh_pageMapFind(emh_block);
+
+    if( ( 0 > heapId ) || ( ( heapId & EMH_MALLOC_HEAP_ID_BITMASK ) != emh_unpackHeapId(emh_block->blockSize) ) )
+    {
+        return -1;
+    }
+    return heapId;
+#else
+    emh_heapId_t heapId = emh_unpackHeapId(emh_block->blockSize);
+    int          linked = 0;
+
+    if( ( EMH_MALLOC_N_HEAPS > heapId ) && ( 0 <= heapId ) )
+    {
+        /*
+         * The id of a destroyed heap may be free or taken by a heap whose blocks carry
+         * no block link, besides the blocks compact heaps map on their own.
+         */
+        linked = ( EMH_HEAP_TLSF >= ( emh_heapLinks[heapId].flags & EMH_HEAP_ENGINE_MASK ) );
+#if defined(EMH_MALLOC_USE_MMAP)
+        linked = linked || ( 0 != ( emh_block->blockSize & emh_mappedBit ) );
+#endif /* EMH_MALLOC_USE_MMAP */
+        if( ( NULL == emh_heapLinks[heapId].end ) || ( 0 == linked ) )
+        {
+            return -1;
+        }
+    }
+    return heapId;
+#endif /* EMH_MALLOC_PAGE_MAP */
+}
+
+/**
+ * @brief Looks up the pool, arena or compact heap whose region contains the given
+ *        address. Pool slots and arena objects carry no block link and compact blocks
+ *        carry a compact header, so they are identified through their address range.
+ * @param addr Address of a memory region.
+ * @return emh_heapId_t id of the heap or -1 if addr is not a pool slot, an arena
+ *         object nor a compact block.
+ */
+static emh_heapId_t emh_findRangeHeap(void *addr)
+{
+    emh_heapId_t heapIdx;
+    unsigned int engine;
+
+#if defined(EMH_MALLOC_PAGE_MAP)
+    heapIdx = emh_pageMapFind(addr);
+    if( 0 <= heapIdx )
+    {
+        engine = emh_heapLinks[heapIdx].flags & EMH_HEAP_ENGINE_MASK;
+        if( ( ( EMH_HEAP_POOL == engine ) || ( EMH_HEAP_ARENA == engine ) || ( EMH_HEAP_COMPACT == engine ) ) && 
+            ( (uint8_t*) emh_heapLinks[heapIdx].base <= (uint8_t*) addr ) && ( (uint8_t*) emh_heapLinks[heapIdx].end > (uint8_t*) addr ) )
+        {
+            return heapIdx;
+        }
+    }
+    return -1;
+#else
+    emh_heapId_t inner = -1;
+
+    /* Heaps may be created within a block of another heap, the smallest region holding the address wins. */
+    for(heapIdx = 0; heapIdx < EMH_MALLOC_N_HEAPS; heapIdx++)
+    {
+        if( ( NULL != emh_heapLinks[heapIdx].end ) && ( (uint8_t*) emh_heapLinks[heapIdx].heapAddr <= (uint8_t*) addr ) && 
+            ( ( (uint8_t*) emh_heapLinks[heapIdx].heapAddr + emh_heapLinks[heapIdx].heapSize ) > (uint8_t*) addr ) &&
+            ( ( 0 > inner ) || ( emh_heapLinks[heapIdx].heapSize < emh_heapLinks[inner].heapSize ) ) )
+        {
+            inner = heapIdx;
+        }
+    }
+    heapIdx = inner;
+    if( 0 <= heapIdx )
+    {
+        engine = emh_heapLinks[heapIdx].flags & EMH_HEAP_ENGINE_MASK;
+        if( ( ( EMH_HEAP_POOL == engine ) || ( EMH_HEAP_ARENA == engine ) || ( EMH_HEAP_COMPACT == engine ) ) && 
+            ( (uint8_t*) emh_heapLinks[heapIdx].base <= (uint8_t*) addr ) && ( (uint8_t*) emh_heapLinks[heapIdx].end > (uint8_t*) addr ) )
+        {
+            return heapIdx;
+        }
+    }
+    return -1;
+#endif /* EMH_MALLOC_PAGE_MAP */
+}
+
+/**
+ * @brief Resets the statistics counters of a heap link.
+ * @param emh_link Pointer to the heap link.
+ */
+static void emh_clearStats(emh_heapLink_t *emh_link)
+{
+    emh_link->nMallocs   = 0;
+    emh_link->nFrees     = 0;
+    emh_link->nFailures  = 0;
+    emh_link->nScanned   = 0;
+    emh_link->maxScanned = 0;
+    return;
+}
+
+/**
+ * @brief Lays a single free block over an additional region of a first-fit or TLSF
+ *        heap and links it to the heap free lists. Regions are kept apart by their
+ *        own end, a block of size zero, so blocks are never merged across regions.
+ *        The heap end stays the highest end of the heap, as the free list of
+ *        first-fit heaps is address ordered and terminated by it.
+ * @param emh_link Pointer to the heap link.
+ * @param region   Pointer to the region header, its end must be set.
+ */
+static void emh_linkRegion(emh_heapLink_t *emh_link, emh_region_t *region)
+{
+    emh_blockLink_t *emh_block = (void*)( ( (uint8_t*) region ) + emh_regionSize );
+    emh_blockLink_t *iterator;
+
+    region->end->blockSize = 0;
+    region->end->nextFree  = NULL;
+    emh_block->blockSize   = ( (size_t) region->end ) - ( (size_t) emh_block );
+    emh_block->nextFree    = NULL;
+    emh_link->freeBytes   += emh_block->blockSize;
+    emh_link->totalBytes  += emh_block->blockSize;
+
+    if( emh_isTagged(emh_link) )
+    {
+        emh_tagLinkFreeBlock(emh_link, emh_block);
+        return;
+    }
+
+    if( region->end > emh_link->end )
+    {
+        for(iterator = &emh_link->start; emh_link->end != iterator->nextFree; iterator = iterator->nextFree);
+        iterator->nextFree = region->end;
+        emh_link->end = region->end;
+    }
+    emh_linkFreeBlock(emh_link, emh_block);
+    return;
+}
+
+/**
+ * @brief Lays a single free block over the heap region of a first-fit or TLSF heap,
+ *        between the heap base and the end of the first region, and over each one
+ *        of its additional regions.
+ * @param emh_link Pointer to the heap link, base, firstEnd, regions, flags and ctrl must be set.
+ */
+static void emh_initBlocks(emh_heapLink_t *emh_link)
+{
+    emh_blockLink_t *emh_stFreeBlock = emh_link->base;
+    emh_region_t    *region;
+
+    if( EMH_HEAP_TLSF == ( emh_link->flags & EMH_HEAP_ENGINE_MASK ) )
+    {
+        memset(emh_link->ctrl, 0x00, sizeof( emh_tlsf_t ));
+    }
+
+    emh_link->end              = emh_link->firstEnd;
+    emh_link->start.nextFree   = emh_stFreeBlock;
+    emh_link->start.blockSize  = (size_t) 0;
+    emh_link->rover            = &emh_link->start;
+    emh_link->end->blockSize   = 0;
+    emh_link->end->nextFree    = NULL;
+
+    emh_stFreeBlock->blockSize  = ( (size_t) emh_link->end ) - ( (size_t) emh_stFreeBlock );
+    emh_stFreeBlock->nextFree   = emh_link->end;
+
+    if( emh_isTagged(emh_link) )
+    {
+        emh_writeFooter(emh_stFreeBlock);
+        if( EMH_HEAP_TLSF == ( emh_link->flags & EMH_HEAP_ENGINE_MASK ) )
+        {
+            emh_link->start.nextFree = NULL;
+        }
+        else
+        {
+            emh_link->start.nextFree = emh_link->end;
+        }
+        emh_tagInsert(emh_link, emh_stFreeBlock);
+    }
+
+    emh_link->freeBytes   = emh_stFreeBlock->blockSize;
+    emh_link->totalBytes  = emh_stFreeBlock->blockSize;
+    for(region = emh_link->regions; NULL != region; region = region->next)
+    {
+        emh_linkRegion(emh_link, region);
+    }
+    emh_link->remainBytes = emh_link->freeBytes;
+    return;
+}
+
+/**
+ * @brief Chains an additional region to a first-fit or TLSF heap, the heap critical
+ *        zone must be held.
+ * @param emh_link Pointer to the heap link.
+ * @param addr     First memory address from the region.
+ * @param size     Size of the region.
+ * @param mapSize  Size of the mapping when the region was mapped by the heap, 0 otherwise.
+ * @return int 0 on success, -1 if the region is too small or could not be recorded
+ *         on the page map.
+ */
+static int emh_addRegion(emh_heapLink_t *emh_link, void *addr, size_t size, size_t mapSize)
+{
+    size_t          unsLongAddr = (size_t) addr;
+    emh_region_t    *region;
+    emh_blockLink_t *end;
+
+    /* The address must be aligned. */
+    unsLongAddr += (EMH_MALLOC_BYTE_ALIGNMENT - 1);
+    unsLongAddr &= ~( (size_t) EMH_MALLOC_BYTE_ALIGN_MASK );
+
+    /* Is the region large enough for its header, its end and a single block? */
+    if( ( NULL == addr ) || 
+        ( size < ( ( unsLongAddr - (size_t) addr ) + emh_regionSize + emh_blockLinkSize + EMH_MALLOC_MIN_BLOCK_SIZE + EMH_MALLOC_BYTE_ALIGNMENT ) ) )
+    {
+        return -1;
+    }
+
+    /* The page map spans the region from its header to its end, as emh_destroy clears it. */
+    region = (void*) unsLongAddr;
+    end    = (void*)( ( ( (size_t) addr ) + size - emh_blockLinkSize ) & ~( (size_t) EMH_MALLOC_BYTE_ALIGN_MASK ) );
+    if( 0 != emh_pageMapSet((emh_heapId_t)( emh_link - emh_heapLinks ), region, ( (size_t) end ) + emh_blockLinkSize - unsLongAddr, 0 == mapSize) )
+    {
+        return -1;
+    }
+
+    /* Only the last region added keeps its fresh mark. */
+    if( NULL != emh_link->regions )
+    {
+        emh_link->regions->fresh = emh_link->regions->end;
+    }
+
+    region->end     = end;
+    region->fresh   = ( 0 != mapSize ) ? (void*) region : (void*) region->end;
+    region->mapSize = mapSize;
+    region->next    = emh_link->regions;
+    emh_link->regions = region;
+    emh_linkRegion(emh_link, region);
+    return 0;
+}
+
+/**
+ * @brief Stacks every slot of a pool heap on its free stack, lowest address on top,
+ *        and clears the used bitmap and the counters.
+ * @param pool Pointer to the pool control structure.
+ */
+static void emh_poolInit(emh_pool_t *pool)
+{
+    size_t idx;
+
+    for(idx = 0; idx < pool->nSlots; idx++)
+    {
+        *emh_poolSlot(pool, idx) = ( idx + 2 <= pool->nSlots ) ? ( idx + 2 ) : 0;
+    }
+    memset((void*) pool->used, 0x00, ( ( pool->nSlots + EMH_POOL_WORD_BITS - 1 ) / EMH_POOL_WORD_BITS ) * sizeof( size_t ));
+    pool->head     = 1;
+    pool->nMallocs = 0;
+    pool->nFrees   = 0;
+    return;
+}
+
+/**
+ * @brief Returns the header of the compact block placed at the given offset.
+ * @param emh_link Pointer to a compact heap link.
+ * @param offset   Offset of the block header from the heap base.
+ * @return uint32_t* 
+ */
+static uint32_t* emh_compactHdr(emh_heapLink_t *emh_link, uint32_t offset)
+{
+    return (uint32_t*)( ( (uint8_t*) emh_link->base ) + offset );
+}
+
+/**
+ * @brief Returns the offset of a compact block header from the heap base.
+ * @param emh_link Pointer to a compact heap link.
+ * @param hdr      Pointer to the block header.
+ * @return uint32_t 
+ */
+static uint32_t emh_compactOffset(emh_heapLink_t *emh_link, void *hdr)
+{
+    return (uint32_t)( ( (uint8_t*) hdr ) - ( (uint8_t*) emh_link->base ) );
+}
+
+/**
+ * @brief Packs the allocated bit and the heap id into the upper bits of a compact header,
+ *        persistent heaps carry EMH_MALLOC_HEAP_ID_BITMASK in place of their heap id.
+ * @param emh_link Pointer to a compact heap link.
+ * @param heapId   Id number of the heap.
+ * @return uint32_t 
+ */
+static uint32_t emh_compactTag(emh_heapLink_t *emh_link, emh_heapId_t heapId)
+{
+    if( 0 != ( emh_link->flags & EMH_HEAP_PERSISTENT ) )
+    {
+        heapId = EMH_MALLOC_HEAP_ID_BITMASK;
+    }
+    return EMH_COMPACT_ALLOC_BIT | ( ( (uint32_t)( heapId & EMH_MALLOC_HEAP_ID_BITMASK ) ) << EMH_COMPACT_SIZE_BITS );
+}
+
+/**
+ * @brief Converts a requested size into a number of compact units, including the header.
+ * @param size Requested size.
+ * @return size_t number of units or 0 if the requested size is not valid.
+ */
+static size_t emh_compactUnitsOf(size_t size)
+{
+    if( ( 0 == size ) || ( size > ( ( EMH_COMPACT_SIZE_MASK * EMH_COMPACT_UNIT ) - EMH_COMPACT_HDR_SIZE ) ) )
+    {
+        return 0;
+    }
+    return ( size + EMH_COMPACT_HDR_SIZE + EMH_COMPACT_UNIT - 1 ) / EMH_COMPACT_UNIT;
+}
+
+/**
+ * @brief Lays free blocks over the whole region of a compact heap, between the heap
+ *        base and the heap end. Blocks are limited to EMH_COMPACT_SIZE_MASK units, so
+ *        large heaps start with a chain of free blocks.
+ * @param emh_link Pointer to the heap link, base, end and ctrl must be set.
+ */
+static void emh_compactInit(emh_heapLink_t *emh_link)
+{
+    emh_compact_t *compact = emh_link->ctrl;
+    uint32_t      endOff   = emh_compactOffset(emh_link, emh_link->end);
+    uint32_t      offset   = 0;
+    size_t        units    = endOff / EMH_COMPACT_UNIT;
+    size_t        chunk;
+    uint32_t      *hdr;
+
+    compact->magic = 0;
+    compact->head  = ( 0 != units ) ? 0 : endOff;
+    while( 0 != units )
+    {
+        chunk   = ( units > EMH_COMPACT_SIZE_MASK ) ? EMH_COMPACT_SIZE_MASK : units;
+        hdr     = emh_compactHdr(emh_link, offset);
+        offset += (uint32_t)( chunk * EMH_COMPACT_UNIT );
+        hdr[0]  = (uint32_t) chunk;
+        hdr[1]  = offset;
+        units  -= chunk;
+    }
+    *emh_compactHdr(emh_link, endOff) = 0;
+
+    compact->layout  = EMH_PERSIST_LAYOUT;
+    compact->baseOff = (uint32_t)( ( (uint8_t*) emh_link->base ) - ( (uint8_t*) compact ) );
+    compact->endOff  = endOff;
+    compact->root    = 0;
+    if( 0 != ( emh_link->flags & EMH_HEAP_PERSISTENT ) )
+    {
+        compact->magic = EMH_PERSIST_MAGIC;
+    }
+
+    emh_link->start.nextFree  = NULL;
+    emh_link->start.blockSize = 0;
+    emh_link->rover           = &emh_link->start;
+    emh_link->freeBytes       = endOff;
+    emh_link->remainBytes     = endOff;
+    emh_link->totalBytes      = endOff;
+    return;
+}
+
+#if defined(EMH_MALLOC_USE_MMAP)
+/**
+ * @brief Returns the page size of the system, queried once.
+ * @return size_t 
+ */
+static size_t emh_pageSize(void)
+{
+    static size_t emh_page = 0;
+
+    if( 0 == emh_page )
+    {
+        emh_page = (size_t) sysconf(_SC_PAGESIZE);
+    }
+    return emh_page;
+}
+
+/**
+ * @brief Returns the page size a heap releases its pages with, huge pages must be
+ *        released whole or the kernel splits them.
+ * @param emh_link Pointer to the heap link.
+ * @return size_t 
+ */
+static size_t emh_purgePage(emh_heapLink_t *emh_link)
+{
+    return ( 0 != ( emh_link->flags & EMH_HEAP_HUGE_PAGES ) ) ? EMH_MALLOC_HUGE_PAGE_SIZE : emh_pageSize();
+}
+
+/**
+ * @brief Maps an anonymous region aligned to EMH_MALLOC_HUGE_PAGE_SIZE and backed
+ *        by huge pages, from the hugetlb pool when it has enough pages reserved, 
+ *        through transparent huge pages otherwise.
+ * @param size Size of the region, a multiple of EMH_MALLOC_HUGE_PAGE_SIZE.
+ * @return void* region address or NULL if it could not be mapped.
+ */
+static void* emh_mapHuge(size_t size)
+{
+    uint8_t *addr;
+    size_t  head;
+
+#if defined(MAP_HUGETLB)
+    addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if( MAP_FAILED != addr )
+    {
+        return addr;
+    }
+#endif /* MAP_HUGETLB */
+
+    /* Over-map by a huge page and trim both ends so the region is aligned. */
+    addr = mmap(NULL, size + EMH_MALLOC_HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if( MAP_FAILED == addr )
+    {
+        return NULL;
+    }
+
+    head = ( EMH_MALLOC_HUGE_PAGE_SIZE - ( ( (size_t) addr ) & ( EMH_MALLOC_HUGE_PAGE_SIZE - 1 ) ) ) & ( EMH_MALLOC_HUGE_PAGE_SIZE - 1 );
+    if( 0 != head )
+    {
+        (void) munmap(addr, head);
+    }
+    (void) munmap(addr + head + size, EMH_MALLOC_HUGE_PAGE_SIZE - head);
+    addr += head;
+
+#if defined(MADV_HUGEPAGE)
+    (void) madvise(addr, size, MADV_HUGEPAGE);
+#endif /* MADV_HUGEPAGE */
+    return addr;
+}
+
+/**
+ * @brief Releases the pages lying entirely within the given address range.
+ * @param page Size of the pages to release.
+ * @param lo   First address of the range.
+ * @param hi   Address right after the range.
+ * @return size_t number of bytes released.
+ */
+static size_t emh_purgeRange(size_t page, void *lo, void *hi)
+{
+    size_t loAddr = ( ( (size_t) lo ) + page - 1 ) & ~( page - 1 );
+    size_t hiAddr = ( (size_t) hi ) & ~( page - 1 );
+
+    if( ( loAddr >= hiAddr ) || ( 0 != madvise((void*) loAddr, hiAddr - loAddr, EMH_MALLOC_PURGE_ADVICE) ) )
+    {
+        return 0;
+    }
+    return hiAddr - loAddr;
+}
+
+/**
+ * @brief Releases the pages of a free block of a first-fit or TLSF heap, keeping
+ *        its block link, previous free link and footer in place.
+ * @param page      Size of the pages to release.
+ * @param emh_block Pointer to a free block link.
+ * @return size_t number of bytes released.
+ */
+static size_t emh_purgeFreeBlock(size_t page, emh_blockLink_t *emh_block)
+{
+    return emh_purgeRange(page, ( (uint8_t*) emh_block ) + EMH_MALLOC_MIN_BLOCK_SIZE, ( (uint8_t*) emh_nextPhysBlock(emh_block) ) - sizeof( size_t ));
+}
+
+/**
+ * @brief Releases the pages of every free block of a heap, the heap critical zone 
+ *        must be held. Pool heaps keep their pages.
+ * @param emh_link Pointer to the heap link.
+ * @return size_t number of bytes released.
+ */
+static size_t emh_purgeHeap(emh_heapLink_t *emh_link)
+{
+    emh_blockLink_t *block;
+    emh_tlsf_t      *tlsf;
+    uint32_t        *hdr;
+    uint32_t        offset;
+    size_t          fl, sl;
+    size_t          purged = 0;
+    size_t          page   = emh_purgePage(emh_link);
+
+    switch( emh_link->flags & EMH_HEAP_ENGINE_MASK )
+    {
+        case EMH_HEAP_TLSF:
+            tlsf = emh_link->ctrl;
+            for(fl = 0; fl < EMH_TLSF_FL_COUNT; fl++)
+            {
+                for(sl = 0; sl < EMH_TLSF_SL_COUNT; sl++)
+                {
+                    for(block = tlsf->heads[fl][sl]; NULL != block; block = block->nextFree)
+                    {
+                        purged += emh_purgeFreeBlock(page, block);
+                    }
+                }
+            }
+            break;
+
+        case EMH_HEAP_COMPACT:
+            for(offset = ( (emh_compact_t*) emh_link->ctrl )->head; emh_compactOffset(emh_link, emh_link->end) != offset; offset = hdr[1])
+            {
+                hdr = emh_compactHdr(emh_link, offset);
+                purged += emh_purgeRange(page, hdr + 2, ( (uint8_t*) hdr ) + ( hdr[0] * EMH_COMPACT_UNIT ));
+            }
+            break;
+
+        case EMH_HEAP_ARENA:
+            purged += emh_purgeRange(page, ( (emh_arena_t*) emh_link->ctrl )->top, emh_link->end);
+            break;
+
+        case EMH_HEAP_POOL:
+            break;
+
+        default:
+            for(block = emh_link->start.nextFree; emh_link->end != block; block = block->nextFree)
+            {
+                purged += emh_purgeFreeBlock(page, block);
+            }
+            break;
+    }
+    emh_link->dirtyBytes = 0;
+    return purged;
+}
+
+/**
+ * @brief Unmaps every block of a heap mapped on its own, the heap critical zone
+ *        must be held.
+ * @param emh_link Pointer to the heap link.
+ */
+static void emh_unmapAll(emh_heapLink_t *emh_link)
+{
+    emh_mapped_t *mapped, *next;
+
+    for(mapped = emh_link->mapped; NULL != mapped; mapped = next)
+    {
+        next = mapped->next;
+        emh_pageMapClear((emh_heapId_t)( emh_link - emh_heapLinks ), mapped, mapped->mapSize);
+        (void) munmap(mapped, mapped->mapSize);
+    }
+    emh_link->mapped      = NULL;
+    emh_link->mappedBytes = 0;
+    return;
+}
+#endif /* EMH_MALLOC_USE_MMAP */
+
+/**
+ * @brief Accounts freed bytes on a heap and, on heaps created with EMH_HEAP_PURGE,
+ *        releases the pages of its free blocks once EMH_MALLOC_PURGE_THRESHOLD bytes
+ *        were freed, the heap critical zone must be held.
+ * @param emh_link Pointer to the heap link.
+ * @param size     Number of bytes freed.
+ */
+static void emh_markDirty(emh_heapLink_t *emh_link, size_t size)
+{
+#if defined(EMH_MALLOC_USE_MMAP)
+    emh_link->dirtyBytes += size;
+    if( ( 0 != ( emh_link->flags & EMH_HEAP_PURGE ) ) && ( emh_link->dirtyBytes >= EMH_MALLOC_PURGE_THRESHOLD ) )
+    {
+        (void) emh_purgeHeap(emh_link);
+    }
+#else
+    (void) emh_link;
+    (void) size;
+#endif /* EMH_MALLOC_USE_MMAP */
+    return;
+}
+
+/**
+ * @brief Takes an available heap link, the id of a destroyed heap if any or else the
+ *        lowest id never handed out, skipping ids ending with the bits of
+ *        EMH_MALLOC_HEAP_ID_BITMASK. On success the global critical zone is left
+ *        locked, so the caller can initialise the heap link and release it.
+ * @return emh_heapId_t index of the available heap link or -1 if there is none.
+ */
+static emh_heapId_t emh_acquireHeapLink(void)
+{
+    static int      emh_critZoneInit = 0;
+    emh_heapId_t    emh_heapIdx = 0;
+
+    /* Initialises mutex */
+    if( 0 == emh_critZoneInit )
+    {
+    	__emh_create_zone__();
+    	emh_critZoneInit = 1;
+    }
+    
+    __emh_lock_zone__();
+    /* Ids whose lowest bits are all set would carry the tag of blocks belonging to no heap. */
+    if( EMH_MALLOC_HEAP_ID_BITMASK == ( emh_nUsedIds & EMH_MALLOC_HEAP_ID_BITMASK ) )
+    {
+        emh_nUsedIds++;
+    }
+    if( 0 < emh_nFreeIds )
+    {
+        emh_heapIdx = emh_freeIds[--emh_nFreeIds];
+    }
+    else if( EMH_MALLOC_N_HEAPS > emh_nUsedIds )
+    {
+        emh_heapIdx = (emh_heapId_t) emh_nUsedIds++;
+    }
+    else
+    {
+        /*
+         * No links are available at the moment.
+         * This means the maximum number of manageable heaps was reached.
+         * Therefore return an invalid heap id.
+         */
+        __emh_unlock_zone__();
+        emh_heapIdx = -1;
+        return emh_heapIdx;
+    }
+
+    /* Initialises the heap mutex, this is done only once per heap link. */
+    if( 0 == emh_heapZoneInit[emh_heapIdx] )
+    {
+        __emh_create_heap_zone__(emh_heapIdx);
+        emh_heapZoneInit[emh_heapIdx] = 1;
+    }
+
+#if defined(EMH_MALLOC_REMOTE_FREE)
+    atomic_store(&emh_heapOwner[emh_heapIdx], (size_t) 0);
+    atomic_store(&emh_remoteFree[emh_heapIdx], NULL);
+#endif /* EMH_MALLOC_REMOTE_FREE */
+    return emh_heapIdx;
+}
+
+/**
+ * @brief Gives a heap link back to the registry and leaves the global critical zone,
+ *        which must be held. The heap link end must be NULL.
+ * @param heapId Id number of the heap link.
+ */
+static void emh_releaseHeapLink(emh_heapId_t heapId)
+{
+    emh_freeIds[emh_nFreeIds++] = heapId;
+    __emh_unlock_zone__();
+    return;
+}
+
+/**
+ * @brief Records the region of a new heap on its heap link and on the page map, the
+ *        global critical zone must be held. The heap link is released on failure.
+ * @param heapId   Id number of the heap link.
+ * @param heapAddr First memory address from the heap region.
+ * @param heapSize Size of the heap memory region.
+ * @return int 0 on success, -1 if the region could not be recorded on the page map.
+ */
+static int emh_recordRegion(emh_heapId_t heapId, void *heapAddr, size_t heapSize)
+{
+    if( 0 != emh_pageMapSet(heapId, heapAddr, heapSize, 1) )
+    {
+        emh_releaseHeapLink(heapId);
+        return -1;
+    }
+    emh_heapLinks[heapId].heapAddr = heapAddr;
+    emh_heapLinks[heapId].heapSize = heapSize;
+    return 0;
+}
+
+/**
+ * @brief Initialises heap space and links it into static links array.
+ * @param heapAddr First memory address from the heap region.
+ * @param heapSize Size of the heap memory region.
+ * @return emh_heapId_t heap identifier, which is an index from emh_heapLinks array.
+ */
+emh_heapId_t emh_create(void* heapAddr, size_t heapSize)
+{
+    return emh_create_ex(heapAddr, heapSize, EMH_HEAP_FIRST_FIT);
+}
+
+/**
+ * @brief Initialises heap space with the allocation engine selected by heapFlags
+ *        and links it into static links array.
+ * @param heapAddr  First memory address from the heap region.
+ * @param heapSize  Size of the heap memory region.
+ * @param heapFlags Heap flags, EMH_HEAP_FIRST_FIT, EMH_HEAP_TLSF or EMH_HEAP_COMPACT,
+ *                  optionally combined with EMH_HEAP_BOUNDARY_TAGS (except compact heaps)
+ *                  or EMH_HEAP_PERSISTENT (compact heaps only), and with EMH_HEAP_MAPPED
+ *                  when the region was mapped with mmap and goes with the heap.
+ * @return emh_heapId_t heap identifier, which is an index from emh_heapLinks array.
+ */
+emh_heapId_t emh_create_ex(void* heapAddr, size_t heapSize, unsigned int heapFlags)
+{
+    emh_heapId_t    emh_heapIdx = 0;
+    emh_heapLink_t  *emh_stFreeLink = emh_heapLinks;
+    uint8_t         *alignedAddr;
+    size_t          unsLongAddr;
+    size_t          totHeapSize = heapSize;
+    size_t          ctrlSize = 0;
+
+    /* TLSF heaps carry their control structure at the beginning of the region. */
+    if( EMH_HEAP_TLSF == ( heapFlags & EMH_HEAP_ENGINE_MASK ) )
+    {
+        ctrlSize = ( sizeof( emh_tlsf_t ) + (size_t)( EMH_MALLOC_BYTE_ALIGNMENT - 1 ) ) & ~( (size_t) EMH_MALLOC_BYTE_ALIGN_MASK );
+    }
+    else if( EMH_HEAP_COMPACT == ( heapFlags & EMH_HEAP_ENGINE_MASK ) )
+    {
+        /* Compact blocks have no room for boundary tags. */
+        if( 0 != ( heapFlags & EMH_HEAP_BOUNDARY_TAGS ) )
+        {
+            return -1;
+        }
+        ctrlSize = ( sizeof( emh_compact_t ) + (size_t)( EMH_MALLOC_BYTE_ALIGNMENT - 1 ) ) & ~( (size_t) EMH_MALLOC_BYTE_ALIGN_MASK );
+    }
+    else if( EMH_HEAP_FIRST_FIT != ( heapFlags & EMH_HEAP_ENGINE_MASK ) )
+    {
+        return -1;
+    }
+
+    /* 
+     * Persistent heaps keep every block inside the region and their control structure
+     * at its very beginning, where emh_attach looks for it.
+     */
+    if( ( 0 != ( heapFlags & EMH_HEAP_PERSISTENT ) ) && 
+        ( ( EMH_HEAP_COMPACT != ( heapFlags & EMH_HEAP_ENGINE_MASK ) ) || 
+          ( 0 != ( heapFlags & ( EMH_HEAP_PURGE | EMH_HEAP_DIRECT_MAP | EMH_HEAP_HUGE_PAGES ) ) ) ||
+          ( 0 != ( ( (size_t) heapAddr ) & EMH_MALLOC_BYTE_ALIGN_MASK ) ) ) )
+    {
+        return -1;
+    }
+
+    /* Only first-fit and TLSF heaps may span several regions. */
+    if( ( 0 != ( heapFlags & EMH_HEAP_GROWABLE ) ) && ( EMH_HEAP_FIRST_FIT != ( heapFlags & EMH_HEAP_ENGINE_MASK ) ) && 
+        ( EMH_HEAP_TLSF != ( heapFlags & EMH_HEAP_ENGINE_MASK ) ) )
+    {
+        return -1;
+    }
+
+#if !defined(EMH_MALLOC_USE_MMAP)
+    if( 0 != ( heapFlags & ( EMH_HEAP_GROWABLE | EMH_HEAP_PURGE | EMH_HEAP_DIRECT_MAP | EMH_HEAP_HUGE_PAGES | EMH_HEAP_MAPPED ) ) )
+    {
+        return -1;
+    }
+#endif /* EMH_MALLOC_USE_MMAP */
+
+    /* Placement policies only apply to the first-fit engine. */
+    if( ( EMH_HEAP_POLICY_FIRST != ( heapFlags & EMH_HEAP_POLICY_MASK ) ) && ( EMH_HEAP_FIRST_FIT != ( heapFlags & EMH_HEAP_ENGINE_MASK ) ) )
+    {
+        return -1;
+    }
+
+    /* Is the region large enough for the metadata, the heap end and a single block? */
+    if( ( NULL == heapAddr ) || 
+        ( heapSize < ( ctrlSize + emh_blockLinkSize + EMH_MALLOC_MIN_BLOCK_SIZE + ( EMH_MALLOC_BYTE_ALIGNMENT << 1 ) ) ) )
+    {
+        return -1;
+    }
+
+    emh_heapIdx = emh_acquireHeapLink();
+    if( ( 0 > emh_heapIdx ) || ( 0 != emh_recordRegion(emh_heapIdx, heapAddr, heapSize) ) )
+    {
+        return -1;
+    }
+
+    /*
+     * The address must be aligned. 
+     * Perform necessary corrections.
+     */
+    unsLongAddr = (size_t)( heapAddr );
+    if( 0 != ( unsLongAddr & EMH_MALLOC_BYTE_ALIGN_MASK ) )
+    {
+        unsLongAddr += (EMH_MALLOC_BYTE_ALIGNMENT - 1);
+        unsLongAddr &= ~( (size_t) EMH_MALLOC_BYTE_ALIGN_MASK );
+        totHeapSize -= unsLongAddr - ( (size_t) heapAddr ); 
+    }
+    alignedAddr = (uint8_t*) unsLongAddr;
+
+    emh_stFreeLink[emh_heapIdx].flags = heapFlags;
+    emh_stFreeLink[emh_heapIdx].ctrl  = NULL;
+    if( 0 != ctrlSize )
+    {
+        emh_stFreeLink[emh_heapIdx].ctrl = (void*) alignedAddr;
+        alignedAddr += ctrlSize;
+        totHeapSize -= ctrlSize;
+    }
+
+    if( EMH_HEAP_COMPACT == ( heapFlags & EMH_HEAP_ENGINE_MASK ) )
+    {
+        /*
+         * Payloads are aligned to the compact unit with their header right before
+         * them, the heap end is a header of size zero. Offsets from the heap base
+         * are 32-bit, larger regions are clamped to 4 GiB.
+         */
+        unsLongAddr = ( ( (size_t) alignedAddr ) + EMH_COMPACT_HDR_SIZE + EMH_COMPACT_UNIT - 1 ) & ~( EMH_COMPACT_UNIT - 1 );
+        unsLongAddr -= EMH_COMPACT_HDR_SIZE;
+        totHeapSize  = ( ( ( (size_t) alignedAddr ) + totHeapSize - unsLongAddr - EMH_COMPACT_HDR_SIZE ) / EMH_COMPACT_UNIT ) * EMH_COMPACT_UNIT;
+        if( totHeapSize > EMH_COMPACT_MAX_HEAP )
+        {
+            totHeapSize = ( EMH_COMPACT_MAX_HEAP / EMH_COMPACT_UNIT ) * EMH_COMPACT_UNIT;
+        }
+
+        emh_stFreeLink[emh_heapIdx].base = (void*) unsLongAddr;
+        emh_stFreeLink[emh_heapIdx].end  = (void*)( unsLongAddr + totHeapSize );
+        emh_compactInit(&emh_stFreeLink[emh_heapIdx]);
+        emh_clearStats(&emh_stFreeLink[emh_heapIdx]);
+        emh_nRangeHeaps++;
+        __emh_unlock_zone__();
+        return emh_heapIdx;
+    }
+
+    unsLongAddr = ( (size_t) alignedAddr ) + totHeapSize;
+    unsLongAddr -= emh_blockLinkSize;
+    unsLongAddr &= ~( (size_t) EMH_MALLOC_BYTE_ALIGN_MASK );
+
+    emh_stFreeLink[emh_heapIdx].base     = (void*) alignedAddr;
+    emh_stFreeLink[emh_heapIdx].end      = (void*) unsLongAddr;
+    emh_stFreeLink[emh_heapIdx].firstEnd = (void*) unsLongAddr;
+    emh_stFreeLink[emh_heapIdx].regions  = NULL;
+    emh_stFreeLink[emh_heapIdx].fresh    = ( 0 != ( heapFlags & EMH_HEAP_ZEROED ) ) ? (void*) alignedAddr : (void*) unsLongAddr;
+    emh_initBlocks(&emh_stFreeLink[emh_heapIdx]);
+    emh_clearStats(&emh_stFreeLink[emh_heapIdx]);
+    __emh_unlock_zone__();
+
+    return emh_heapIdx;
+}
+
+#if defined(EMH_MALLOC_USE_MMAP)
+/**
+ * @brief Maps a heap region backed by huge pages and initialises a heap on it, so
+ *        large heaps take far fewer TLB entries. The region is aligned to and sized
+ *        in multiples of EMH_MALLOC_HUGE_PAGE_SIZE, it is taken from the hugetlb
+ *        pool when enough huge pages are reserved and from transparent huge pages
+ *        otherwise. On first-fit heaps, EMH_HEAP_POLICY_SPLIT keeps the small blocks
+ *        packed in the lowest huge pages of the heap, apart from the large blocks.
+ * @param heapSize  Size of the heap, rounded up to a multiple of EMH_MALLOC_HUGE_PAGE_SIZE.
+ * @param heapFlags Heap flags, as accepted by emh_create_ex.
+ * @return emh_heapId_t heap identifier, which is an index from emh_heapLinks array.
+ */
+emh_heapId_t emh_create_huge(size_t heapSize, unsigned int heapFlags)
+{
+    emh_heapId_t emh_heapIdx;
+    void         *addr;
+
+    if( ( 0 == heapSize ) || ( heapSize > ( SIZE_MAX - EMH_MALLOC_HUGE_PAGE_SIZE ) ) )
+    {
+        return -1;
+    }
+
+    heapSize = ( heapSize + EMH_MALLOC_HUGE_PAGE_SIZE - 1 ) & ~( EMH_MALLOC_HUGE_PAGE_SIZE - 1 );
+    addr     = emh_mapHuge(heapSize);
+    if( NULL == addr )
+    {
+        return -1;
+    }
+
+    emh_heapIdx = emh_create_ex(addr, heapSize, heapFlags | EMH_HEAP_HUGE_PAGES | EMH_HEAP_ZEROED | EMH_HEAP_MAPPED);
+    if( 0 > emh_heapIdx )
+    {
+        (void) munmap(addr, heapSize);
+    }
+    return emh_heapIdx;
+}
+
+/**
+ * @brief Maps a heap region on the given memory node and initialises a heap on it,
+ *        to be registered through emh_set_local for the CPUs of the node. Pages
+ *        are placed through the __emh_bind_node__ hook when the port provides it,
+ *        otherwise on first touch, by the threads that allocate from the heap.
+ * @param heapSize  Size of the heap, rounded up to a multiple of the page size.
+ * @param heapFlags Heap flags, as accepted by emh_create_ex.
+ * @param node      Memory node of the heap.
+ * @return emh_heapId_t heap identifier, which is an index from emh_heapLinks array.
+ */
+emh_heapId_t emh_create_node(size_t heapSize, unsigned int heapFlags, unsigned int node)
+{
+    emh_heapId_t emh_heapIdx;
+    void         *addr;
+
+    if( ( 0 == heapSize ) || ( heapSize > ( SIZE_MAX - emh_pageSize() ) ) )
+    {
+        return -1;
+    }
+
+    heapSize = ( heapSize + emh_pageSize() - 1 ) & ~( emh_pageSize() - 1 );
+    addr     = mmap(NULL, heapSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if( MAP_FAILED == addr )
+    {
+        return -1;
+    }
+
+#if defined(__emh_bind_node__)
+    if( 0 != __emh_bind_node__(addr, heapSize, node) )
+    {
+        (void) munmap(addr, heapSize);
+        return -1;
+    }
+#else
+    (void) node;
+#endif /* __emh_bind_node__ */
+
+    emh_heapIdx = emh_create_ex(addr, heapSize, heapFlags | EMH_HEAP_ZEROED | EMH_HEAP_MAPPED);
+    if( 0 > emh_heapIdx )
+    {
+        (void) munmap(addr, heapSize);
+    }
+    return emh_heapIdx;
+}
+#endif /* EMH_MALLOC_USE_MMAP */
+
+/**
+ * @brief Initialises a pool heap, where the heap region is carved into fixed size
+ *        slots. Slots carry no block link and are served from a free stack, which
+ *        is lock-free when C11 atomics are available.
+ * @param heapAddr First memory address from the heap region.
+ * @param heapSize Size of the heap memory region.
+ * @param objSize  Size of the objects served by the pool.
+ * @return emh_heapId_t heap identifier, which is an index from emh_heapLinks array.
+ */
+emh_heapId_t emh_create_pool(void* heapAddr, size_t heapSize, size_t objSize)
+{
+    emh_heapId_t emh_heapIdx = 0;
+    emh_pool_t   *pool;
+    size_t       unsLongAddr;
+    size_t       slotSize;
+    size_t       ctrlSize;
+    size_t       usedSize;
+    size_t       nSlots;
+
+    ctrlSize = ( sizeof( emh_pool_t ) + (size_t)( EMH_MALLOC_BYTE_ALIGNMENT - 1 ) ) & ~( (size_t) EMH_MALLOC_BYTE_ALIGN_MASK );
+
+    /* Free slots must be able to hold the index of the next free slot. */
+    slotSize = ( objSize < sizeof( size_t ) ) ? sizeof( size_t ) : objSize;
+    slotSize = ( slotSize + (size_t)( EMH_MALLOC_BYTE_ALIGNMENT - 1 ) ) & ~( (size_t) EMH_MALLOC_BYTE_ALIGN_MASK );
+
+    if( ( NULL == heapAddr ) || ( 0 == objSize ) || ( objSize > emh_sizeMsk ) ||
+        ( heapSize < ( ctrlSize + slotSize + ( 2 * EMH_MALLOC_BYTE_ALIGNMENT ) ) ) )
+    {
+        return -1;
+    }
+
+    /* The address must be aligned. */
+    unsLongAddr  = (size_t)( heapAddr );
+    unsLongAddr += (EMH_MALLOC_BYTE_ALIGNMENT - 1);
+    unsLongAddr &= ~( (size_t) EMH_MALLOC_BYTE_ALIGN_MASK );
+
+    /* The used bitmap is sized for the slots fitting without it, the slots then fit beside it. */
+    nSlots   = ( heapSize - ( unsLongAddr - ( (size_t) heapAddr ) ) - ctrlSize ) / slotSize;
+    nSlots   = ( nSlots >= EMH_POOL_IDX_MASK ) ? ( EMH_POOL_IDX_MASK - 1 ) : nSlots;
+    usedSize = ( ( nSlots + EMH_POOL_WORD_BITS - 1 ) / EMH_POOL_WORD_BITS ) * sizeof( size_t );
+    usedSize = ( usedSize + (size_t)( EMH_MALLOC_BYTE_ALIGNMENT - 1 ) ) & ~( (size_t) EMH_MALLOC_BYTE_ALIGN_MASK );
+    if( ( heapSize - ( unsLongAddr - ( (size_t) heapAddr ) ) - ctrlSize ) < ( usedSize + slotSize ) )
+    {
+        return -1;
+    }
+
+    emh_heapIdx = emh_acquireHeapLink();
+    if( ( 0 > emh_heapIdx ) || ( 0 != emh_recordRegion(emh_heapIdx, heapAddr, heapSize) ) )
+    {
+        return -1;
+    }
+    heapSize -= unsLongAddr - ( (size_t) heapAddr );
+
+    pool = (void*) unsLongAddr;
+    pool->used     = (void*)( ( (uint8_t*) pool ) + ctrlSize );
+    pool->slots    = ( (uint8_t*) pool ) + ctrlSize + usedSize;
+    pool->slotSize = slotSize;
+    pool->nSlots   = ( heapSize - ctrlSize - usedSize ) / slotSize;
+
+    emh_poolInit(pool);
+
+    emh_heapLinks[emh_heapIdx].flags          = EMH_HEAP_POOL;
+    emh_heapLinks[emh_heapIdx].ctrl           = pool;
+    emh_heapLinks[emh_heapIdx].start.nextFree = NULL;
+    emh_heapLinks[emh_heapIdx].start.blockSize= 0;
+    emh_heapLinks[emh_heapIdx].freeBytes      = pool->nSlots * slotSize;
+    emh_heapLinks[emh_heapIdx].remainBytes    = pool->nSlots * slotSize;
+    emh_heapLinks[emh_heapIdx].totalBytes     = pool->nSlots * slotSize;
+    emh_heapLinks[emh_heapIdx].base           = pool->slots;
+    emh_heapLinks[emh_heapIdx].end            = (void*) emh_poolSlot(pool, pool->nSlots);
+    emh_clearStats(&emh_heapLinks[emh_heapIdx]);
+    emh_nRangeHeaps++;
+    __emh_unlock_zone__();
+
+    return emh_heapIdx;
+}
+
+/**
+ * @brief Initialises an arena heap, where objects are carved by bumping a pointer
+ *        through the heap region. Objects carry no block link and are not released
+ *        one by one, the whole arena is released at once by emh_reset or down to
+ *        a mark taken by emh_arena_mark through emh_arena_rewind.
+ * @param heapAddr First memory address from the heap region.
+ * @param heapSize Size of the heap memory region.
+ * @return emh_heapId_t heap identifier, which is an index from emh_heapLinks array.
+ */
+emh_heapId_t emh_create_arena(void* heapAddr, size_t heapSize)
+{
+    emh_heapId_t emh_heapIdx = 0;
+    emh_arena_t  *arena;
+    size_t       unsLongAddr;
+    size_t       ctrlSize;
+
+    ctrlSize = ( sizeof( emh_arena_t ) + (size_t)( EMH_MALLOC_BYTE_ALIGNMENT - 1 ) ) & ~( (size_t) EMH_MALLOC_BYTE_ALIGN_MASK );
+
+    if( ( NULL == heapAddr ) || ( heapSize < ( ctrlSize + ( EMH_MALLOC_BYTE_ALIGNMENT << 1 ) ) ) )
+    {
+        return -1;
+    }
+
+    emh_heapIdx = emh_acquireHeapLink();
+    if( ( 0 > emh_heapIdx ) || ( 0 != emh_recordRegion(emh_heapIdx, heapAddr, heapSize) ) )
+    {
+        return -1;
+    }
+
+    /* The address must be aligned. */
+    unsLongAddr  = (size_t)( heapAddr );
+    unsLongAddr += (EMH_MALLOC_BYTE_ALIGNMENT - 1);
+    unsLongAddr &= ~( (size_t) EMH_MALLOC_BYTE_ALIGN_MASK );
+    heapSize    -= unsLongAddr - ( (size_t) heapAddr );
+    heapSize    &= ~( (size_t) EMH_MALLOC_BYTE_ALIGN_MASK );
+
+    arena = (void*) unsLongAddr;
+    arena->top  = ( (uint8_t*) arena ) + ctrlSize;
+    arena->last = NULL;
+
+    emh_heapLinks[emh_heapIdx].flags          = EMH_HEAP_ARENA;
+    emh_heapLinks[emh_heapIdx].ctrl           = arena;
+    emh_heapLinks[emh_heapIdx].start.nextFree = NULL;
+    emh_heapLinks[emh_heapIdx].start.blockSize= 0;
+    emh_heapLinks[emh_heapIdx].freeBytes      = heapSize - ctrlSize;
+    emh_heapLinks[emh_heapIdx].remainBytes    = heapSize - ctrlSize;
+    emh_heapLinks[emh_heapIdx].totalBytes     = heapSize - ctrlSize;
+    emh_heapLinks[emh_heapIdx].base           = arena->top;
+    emh_heapLinks[emh_heapIdx].end            = (void*)( unsLongAddr + heapSize );
+    emh_clearStats(&emh_heapLinks[emh_heapIdx]);
+    emh_nRangeHeaps++;
+    __emh_unlock_zone__();
+
+    return emh_heapIdx;
+}
+
+/**
+ * @brief Attaches a persistent compact heap, formatted by emh_create_ex with 
+ *        EMH_HEAP_PERSISTENT, again. The region may be mapped at any address, by
+ *        this process or by another one: blocks are linked through offsets from
+ *        the heap base and carry no heap id. The whole heap is walked first, the
+ *        region is refused unless every block and the free list are consistent.
+ *        The region must not be attached by another process at the same time.
+ * @param heapAddr First memory address from the heap region, as passed to emh_create_ex.
+ * @param heapSize Size of the heap memory region.
+ * @return emh_heapId_t heap identifier, which is an index from emh_heapLinks array.
+ */
+emh_heapId_t emh_attach(void *heapAddr, size_t heapSize)
+{
+    emh_heapId_t  emh_heapIdx;
+    emh_compact_t *compact = heapAddr;
+    uint8_t       *base;
+    uint32_t      *hdr;
+    uint32_t      offset   = 0;
+    uint32_t      freeOff;
+    uint32_t      tag      = EMH_COMPACT_ALLOC_BIT | ( ( (uint32_t) EMH_MALLOC_HEAP_ID_BITMASK ) << EMH_COMPACT_SIZE_BITS );
+    size_t        units;
+    size_t        freeBytes = 0;
+    size_t        nBlocks   = 0;
+
+    if( ( NULL == heapAddr ) || ( 0 != ( ( (size_t) heapAddr ) & EMH_MALLOC_BYTE_ALIGN_MASK ) ) || 
+        ( heapSize < sizeof( emh_compact_t ) ) )
+    {
+        return -1;
+    }
+
+    /* Is the region a persistent heap laid out by a compatible build? */
+    if( ( EMH_PERSIST_MAGIC != compact->magic ) || ( EMH_PERSIST_LAYOUT != compact->layout ) ||
+        ( compact->baseOff < sizeof( emh_compact_t ) ) || ( 0 != ( compact->endOff % EMH_COMPACT_UNIT ) ) ||
+        ( heapSize < ( (size_t) compact->baseOff + (size_t) compact->endOff + EMH_COMPACT_HDR_SIZE ) ) )
+    {
+        return -1;
+    }
+    base = ( (uint8_t*) heapAddr ) + compact->baseOff;
+    if( 0 != ( ( ( (size_t) base ) + EMH_COMPACT_HDR_SIZE ) % EMH_COMPACT_UNIT ) )
+    {
+        return -1;
+    }
+
+    /* Free blocks must appear on the free list in address order, allocated blocks must be tagged. */
+    freeOff = compact->head;
+    while( offset < compact->endOff )
+    {
+        hdr   = (uint32_t*)( base + offset );
+        units = hdr[0] & EMH_COMPACT_SIZE_MASK;
+        if( ( 0 == units ) || ( ( units * EMH_COMPACT_UNIT ) > ( compact->endOff - offset ) ) )
+        {
+            return -1;
+        }
+        if( 0 == ( hdr[0] & ~EMH_COMPACT_SIZE_MASK ) )
+        {
+            if( freeOff != offset )
+            {
+                return -1;
+            }
+            freeOff    = hdr[1];
+            freeBytes += units * EMH_COMPACT_UNIT;
+        }
+        else if( tag == ( hdr[0] & ~EMH_COMPACT_SIZE_MASK ) )
+        {
+            nBlocks++;
+        }
+        else
+        {
+            return -1;
+        }
+        offset += (uint32_t)( units * EMH_COMPACT_UNIT );
+    }
+    if( ( compact->endOff != freeOff ) || ( 0 != *(uint32_t*)( base + compact->endOff ) ) ||
+        ( ( 0 != compact->root ) && ( ( compact->root >= compact->endOff ) || 
+          ( EMH_COMPACT_HDR_SIZE != ( compact->root % EMH_COMPACT_UNIT ) ) ) ) )
+    {
+        return -1;
+    }
+
+    emh_heapIdx = emh_acquireHeapLink();
+    if( ( 0 > emh_heapIdx ) || ( 0 != emh_recordRegion(emh_heapIdx, heapAddr, heapSize) ) )
+    {
+        return -1;
+    }
+
+    emh_heapLinks[emh_heapIdx].flags          = EMH_HEAP_COMPACT | EMH_HEAP_PERSISTENT;
+    emh_heapLinks[emh_heapIdx].ctrl           = compact;
+    emh_heapLinks[emh_heapIdx].base           = base;
+    emh_heapLinks[emh_heapIdx].end            = (void*)( base + compact->endOff );
+    emh_heapLinks[emh_heapIdx].start.nextFree = NULL;
+    emh_heapLinks[emh_heapIdx].start.blockSize= 0;
+    emh_heapLinks[emh_heapIdx].rover          = &emh_heapLinks[emh_heapIdx].start;
+    emh_heapLinks[emh_heapIdx].freeBytes      = freeBytes;
+    emh_heapLinks[emh_heapIdx].remainBytes    = freeBytes;
+    emh_heapLinks[emh_heapIdx].totalBytes     = compact->endOff;
+    emh_clearStats(&emh_heapLinks[emh_heapIdx]);
+    /* Blocks allocated before the heap was attached count as allocations of this process. */
+    emh_heapLinks[emh_heapIdx].nMallocs       = nBlocks;
+    emh_nRangeHeaps++;
+    __emh_unlock_zone__();
+
+    return emh_heapIdx;
+}
+
+#if defined(EMH_MALLOC_USE_MMAP)
+/**
+ * @brief Opens a persistent heap kept on a file, mapped shared so its blocks are
+ *        written back to the file. An empty or new file is sized to heapSize and
+ *        formatted as a compact heap with EMH_HEAP_PERSISTENT, an existing one
+ *        is mapped whole and attached, see emh_attach. The file must not be opened
+ *        by another process until the heap is destroyed.
+ * @param path     Path of the heap file.
+ * @param heapSize Size of a new heap file, ignored when the file exists.
+ * @return emh_heapId_t heap identifier, which is an index from emh_heapLinks array.
+ */
+emh_heapId_t emh_open_file(const char *path, size_t heapSize)
+{
+    emh_heapId_t emh_heapIdx;
+    struct stat  fileStat;
+    void         *addr;
+    int          fd;
+    int          fresh = 0;
+
+    if( NULL == path )
+    {
+        return -1;
+    }
+
+    fd = open(path, O_RDWR | O_CREAT, 0600);
+    if( 0 > fd )
+    {
+        return -1;
+    }
+    if( 0 != fstat(fd, &fileStat) )
+    {
+        (void) close(fd);
+        return -1;
+    }
+
+    if( 0 == fileStat.st_size )
+    {
+        if( ( 0 == heapSize ) || ( 0 != ftruncate(fd, (off_t) heapSize) ) )
+        {
+            (void) close(fd);
+            return -1;
+        }
+        fresh = 1;
+    }
+    else
+    {
+        heapSize = (size_t) fileStat.st_size;
+    }
+
+    /* The mapping outlives the descriptor. */
+    addr = mmap(NULL, heapSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    (void) close(fd);
+    if( MAP_FAILED == addr )
+    {
+        return -1;
+    }
+
+    if( 0 != fresh )
+    {
+        emh_heapIdx = emh_create_ex(addr, heapSize, EMH_HEAP_COMPACT | EMH_HEAP_PERSISTENT | EMH_HEAP_MAPPED);
+    }
+    else
+    {
+        emh_heapIdx = emh_attach(addr, heapSize);
+        if( 0 <= emh_heapIdx )
+        {
+            /* The id is not handed out yet, the mapping goes with the heap on emh_destroy. */
+            emh_heapLinks[emh_heapIdx].flags |= EMH_HEAP_MAPPED;
+        }
+    }
+    if( 0 > emh_heapIdx )
+    {
+        (void) munmap(addr, heapSize);
+    }
+    return emh_heapIdx;
+}
+
+/**
+ * @brief Writes the pages of a persistent heap back to its file and waits for the
+ *        write to complete, the heap is consistent on the file once it returns.
+ * @param heapId Id number of the persistent heap.
+ * @return int 0 on success, -1 if the heap is not persistent or the write failed.
+ */
+int emh_sync(emh_heapId_t heapId)
+{
+    emh_heapLink_t *emh_link;
+    size_t         start;
+    size_t         stop;
+    int            status;
+
+    /* Is heap ID not valid? */
+    if( ( 0 > heapId ) || ( EMH_MALLOC_N_HEAPS <= heapId ) || ( NULL == emh_heapLinks[heapId].end ) ||
+        ( 0 == ( emh_heapLinks[heapId].flags & EMH_HEAP_PERSISTENT ) ) )
+    {
+        return -1;
+    }
+
+    emh_link = &emh_heapLinks[heapId];
+    start    = ( (size_t) emh_link->ctrl ) & ~( emh_pageSize() - 1 );
+    stop     = ( (size_t) emh_link->end ) + EMH_COMPACT_HDR_SIZE;
+
+    __emh_lock_heap_zone__(heapId);
+    status = msync((void*) start, stop - start, MS_SYNC);
+    __emh_unlock_heap_zone__(heapId);
+    return ( 0 == status ) ? 0 : -1;
+}
+#endif /* EMH_MALLOC_USE_MMAP */
+
+/**
+ * @brief Carves an object from an arena heap, the heap critical zone must be held.
+ * @param emh_link  Pointer to the arena heap link.
+ * @param size      Size of the object.
+ * @param alignment Alignment of the object, a power of two.
+ * @return void* object address or NULL if the arena is exhausted.
+ */
+static void* emh_arenaAlloc(emh_heapLink_t *emh_link, size_t size, size_t alignment)
+{
+    emh_arena_t *arena = emh_link->ctrl;
+    size_t      addr   = ( ( (size_t) arena->top ) + alignment - 1 ) & ~( alignment - 1 );
+    size_t      limit  = (size_t) emh_link->end;
+
+    if( ( 0 == size ) || ( addr > limit ) || ( size > ( limit - addr ) ) )
+    {
+        emh_link->nFailures++;
+        return NULL;
+    }
+
+    size = ( size + (size_t)( EMH_MALLOC_BYTE_ALIGNMENT - 1 ) ) & ~( (size_t) EMH_MALLOC_BYTE_ALIGN_MASK );
+    if( size > ( limit - addr ) )
+    {
+        size = limit - addr;
+    }
+
+    arena->last = (uint8_t*) addr;
+    arena->top  = (uint8_t*)( addr + size );
+    emh_link->freeBytes = limit - ( (size_t) arena->top );
+    if ( emh_link->freeBytes < emh_link->remainBytes )
+    {
+        emh_link->remainBytes = emh_link->freeBytes;
+    }
+    emh_link->nMallocs++;
+    return (void*) addr;
+}
+
+/**
+ * @brief Resizes an arena object. The most recent object is resized in place when
+ *        the arena has room for it, any other object is copied to a new one. The 
+ *        heap critical zone must be held.
+ * @param emh_link Pointer to the arena heap link.
+ * @param addr     Address of the object.
+ * @param size     Requested size.
+ * @return void* object address or NULL if the arena is exhausted.
+ */
+static void* emh_arenaResize(emh_heapLink_t *emh_link, uint8_t *addr, size_t size)
+{
+    emh_arena_t *arena = emh_link->ctrl;
+    uint8_t     *top   = arena->top;
+    void        *newAddr;
+
+    /* Objects above the top were released by a rewind or a reset. */
+    if( addr >= top )
+    {
+        return NULL;
+    }
+
+    if( ( addr == arena->last ) && ( size <= (size_t)( (uint8_t*) emh_link->end - addr ) ) )
+    {
+        arena->top = addr;
+        return emh_arenaAlloc(emh_link, size, EMH_MALLOC_BYTE_ALIGNMENT);
+    }
+
+    newAddr = emh_arenaAlloc(emh_link, size, EMH_MALLOC_BYTE_ALIGNMENT);
+    if( NULL != newAddr )
+    {
+        /* The object size is unknown, copy up to the previous top, which bounds it. */
+        memcpy(newAddr, addr, ( size < (size_t)( top - addr ) ) ? size : (size_t)( top - addr ));
+    }
+    return newAddr;
+}
+
+/**
+ * @brief Takes the first free block of a compact heap that fits the requested size
+ *        and splits off the remaining space, the heap critical zone must be held.
+ * @param heapId   Id number of the compact heap.
+ * @param emh_link Pointer to the compact heap link.
+ * @param size     Requested size.
+ * @return void* memory aligned pointer to the allocated memory area or NULL if
+ *         there is no block that fits.
+ */
+static void* emh_compactAlloc(emh_heapId_t heapId, emh_heapLink_t *emh_link, size_t size)
+{
+    emh_compact_t *compact = emh_link->ctrl;
+    uint32_t      endOff   = emh_compactOffset(emh_link, emh_link->end);
+    uint32_t      offset   = endOff;
+    uint32_t      *link    = &compact->head;
+    uint32_t      *hdr     = NULL;
+    uint32_t      *newHdr;
+    size_t        units    = emh_compactUnitsOf(size);
+    size_t        blockUnits;
+    size_t        scanned  = 0;
+
+    /* The free byte count of a persistent heap only covers this process, it may be shared. */
+    if( ( 0 != units ) && ( ( ( units * EMH_COMPACT_UNIT ) <= emh_link->freeBytes ) || ( 0 != ( emh_link->flags & EMH_HEAP_PERSISTENT ) ) ) )
+    {
+        for(offset = *link; endOff != offset; offset = *link)
+        {
+            scanned++;
+            hdr = emh_compactHdr(emh_link, offset);
+            if( ( hdr[0] & EMH_COMPACT_SIZE_MASK ) >= units )
+            {
+                break;
+            }
+            link = &hdr[1];
+        }
+    }
+
+    emh_link->nScanned += scanned;
+    if( scanned > emh_link->maxScanned )
+    {
+        emh_link->maxScanned = scanned;
+    }
+
+    if( endOff == offset )
+    {
+        emh_link->nFailures++;
+        return NULL;
+    }
+
+    /* The remaining space takes the place of the block on the free list. */
+    blockUnits = hdr[0] & EMH_COMPACT_SIZE_MASK;
+    if( blockUnits > units )
+    {
+        newHdr    = emh_compactHdr(emh_link, offset + (uint32_t)( units * EMH_COMPACT_UNIT ));
+        newHdr[0] = (uint32_t)( blockUnits - units );
+        newHdr[1] = hdr[1];
+        *link     = emh_compactOffset(emh_link, newHdr);
+    }
+    else
+    {
+        *link = hdr[1];
+    }
+    hdr[0] = (uint32_t) units | emh_compactTag(emh_link, heapId);
+
+    emh_link->freeBytes -= units * EMH_COMPACT_UNIT;
+    if ( emh_link->freeBytes < emh_link->remainBytes )
+    {
+        emh_link->remainBytes = emh_link->freeBytes;
+    }
+    emh_link->nMallocs++;
+    return (void*)( hdr + 1 );
+}
+
+/**
+ * @brief Links a free block into the address ordered free list of a compact heap,
+ *        merging it with its free neighbours as long as the merged block size fits
+ *        the header, the heap critical zone must be held.
+ * @param emh_link Pointer to the compact heap link.
+ * @param offset   Offset of the free block, whose header holds its size only.
+ */
+static void emh_compactLinkFree(emh_heapLink_t *emh_link, uint32_t offset)
+{
+    emh_compact_t *compact = emh_link->ctrl;
+    uint32_t      endOff   = emh_compactOffset(emh_link, emh_link->end);
+    uint32_t      *link    = &compact->head;
+    uint32_t      *hdr     = emh_compactHdr(emh_link, offset);
+    uint32_t      *prevHdr = NULL;
+    uint32_t      *nextHdr;
+    uint32_t      prevOff  = 0;
+
+    /* The heap end lies above every block, so the walk always stops. */
+    while( *link < offset )
+    {
+        prevOff = *link;
+        prevHdr = emh_compactHdr(emh_link, prevOff);
+        link    = &prevHdr[1];
+    }
+
+    /* Is the block being linked and the block linked after contiguous? */
+    hdr[1] = *link;
+    if( ( endOff != *link ) && ( ( offset + ( hdr[0] * EMH_COMPACT_UNIT ) ) == *link ) )
+    {
+        nextHdr = emh_compactHdr(emh_link, *link);
+        if( ( hdr[0] + nextHdr[0] ) <= EMH_COMPACT_SIZE_MASK )
+        {
+            hdr[0] += nextHdr[0];
+            hdr[1]  = nextHdr[1];
+        }
+    }
+
+    /* Is the block being linked and the one linked before contiguous? */
+    if( ( NULL != prevHdr ) && ( ( prevOff + ( prevHdr[0] * EMH_COMPACT_UNIT ) ) == offset ) &&
+        ( ( prevHdr[0] + hdr[0] ) <= EMH_COMPACT_SIZE_MASK ) )
+    {
+        prevHdr[0] += hdr[0];
+        prevHdr[1]  = hdr[1];
+    }
+    else
+    {
+        *link = offset;
+    }
+    return;
+}
+
+/**
+ * @brief Returns the header of an allocated block of a compact heap, checking that 
+ *        the address is the payload of a block allocated from that heap. Besides the
+ *        tag, the header must lie on a block boundary, found by walking the blocks
+ *        from the last free block below it, so stale headers left inside merged
+ *        free blocks or payload words resembling a header are refused. The heap
+ *        critical zone must be held.
+ * @param heapId   Id number of the compact heap.
+ * @param emh_link Pointer to the compact heap link.
+ * @param addr     Address of the memory region.
+ * @return uint32_t* block header or NULL if addr is not an allocated block.
+ */
+static uint32_t* emh_compactBlockOf(emh_heapId_t heapId, emh_heapLink_t *emh_link, uint8_t *addr)
+{
+    uint32_t *hdr   = (uint32_t*)( addr - EMH_COMPACT_HDR_SIZE );
+    uint32_t offset = emh_compactOffset(emh_link, hdr);
+    uint32_t walk   = 0;
+    uint32_t next;
+    uint32_t units;
+
+    if( ( addr < ( (uint8_t*) emh_link->base ) + EMH_COMPACT_HDR_SIZE ) || ( addr >= (uint8_t*) emh_link->end ) ||
+        ( 0 != ( offset % EMH_COMPACT_UNIT ) ) ||
+        ( emh_compactTag(emh_link, heapId) != ( hdr[0] & ~EMH_COMPACT_SIZE_MASK ) ) )
+    {
+        return NULL;
+    }
+
+    /* The free list is address ordered, its blocks below the header bound the walk. */
+    for(next = ( (emh_compact_t*) emh_link->ctrl )->head; next < offset; next = emh_compactHdr(emh_link, next)[1])
+    {
+        walk = next;
+    }
+    while( walk < offset )
+    {
+        units = emh_compactHdr(emh_link, walk)[0] & EMH_COMPACT_SIZE_MASK;
+        if( 0 == units )
+        {
+            return NULL;
+        }
+        walk += (uint32_t)( units * EMH_COMPACT_UNIT );
+    }
+    return ( walk == offset ) ? hdr : NULL;
+}
+
+/**
+ * @brief Returns an allocated block to a compact heap, taking the heap critical zone.
+ * @param heapId Id number of the compact heap.
+ * @param addr   Address of the memory region.
+ */
+static void emh_compactFree(emh_heapId_t heapId, uint8_t *addr)
+{
+    emh_heapLink_t *emh_link = &emh_heapLinks[heapId];
+    uint32_t       *hdr;
+    size_t         blockSize;
+
+    __emh_lock_heap_zone__(heapId);
+    hdr = emh_compactBlockOf(heapId, emh_link, addr);
+    if( NULL != hdr )
+    {
+        /* Linking may merge the block into its neighbours, only its own extent turns dirty. */
+        hdr[0]   &= EMH_COMPACT_SIZE_MASK;
+        blockSize = hdr[0] * EMH_COMPACT_UNIT;
+        emh_link->freeBytes += blockSize;
+        emh_link->nFrees++;
+        emh_compactLinkFree(emh_link, emh_compactOffset(emh_link, hdr));
+        emh_markDirty(emh_link, blockSize);
+    }
+    __emh_unlock_heap_zone__(heapId);
+    return;
+}
+
+/**
+ * @brief Resizes an allocated block of a compact heap in place, the heap critical
+ *        zone must be held. Shrinking splits off the tail of the block as a free
+ *        block, growing merges the next physical block when it is free and large enough.
+ * @param emh_link Pointer to the compact heap link.
+ * @param hdr      Pointer to the block header.
+ * @param units    Requested number of units, including the header.
+ * @return int 1 if the block was resized, 0 otherwise.
+ */
+static int emh_compactResize(emh_heapLink_t *emh_link, uint32_t *hdr, size_t units)
+{
+    emh_compact_t *compact    = emh_link->ctrl;
+    uint32_t      offset      = emh_compactOffset(emh_link, hdr);
+    size_t        blockUnits  = hdr[0] & EMH_COMPACT_SIZE_MASK;
+    uint32_t      next        = offset + (uint32_t)( blockUnits * EMH_COMPACT_UNIT );
+    uint32_t      *nextHdr    = emh_compactHdr(emh_link, next);
+    uint32_t      *newHdr;
+    uint32_t      *link;
+    size_t        nextUnits;
+
+    if( units <= blockUnits )
+    {
+        if( units < blockUnits )
+        {
+            hdr[0] = ( hdr[0] & ~EMH_COMPACT_SIZE_MASK ) | (uint32_t) units;
+            newHdr = emh_compactHdr(emh_link, offset + (uint32_t)( units * EMH_COMPACT_UNIT ));
+            newHdr[0] = (uint32_t)( blockUnits - units );
+            emh_link->freeBytes += ( blockUnits - units ) * EMH_COMPACT_UNIT;
+            emh_compactLinkFree(emh_link, emh_compactOffset(emh_link, newHdr));
+        }
+        return 1;
+    }
+
+    /* Is the next physical block free and large enough? The heap end has a size of zero. */
+    nextUnits = nextHdr[0] & EMH_COMPACT_SIZE_MASK;
+    if( ( 0 == nextUnits ) || ( 0 != ( nextHdr[0] & EMH_COMPACT_ALLOC_BIT ) ) || ( ( blockUnits + nextUnits ) < units ) )
+    {
+        return 0;
+    }
+
+    for(link = &compact->head; *link != next; link = &emh_compactHdr(emh_link, *link)[1]);
+
+    /* The remaining space takes the place of the next block on the free list. */
+    if( ( blockUnits + nextUnits ) > units )
+    {
+        newHdr    = emh_compactHdr(emh_link, offset + (uint32_t)( units * EMH_COMPACT_UNIT ));
+        newHdr[1] = nextHdr[1];
+        newHdr[0] = (uint32_t)( blockUnits + nextUnits - units );
+        *link     = emh_compactOffset(emh_link, newHdr);
+    }
+    else
+    {
+        *link = nextHdr[1];
+    }
+    hdr[0] = ( hdr[0] & ~EMH_COMPACT_SIZE_MASK ) | (uint32_t) units;
+
+    emh_link->freeBytes -= ( units - blockUnits ) * EMH_COMPACT_UNIT;
+    if ( emh_link->freeBytes < emh_link->remainBytes )
+    {
+        emh_link->remainBytes = emh_link->freeBytes;
+    }
+    return 1;
+}
+
+/**
+ * @brief Reallocates a block of a compact heap, in place when possible, otherwise 
+ *        by copying it to a new block of the same heap.
+ * @param heapId Id number of the compact heap.
+ * @param addr   Address of the memory region.
+ * @param size   Requested size, not zero.
+ * @return void* 
+ */
+static void* emh_compactRealloc(emh_heapId_t heapId, uint8_t *addr, size_t size)
+{
+    emh_heapLink_t *emh_link = &emh_heapLinks[heapId];
+    uint32_t       *hdr;
+    size_t         units = emh_compactUnitsOf(size);
+    size_t         capacity = 0;
+    int            resized  = 0;
+    void           *newAddr;
+
+    __emh_lock_heap_zone__(heapId);
+    hdr = emh_compactBlockOf(heapId, emh_link, addr);
+    if( ( NULL != hdr ) && ( 0 != units ) )
+    {
+        capacity = ( ( hdr[0] & EMH_COMPACT_SIZE_MASK ) * EMH_COMPACT_UNIT ) - EMH_COMPACT_HDR_SIZE;
+        resized  = emh_compactResize(emh_link, hdr, units);
+    }
+    __emh_unlock_heap_zone__(heapId);
+
+    if( 0 != resized )
+    {
+        return addr;
+    }
+    if( 0 == capacity )
+    {
+        return NULL;
+    }
+
+    newAddr = emh_mallocImpl(heapId, size);
+    if( NULL != newAddr )
+    {
+        /* Only growing reaches this point, copy the whole previous block. */
+        memcpy(newAddr, addr, capacity);
+        emh_compactFree(heapId, addr);
+    }
+    return newAddr;
+}
+
+/**
+ * @brief Sets the root block of a persistent heap, kept on the heap itself so the
+ *        data reachable from it is found again once the heap is attached.
+ * @param heapId Id number of the persistent heap.
+ * @param addr   Address of a block allocated from the heap, NULL to clear the root.
+ * @return int 0 on success, -1 if the heap is not persistent or addr is not a block of it.
+ */
+int emh_set_root(emh_heapId_t heapId, void *addr)
+{
+    emh_heapLink_t *emh_link;
+    emh_compact_t  *compact;
+    int            status = 0;
+
+    /* Is heap ID not valid? */
+    if( ( 0 > heapId ) || ( EMH_MALLOC_N_HEAPS <= heapId ) || ( NULL == emh_heapLinks[heapId].end ) ||
+        ( 0 == ( emh_heapLinks[heapId].flags & EMH_HEAP_PERSISTENT ) ) )
+    {
+        return -1;
+    }
+
+    emh_link = &emh_heapLinks[heapId];
+    compact  = emh_link->ctrl;
+    __emh_lock_heap_zone__(heapId);
+    if( NULL == addr )
+    {
+        compact->root = 0;
+    }
+    else if( ( (uint8_t*) addr < (uint8_t*) emh_link->end ) && 
+             ( NULL != emh_compactBlockOf(heapId, emh_link, addr) ) )
+    {
+        compact->root = emh_compactOffset(emh_link, addr);
+    }
+    else
+    {
+        status = -1;
+    }
+    __emh_unlock_heap_zone__(heapId);
+    return status;
+}
+
+/**
+ * @brief Returns the root block of a persistent heap, see emh_set_root.
+ * @param heapId Id number of the persistent heap.
+ * @return void* root block address or NULL if the heap has no root.
+ */
+void* emh_get_root(emh_heapId_t heapId)
+{
+    emh_heapLink_t *emh_link;
+    void           *addr = NULL;
+
+    /* Is heap ID not valid? */
+    if( ( 0 > heapId ) || ( EMH_MALLOC_N_HEAPS <= heapId ) || ( NULL == emh_heapLinks[heapId].end ) ||
+        ( 0 == ( emh_heapLinks[heapId].flags & EMH_HEAP_PERSISTENT ) ) )
+    {
+        return NULL;
+    }
+
+    emh_link = &emh_heapLinks[heapId];
+    __emh_lock_heap_zone__(heapId);
+    if( 0 != ( (emh_compact_t*) emh_link->ctrl )->root )
+    {
+        addr = emh_compactHdr(emh_link, ( (emh_compact_t*) emh_link->ctrl )->root);
+    }
+    __emh_unlock_heap_zone__(heapId);
+    return addr;
+}
+
+/**
+ * @brief Chains an additional memory region to the first-fit or TLSF heap specified
+ *        by heapId, so the heap spans several regions. Blocks are allocated from any
+ *        region of the heap but never merged across regions.
+ * @param heapId Id number of the heap.
+ * @param addr   First memory address from the region.
+ * @param size   Size of the region.
+ * @return int 0 on success, -1 if the heap id is not valid, the heap is neither a
+ *         first-fit nor a TLSF heap or the region is too small.
+ */
+int emh_extend(emh_heapId_t heapId, void *addr, size_t size)
+{
+    emh_heapLink_t *emh_link;
+    int            ret;
+
+    /* Is heap ID not valid? */
+    if( ( 0 > heapId ) || ( EMH_MALLOC_N_HEAPS <= heapId ) || ( NULL == emh_heapLinks[heapId].end ) ||
+        ( ( EMH_HEAP_FIRST_FIT != ( emh_heapLinks[heapId].flags & EMH_HEAP_ENGINE_MASK ) ) && 
+          ( EMH_HEAP_TLSF != ( emh_heapLinks[heapId].flags & EMH_HEAP_ENGINE_MASK ) ) ) )
+    {
+        return -1;
+    }
+
+    emh_link = &emh_heapLinks[heapId];
+    __emh_lock_heap_zone__(heapId);
+    ret = emh_addRegion(emh_link, addr, size, 0);
+    __emh_unlock_heap_zone__(heapId);
+    return ret;
+}
+
+/**
+ * @brief Releases every block of the heap specified by heapId at once, leaving it
+ *        as it was right after its creation. Works on every heap kind, the caller
+ *        must ensure no block of the heap is used afterwards. Blocks of the heap
+ *        held by per-thread caches are dropped by each thread on its next access.
+ * @param heapId Id number of the heap.
+ * @return int 0 on success, -1 if the heap id is not valid.
+ */
+int emh_reset(emh_heapId_t heapId)
+{
+    emh_heapLink_t *emh_link;
+    emh_arena_t    *arena;
+
+    /* Is heap ID not valid? */
+    if( ( 0 > heapId ) || ( EMH_MALLOC_N_HEAPS <= heapId ) || ( NULL == emh_heapLinks[heapId].end ) )
+    {
+        return -1;
+    }
+
+    emh_link = &emh_heapLinks[heapId];
+    __emh_lock_heap_zone__(heapId);
+#if defined(EMH_MALLOC_USE_MMAP)
+    emh_unmapAll(emh_link);
+    emh_link->dirtyBytes = 0;
+#endif /* EMH_MALLOC_USE_MMAP */
+    switch( emh_link->flags & EMH_HEAP_ENGINE_MASK )
+    {
+        case EMH_HEAP_POOL:
+            emh_poolInit(emh_link->ctrl);
+            emh_link->freeBytes   = emh_link->totalBytes;
+            emh_link->remainBytes = emh_link->totalBytes;
+            break;
+
+        case EMH_HEAP_COMPACT:
+            emh_compactInit(emh_link);
+            break;
+
+        case EMH_HEAP_ARENA:
+            arena = emh_link->ctrl;
+            arena->top  = emh_link->base;
+            arena->last = NULL;
+            emh_link->freeBytes   = emh_link->totalBytes;
+            emh_link->remainBytes = emh_link->totalBytes;
+            break;
+
+        default:
+#if defined(EMH_MALLOC_REMOTE_FREE)
+            /* Blocks waiting on the remote free list vanish with the rest. */
+            atomic_store(&emh_remoteFree[heapId], NULL);
+#endif /* EMH_MALLOC_REMOTE_FREE */
+            emh_initBlocks(emh_link);
+            break;
+    }
+    emh_clearStats(emh_link);
+    emh_link->generation++;
+    __emh_unlock_heap_zone__(heapId);
+
+#if defined(EMH_MALLOC_USE_PROFILE)
+    emh_profileDropHeap(heapId);
+#endif /* EMH_MALLOC_USE_PROFILE */
+    return 0;
+}
+
+/**
+ * @brief Destroys the heap specified by heapId and gives its id back, the next heap
+ *        created may take it. Blocks mapped on their own and regions mapped by a
+ *        growable heap are unmapped, so is the heap region of heaps created with
+ *        EMH_HEAP_MAPPED, other regions are handed back to the caller untouched.
+ *        The caller must ensure no block of the heap is used afterwards. Blocks of
+ *        the heap held by per-thread caches are dropped by each thread on its next
+ *        access.
+ * @param heapId Id number of the heap.
+ * @return int 0 on success, -1 if the heap id is not valid.
+ */
+int emh_destroy(emh_heapId_t heapId)
+{
+    emh_heapLink_t *emh_link;
+    emh_region_t   *region, *next;
+    void           *heapAddr;
+    size_t         heapSize;
+    size_t         generation;
+    unsigned int   flags;
+    unsigned int   engine;
+    int            cpu;
+
+    /* Is heap ID not valid? */
+    if( ( 0 > heapId ) || ( EMH_MALLOC_N_HEAPS <= heapId ) || ( NULL == emh_heapLinks[heapId].end ) )
+    {
+        return -1;
+    }
+
+    emh_link = &emh_heapLinks[heapId];
+    __emh_lock_heap_zone__(heapId);
+#if defined(EMH_MALLOC_USE_MMAP)
+    emh_unmapAll(emh_link);
+#endif /* EMH_MALLOC_USE_MMAP */
+#if defined(EMH_MALLOC_REMOTE_FREE)
+    atomic_store(&emh_remoteFree[heapId], NULL);
+    atomic_store(&emh_heapOwner[heapId], (size_t) 0);
+#endif /* EMH_MALLOC_REMOTE_FREE */
+    for(region = emh_link->regions; NULL != region; region = next)
+    {
+        next = region->next;
+        emh_pageMapClear(heapId, region, ( ( (size_t) region->end ) + emh_blockLinkSize ) - (size_t) region);
+#if defined(EMH_MALLOC_USE_MMAP)
+        if( 0 != region->mapSize )
+        {
+            (void) munmap(region, region->mapSize);
+        }
+#endif /* EMH_MALLOC_USE_MMAP */
+    }
+    emh_pageMapClear(heapId, emh_link->heapAddr, emh_link->heapSize);
+    heapAddr   = emh_link->heapAddr;
+    heapSize   = emh_link->heapSize;
+    flags      = emh_link->flags;
+    generation = emh_link->generation + 1;
+    __emh_unlock_heap_zone__(heapId);
+
+#if defined(EMH_MALLOC_USE_PROFILE)
+    emh_profileDropHeap(heapId);
+#endif /* EMH_MALLOC_USE_PROFILE */
+
+    __emh_lock_zone__();
+    for(cpu = 0; cpu <= EMH_MALLOC_MAX_CPUS; cpu++)
+    {
+        if( ( heapId + 1 ) == emh_localHeaps[cpu] )
+        {
+            emh_localHeaps[cpu] = 0;
+        }
+    }
+    engine = flags & EMH_HEAP_ENGINE_MASK;
+    if( ( EMH_HEAP_POOL == engine ) || ( EMH_HEAP_ARENA == engine ) || ( EMH_HEAP_COMPACT == engine ) )
+    {
+        emh_nRangeHeaps--;
+    }
+    /* The generation outlives the heap, per-thread caches tell a new heap on the same id apart. */
+    memset(emh_link, 0x00, sizeof( emh_heapLink_t ));
+    emh_link->generation = generation;
+    emh_releaseHeapLink(heapId);
+
+#if defined(EMH_MALLOC_USE_MMAP)
+    if( 0 != ( flags & EMH_HEAP_MAPPED ) )
+    {
+        (void) munmap(heapAddr, heapSize);
+    }
+#else
+    (void) heapAddr;
+    (void) heapSize;
+#endif /* EMH_MALLOC_USE_MMAP */
+    return 0;
+}
+
+/**
+ * @brief Takes a mark of the current top of an arena heap, every object allocated
+ *        after the mark is released by emh_arena_rewind.
+ * @param heapId Id number of the arena heap.
+ * @return size_t mark, zero when the heap is not an arena (a mark of zero rewinds
+ *         the whole arena).
+ */
+size_t emh_arena_mark(emh_heapId_t heapId)
+{
+    size_t mark = 0;
+
+    /* Is heap ID not valid? */
+    if( ( 0 > heapId ) || ( EMH_MALLOC_N_HEAPS <= heapId ) || ( NULL == emh_heapLinks[heapId].end ) ||
+        ( EMH_HEAP_ARENA != ( emh_heapLinks[heapId].flags & EMH_HEAP_ENGINE_MASK ) ) )
+    {
+        return mark;
+    }
+
+    __emh_lock_heap_zone__(heapId);
+    mark = (size_t)( ( (emh_arena_t*) emh_heapLinks[heapId].ctrl )->top - (uint8_t*) emh_heapLinks[heapId].base );
+    __emh_unlock_heap_zone__(heapId);
+    return mark;
+}
+
+/**
+ * @brief Releases every object allocated on an arena heap after the given mark.
+ * @param heapId Id number of the arena heap.
+ * @param mark   Mark taken by emh_arena_mark.
+ * @return int 0 on success, -1 if the heap is not an arena or the mark lies above
+ *         the current top.
+ */
+int emh_arena_rewind(emh_heapId_t heapId, size_t mark)
+{
+    emh_heapLink_t *emh_link;
+    emh_arena_t    *arena;
+    int            ret = -1;
+
+    /* Is heap ID not valid? */
+    if( ( 0 > heapId ) || ( EMH_MALLOC_N_HEAPS <= heapId ) || ( NULL == emh_heapLinks[heapId].end ) ||
+        ( EMH_HEAP_ARENA != ( emh_heapLinks[heapId].flags & EMH_HEAP_ENGINE_MASK ) ) )
+    {
+        return ret;
+    }
+
+    emh_link = &emh_heapLinks[heapId];
+    arena    = emh_link->ctrl;
+    __emh_lock_heap_zone__(heapId);
+    if( mark <= (size_t)( arena->top - (uint8_t*) emh_link->base ) )
+    {
+        /* Like emh_reset, the accounting restarts from the new top. */
+        arena->top  = (uint8_t*) emh_link->base + mark;
+        arena->last = NULL;
+        emh_link->freeBytes   = emh_link->totalBytes - mark;
+        emh_link->remainBytes = emh_link->freeBytes;
+        ret = 0;
+    }
+    __emh_unlock_heap_zone__(heapId);
+    return ret;
+}
+
+/**
+ * @brief Converts a requested size into an aligned block size, including the block link.
+ * @param emh_link Pointer to the heap link.
+ * @param size     Requested size.
+ * @return size_t block size or 0 if the requested size is not valid.
+ */
+static size_t emh_blockSizeOf(emh_heapLink_t *emh_link, size_t size)
+{
+    /*
+     * Check if the requested size is valid and can fit the
+     * allocation control bit.
+     */
+    if( ( 0 == size ) || ( size >= ( emh_sizeMsk - emh_blockLinkSize - EMH_MALLOC_BYTE_ALIGNMENT ) ) )
+    {
+        return 0;
+    }
+
+    /* Perform necessary corrections on requested size. */
+    size += emh_blockLinkSize;
+    if( 0 != ( size & EMH_MALLOC_BYTE_ALIGN_MASK ) )
+    {
+        size += ( EMH_MALLOC_BYTE_ALIGNMENT - ( size & EMH_MALLOC_BYTE_ALIGN_MASK ) );
+    }
+
+    /* Free blocks of boundary tagged heaps hold the previous free link and the footer. */
+    if( ( size < EMH_MALLOC_MIN_BLOCK_SIZE ) && emh_isTagged(emh_link) )
+    {
+        size = EMH_MALLOC_MIN_BLOCK_SIZE;
+    }
+    return size;
+}
+
+/**
+ * @brief Returns the fresh mark of the region holding a block of a first-fit or TLSF
+ *        heap. Only the primary region and the last region added are tracked, older
+ *        regions are deemed used as a whole.
+ * @param emh_link  Pointer to the heap link.
+ * @param emh_block Pointer to the block.
+ * @return void** location of the mark or NULL if the region is not tracked.
+ */
+static void** emh_freshMark(emh_heapLink_t *emh_link, emh_blockLink_t *emh_block)
+{
+    uint8_t *addr = (uint8_t*) emh_block;
+
+    if( ( addr >= (uint8_t*) emh_link->base ) && ( addr < (uint8_t*) emh_link->firstEnd ) )
+    {
+        return &emh_link->fresh;
+    }
+    if( ( NULL != emh_link->regions ) && ( addr > (uint8_t*) emh_link->regions ) && ( addr < (uint8_t*) emh_link->regions->end ) )
+    {
+        return &emh_link->regions->fresh;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Tells whether a block taken from the free lists lies on zero filled memory
+ *        never handed out before, i.e. at or above the fresh mark of its region. Such
+ *        a block only holds the free block links written by the heap.
+ * @param emh_link  Pointer to the heap link.
+ * @param emh_block Pointer to the block.
+ * @return int 
+ */
+static int emh_isFresh(emh_heapLink_t *emh_link, emh_blockLink_t *emh_block)
+{
+    void **mark = emh_freshMark(emh_link, emh_block);
+
+    return ( NULL != mark ) && ( (uint8_t*) emh_block >= (uint8_t*) *mark );
+}
+
+/**
+ * @brief Moves the fresh mark of the region holding a block past the end of the block,
+ *        which is about to be handed out, the heap critical zone must be held.
+ * @param emh_link  Pointer to the heap link.
+ * @param emh_block Pointer to the block.
+ */
+static void emh_markUsed(emh_heapLink_t *emh_link, emh_blockLink_t *emh_block)
+{
+    void **mark = emh_freshMark(emh_link, emh_block);
+    void *end   = emh_nextPhysBlock(emh_block);
+
+    if( ( NULL != mark ) && ( (uint8_t*) *mark < (uint8_t*) end ) )
+    {
+        *mark = end;
+    }
+    return;
+}
+
+/**
+ * @brief Tags a block taken from the free lists as allocated and updates the heap 
+ *        link metadata, the heap critical zone must be held.
+ * @param heapId   Id number of the heap.
+ * @param emh_link Pointer to the heap link.
+ * @param block    Pointer to the block.
+ * @return void* memory aligned pointer to the allocated memory area.
+ */
+static void* emh_markAllocated(emh_heapId_t heapId, emh_heapLink_t *emh_link, emh_blockLink_t *block)
+{
+    emh_link->freeBytes -= block->blockSize & emh_sizeMsk;
+    if ( emh_link->freeBytes < emh_link->remainBytes )
+    {
+        emh_link->remainBytes = emh_link->freeBytes;
+    }
+    emh_link->nMallocs++;
+    emh_markUsed(emh_link, block);
+
+    block->blockSize |= emh_allocBit;
+    block->blockSize |= emh_packHeapId(heapId);
+    block->nextFree = NULL;
+
+    return ( void* )( ( ( uint8_t* ) block ) + emh_blockLinkSize );
+}
+
+/**
+ * @brief Returns an allocated block to its heap link, the heap critical zone must be held.
+ * @param emh_link  Pointer to the heap link.
+ * @param emh_block Pointer to the allocated block.
+ */
+static void emh_heapFree(emh_heapLink_t *emh_link, emh_blockLink_t *emh_block)
+{
+    size_t blockSize;
+
+    emh_block->blockSize &= ~(emh_allocBit | emh_heapIdMsk);
+    blockSize = emh_block->blockSize & emh_sizeMsk;
+    emh_link->freeBytes += blockSize;
+    emh_link->nFrees++;
+
+    if( emh_isTagged(emh_link) )
+    {
+        emh_tagLinkFreeBlock(emh_link, emh_block);
+    }
+    else
+    {
+        emh_linkFreeBlock(emh_link, emh_block);
+    }
+    emh_markDirty(emh_link, blockSize);
+    return;
+}
+
+#if defined(EMH_MALLOC_USE_MMAP)
+/**
+ * @brief Serves a request with a mapping of its own, tagged with the heap id so
+ *        emh_free finds the heap it belongs to.
+ * @param heapId   Id number of the heap.
+ * @param emh_link Pointer to the heap link.
+ * @param size     Size of memory to be allocated.
+ * @return void* memory aligned pointer to the allocated memory area.
+ */
+static void* emh_mapAlloc(emh_heapId_t heapId, emh_heapLink_t *emh_link, size_t size)
+{
+    size_t          page = emh_pageSize();
+    size_t          mapSize;
+    emh_mapped_t    *mapped = MAP_FAILED;
+    emh_blockLink_t *block;
+
+    if( size <= ( ( (size_t) -1 ) - emh_mappedSize - emh_blockLinkSize - page ) )
+    {
+        mapSize = ( size + emh_mappedSize + emh_blockLinkSize + page - 1 ) & ~( page - 1 );
+        mapped  = mmap(NULL, mapSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if( ( MAP_FAILED != mapped ) && ( 0 != emh_pageMapSet(heapId, mapped, mapSize, 0) ) )
+        {
+            (void) munmap(mapped, mapSize);
+            mapped = MAP_FAILED;
+        }
+    }
+
+    __emh_lock_heap_zone__(heapId);
+    if( MAP_FAILED == mapped )
+    {
+        emh_link->nFailures++;
+        __emh_unlock_heap_zone__(heapId);
+        return NULL;
+    }
+
+    mapped->mapSize = mapSize;
+    mapped->prev    = NULL;
+    mapped->next    = emh_link->mapped;
+    if( NULL != mapped->next )
+    {
+        mapped->next->prev = mapped;
+    }
+    emh_link->mapped       = mapped;
+    emh_link->mappedBytes += mapSize;
+    emh_link->nMallocs++;
+    __emh_unlock_heap_zone__(heapId);
+
+    block = (void*)( ( (uint8_t*) mapped ) + emh_mappedSize );
+    block->blockSize = emh_mappedBit | emh_allocBit | emh_packHeapId(heapId);
+    block->nextFree  = NULL;
+    return ( void* )( ( ( uint8_t* ) block ) + emh_blockLinkSize );
+}
+
+/**
+ * @brief Tells whether a block link belongs to an allocated block mapped on its own.
+ * @param emh_block Pointer to a block link.
+ * @return int 
+ */
+static int emh_isMapped(emh_blockLink_t *emh_block)
+{
+    return ( ( emh_mappedBit | emh_allocBit ) == ( emh_block->blockSize & ( emh_mappedBit | emh_allocBit ) ) ) &&
+           ( NULL == emh_block->nextFree );
+}
+
+/**
+ * @brief Unmaps a block mapped on its own.
+ * @param heapId    Id number of the heap the block belongs to.
+ * @param emh_block Pointer to the block link.
+ */
+static void emh_mapFree(emh_heapId_t heapId, emh_blockLink_t *emh_block)
+{
+    emh_heapLink_t *emh_link = &emh_heapLinks[heapId];
+    emh_mapped_t   *mapped   = (void*)( ( (uint8_t*) emh_block ) - emh_mappedSize );
+
+    __emh_lock_heap_zone__(heapId);
+    if( NULL != mapped->prev )
+    {
+        mapped->prev->next = mapped->next;
+    }
+    else
+    {
+        emh_link->mapped = mapped->next;
+    }
+    if( NULL != mapped->next )
+    {
+        mapped->next->prev = mapped->prev;
+    }
+    emh_link->mappedBytes -= mapped->mapSize;
+    emh_link->nFrees++;
+    __emh_unlock_heap_zone__(heapId);
+
+    emh_pageMapClear(heapId, mapped, mapped->mapSize);
+    (void) munmap(mapped, mapped->mapSize);
+    return;
+}
+
+/**
+ * @brief Reallocates a block mapped on its own. Growing beyond the mapping copies the
+ *        block to a new block of the same heap. Shrinking below EMH_MALLOC_MMAP_THRESHOLD
+ *        moves the block into the heap when it has room for it, otherwise the pages of
+ *        the mapping beyond the block are unmapped once they add up to the threshold.
+ * @param heapId    Id number of the heap the block belongs to.
+ * @param emh_block Pointer to the block link.
+ * @param size      Requested size, not zero.
+ * @return void* 
+ */
+static void* emh_mapRealloc(emh_heapId_t heapId, emh_blockLink_t *emh_block, size_t size)
+{
+    emh_heapLink_t *emh_link = &emh_heapLinks[heapId];
+    emh_mapped_t   *mapped   = (void*)( ( (uint8_t*) emh_block ) - emh_mappedSize );
+    size_t         capacity  = mapped->mapSize - emh_mappedSize - emh_blockLinkSize;
+    size_t         page      = emh_pageSize();
+    size_t         mapSize, tailSize;
+    void           *addr     = ( void* )( ( ( uint8_t* ) emh_block ) + emh_blockLinkSize );
+    void           *newAddr;
+
+    if( size > capacity )
+    {
+        newAddr = emh_mallocImpl(heapId, size);
+        if( NULL != newAddr )
+        {
+            memcpy(newAddr, addr, capacity);
+            emh_mapFree(heapId, emh_block);
+        }
+        return newAddr;
+    }
+
+    if( size < EMH_MALLOC_MMAP_THRESHOLD )
+    {
+        newAddr = emh_mallocImpl(heapId, size);
+        if( NULL != newAddr )
+        {
+            memcpy(newAddr, addr, size);
+            emh_mapFree(heapId, emh_block);
+            return newAddr;
+        }
+    }
+
+    mapSize  = ( size + emh_mappedSize + emh_blockLinkSize + page - 1 ) & ~( page - 1 );
+    tailSize = mapped->mapSize - mapSize;
+    if( tailSize >= EMH_MALLOC_MMAP_THRESHOLD )
+    {
+        __emh_lock_heap_zone__(heapId);
+        mapped->mapSize        = mapSize;
+        emh_link->mappedBytes -= tailSize;
+        __emh_unlock_heap_zone__(heapId);
+
+        emh_pageMapClear(heapId, ( (uint8_t*) mapped ) + mapSize, tailSize);
+        (void) munmap(( (uint8_t*) mapped ) + mapSize, tailSize);
+    }
+    return addr;
+}
+#endif /* EMH_MALLOC_USE_MMAP */
+
+#if defined(EMH_MALLOC_REMOTE_FREE)
+/**
+ * @brief Returns the blocks on the remote free list of a heap to its free lists,
+ *        the heap critical zone must be held.
+ * @param heapId   Id number of the heap.
+ * @param emh_link Pointer to the heap link.
+ */
+static void emh_drainRemote(emh_heapId_t heapId, emh_heapLink_t *emh_link)
+{
+    emh_blockLink_t *block, *next;
+
+    if( NULL == atomic_load_explicit(&emh_remoteFree[heapId], memory_order_relaxed) )
+    {
+        return;
+    }
+
+    /* Producers only push, so the whole list is taken with a single exchange. */
+    block = atomic_exchange_explicit(&emh_remoteFree[heapId], NULL, memory_order_acquire);
+    /* The list ends at a heap end, which may no longer be the last one of a heap spanning several regions. */
+    while( ( NULL != block ) && ( 0 != ( block->blockSize & emh_sizeMsk ) ) )
+    {
+        next = block->nextFree;
+        block->nextFree = NULL;
+        emh_heapFree(emh_link, block);
+        block = next;
+    }
+    return;
+}
+
+/**
+ * @brief Pushes an allocated block on the remote free list of its heap when the 
+ *        calling thread does not own the heap, without taking the heap critical zone.
+ * @param heapId    Id number of the heap the block belongs to.
+ * @param emh_block Pointer to the allocated block.
+ * @return int 1 if the block was pushed, 0 if it must be released to the heap.
+ */
+static int emh_remoteFreeBlock(emh_heapId_t heapId, emh_blockLink_t *emh_block)
+{
+    size_t          owner = atomic_load_explicit(&emh_heapOwner[heapId], memory_order_relaxed);
+    emh_blockLink_t *head;
+
+    if( ( 0 == owner ) || ( (size_t) __emh_thread_id__() == owner ) )
+    {
+        return 0;
+    }
+
+    head = atomic_load_explicit(&emh_remoteFree[heapId], memory_order_relaxed);
+    do
+    {
+        emh_block->nextFree = ( NULL != head ) ? head : emh_heapLinks[heapId].end;
+    } while( !atomic_compare_exchange_weak_explicit(&emh_remoteFree[heapId], &head, emh_block, memory_order_release, memory_order_relaxed) );
+    return 1;
+}
+#endif /* EMH_MALLOC_REMOTE_FREE */
+
+/**
+ * @brief Takes a block that fits the requested size from the free lists of a first-fit
+ *        or TLSF heap, the heap critical zone must be held.
+ * @param emh_link Pointer to the heap link.
+ * @param size     Aligned block size, including the block link.
+ * @return emh_blockLink_t* unlinked block or NULL if there is none.
+ */
+static emh_blockLink_t* emh_findBlock(emh_heapLink_t *emh_link, size_t size)
+{
+    /* Is requested size possible to fit in ? */
+    if( size > emh_link->freeBytes )
+    {
+        return NULL;
+    }
+
+    if( EMH_HEAP_TLSF == ( emh_link->flags & EMH_HEAP_ENGINE_MASK ) )
+    {
+        return emh_tlsfAlloc(emh_link, size);
+    }
+    return emh_firstFitAlloc(emh_link, size);
+}
+
+#if defined(EMH_MALLOC_USE_MMAP)
+/**
+ * @brief Maps a new region large enough for the requested block and chains it to a
+ *        growable heap, the heap critical zone must be held.
+ * @param emh_link Pointer to the heap link.
+ * @param size     Aligned block size, including the block link.
+ * @return int 0 on success, -1 if the region could not be mapped.
+ */
+static int emh_growHeap(emh_heapLink_t *emh_link, size_t size)
+{
+    size_t mapSize = size + emh_regionSize + emh_blockLinkSize + EMH_MALLOC_MIN_BLOCK_SIZE + EMH_MALLOC_BYTE_ALIGNMENT;
+    void   *addr;
+
+    if( 0 != ( emh_link->flags & EMH_HEAP_HUGE_PAGES ) )
+    {
+        /* Regions of heaps backed by huge pages are whole huge pages as well. */
+        mapSize = ( mapSize + EMH_MALLOC_HUGE_PAGE_SIZE - 1 ) & ~( EMH_MALLOC_HUGE_PAGE_SIZE - 1 );
+        addr    = emh_mapHuge(mapSize);
+    }
+    else
+    {
+        mapSize = ( ( mapSize + EMH_MALLOC_GROW_CHUNK - 1 ) / EMH_MALLOC_GROW_CHUNK ) * EMH_MALLOC_GROW_CHUNK;
+        addr    = mmap(NULL, mapSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        addr    = ( MAP_FAILED != addr ) ? addr : NULL;
+    }
+
+    if( NULL == addr )
+    {
+        return -1;
+    }
+
+    if( 0 != emh_addRegion(emh_link, addr, mapSize, mapSize) )
+    {
+        (void) munmap(addr, mapSize);
+        return -1;
+    }
+    return 0;
+}
+#endif /* EMH_MALLOC_USE_MMAP */
+
+/**
+ * @brief Allocates a block from a heap link, the heap critical zone must be held.
+ * @param heapId   Id number of the heap memory region to be used.
+ * @param emh_link Pointer to the heap link.
+ * @param size     Size of memory to be allocated from the heap.
+ * @param fresh    Optional output, set to 1 when the block lies on zero filled memory
+ *                 never handed out before, see emh_isFresh.
+ * @return void* 
+ */
+static void* emh_heapAlloc(emh_heapId_t heapId, emh_heapLink_t *emh_link, size_t size, int *fresh)
+{
+    void* addr = NULL;
+    emh_blockLink_t *block;
+
+#if defined(EMH_MALLOC_REMOTE_FREE)
+    emh_drainRemote(heapId, emh_link);
+#endif /* EMH_MALLOC_REMOTE_FREE */
+
+    size = emh_blockSizeOf(emh_link, size);
+    if( 0 != size )
+    {   
+        block = emh_findBlock(emh_link, size);
+#if defined(EMH_MALLOC_USE_MMAP)
+        if( ( NULL == block ) && ( 0 != ( emh_link->flags & EMH_HEAP_GROWABLE ) ) && ( 0 == emh_growHeap(emh_link, size) ) )
+        {
+            block = emh_findBlock(emh_link, size);
+        }
+#endif /* EMH_MALLOC_USE_MMAP */
+
+        if( NULL != block )
+        {
+            if( NULL != fresh )
+            {
+                *fresh = emh_isFresh(emh_link, block);
+            }
+            addr = emh_markAllocated(heapId, emh_link, block);
+        }
+    }
+
+    if( NULL == addr )
+    {
+        emh_link->nFailures++;
+    }
+    return addr;
+}
+
+/**
+ * @brief Resizes an allocated block in place, the heap critical zone must be held.
+ *        Shrinking splits off the tail of the block as a free block, growing merges
+ *        the next physical block when it is free and large enough.
+ * @param emh_link  Pointer to the heap link.
+ * @param emh_block Pointer to the allocated block.
+ * @param size      Aligned block size, including the block link.
+ * @return int 1 if the block was resized, 0 otherwise.
+ */
+static int emh_heapResize(emh_heapLink_t *emh_link, emh_blockLink_t *emh_block, size_t size)
+{
+    size_t          blockSize = emh_block->blockSize & emh_sizeMsk;
+    size_t          nextSize;
+    emh_blockLink_t *next, *newBlock, *iterator;
+
+    if( size <= blockSize )
+    {
+        /* Is the tail large enough to become a free block? */
+        if( EMH_MALLOC_MIN_BLOCK_SIZE < ( blockSize - size ) )
+        {
+            emh_block->blockSize = size | ( emh_block->blockSize & ~emh_sizeMsk );
+            newBlock = ( void* )( ( ( uint8_t* ) emh_block ) + size );
+            newBlock->blockSize = blockSize - size;
+            emh_link->freeBytes += newBlock->blockSize;
+
+            if( emh_isTagged(emh_link) )
+            {
+                emh_tagLinkFreeBlock(emh_link, newBlock);
+            }
+            else
+            {
+                emh_linkFreeBlock(emh_link, newBlock);
+            }
+        }
+        return 1;
+    }
+
+    /* Is the next physical block free and large enough? The heap end has a size of zero. */
+    next     = emh_nextPhysBlock(emh_block);
+    nextSize = next->blockSize & emh_sizeMsk;
+    if( ( 0 == nextSize ) || ( 0 != ( next->blockSize & emh_allocBit ) ) || ( ( blockSize + nextSize ) < size ) )
+    {
+        return 0;
+    }
+
+    if( emh_isTagged(emh_link) )
+    {
+        emh_tagRemove(emh_link, next);
+        emh_block->blockSize += nextSize;
+        emh_tagSplit(emh_link, emh_block, size);
+    }
+    else
+    {
+        for(iterator = &emh_link->start; iterator->nextFree != next; iterator = iterator->nextFree );
+
+        if( EMH_MALLOC_MIN_BLOCK_SIZE < ( blockSize + nextSize - size ) )
+        {
+            /* The remaining space takes the place of the next block on the free list. */
+            newBlock = ( void* )( ( ( uint8_t* ) emh_block ) + size );
+            newBlock->nextFree  = next->nextFree;
+            newBlock->blockSize = blockSize + nextSize - size;
+            emh_roverReplace(emh_link, next, newBlock);
+            iterator->nextFree  = newBlock;
+            emh_block->blockSize = size | ( emh_block->blockSize & ~emh_sizeMsk );
+        }
+        else
+        {
+            emh_roverReplace(emh_link, next, iterator);
+            iterator->nextFree = next->nextFree;
+            emh_block->blockSize += nextSize;
+        }
+    }
+
+    emh_link->freeBytes -= ( emh_block->blockSize & emh_sizeMsk ) - blockSize;
+    if ( emh_link->freeBytes < emh_link->remainBytes )
+    {
+        emh_link->remainBytes = emh_link->freeBytes;
+    }
+    emh_markUsed(emh_link, emh_block);
+    return 1;
+}
+
+#if defined(EMH_MALLOC_USE_TCACHE)
+/*
+ * Per-thread cache. Small blocks are kept allocated in per-thread bins indexed
+ * by heap id and size class, so they can be handed out and taken back without
+ * entering the heap critical zone. Cached blocks are chained through nextFree
+ * and the last one points to emh_tcacheEnd, so a cached block never passes the
+ * emh_free validity check.
+ */
+#define EMH_TCACHE_MAX_SIZE ( (size_t)( EMH_MALLOC_TCACHE_STEP * EMH_MALLOC_TCACHE_CLASSES ) )
+
+typedef struct emh_tcache_t
+{
+    emh_blockLink_t* bins[EMH_MALLOC_TCACHE_HEAPS][EMH_MALLOC_TCACHE_CLASSES];
+    size_t           heapBytes[EMH_MALLOC_TCACHE_HEAPS];
+    size_t           generation[EMH_MALLOC_TCACHE_HEAPS];
+    size_t           cachedBytes;
+}emh_tcache_t;
+
+static emh_blockLink_t emh_tcacheEnd;
+static EMH_MALLOC_THREAD_LOCAL emh_tcache_t emh_tcache;
+static EMH_MALLOC_THREAD_LOCAL size_t       emh_tcacheLimit = EMH_MALLOC_TCACHE_LIMIT;
+
+/**
+ * @brief Pushes an allocated block into a bin of the calling thread cache.
+ * @param heapId    Id number of the heap the block belongs to.
+ * @param sizeClass Size class of the block.
+ * @param emh_block Pointer to the allocated block.
+ */
+static void emh_tcachePush(emh_heapId_t heapId, size_t sizeClass, emh_blockLink_t *emh_block)
+{
+    emh_blockLink_t **bin = &emh_tcache.bins[heapId][sizeClass];
+
+    emh_block->nextFree = ( NULL != *bin ) ? *bin : &emh_tcacheEnd;
+    *bin = emh_block;
+    emh_tcache.cachedBytes += ( sizeClass + 1 ) * EMH_MALLOC_TCACHE_STEP;
+    emh_tcache.heapBytes[heapId] += ( sizeClass + 1 ) * EMH_MALLOC_TCACHE_STEP;
+    return;
+}
+
+/**
+ * @brief Pops an allocated block from a bin of the calling thread cache.
+ * @param heapId    Id number of the heap.
+ * @param sizeClass Size class of the block.
+ * @return emh_blockLink_t* block or NULL if the bin is empty.
+ */
+static emh_blockLink_t* emh_tcachePop(emh_heapId_t heapId, size_t sizeClass)
+{
+    emh_blockLink_t **bin = &emh_tcache.bins[heapId][sizeClass];
+    emh_blockLink_t *block = *bin;
+
+    if( NULL != block )
+    {
+        *bin = ( &emh_tcacheEnd != block->nextFree ) ? block->nextFree : NULL;
+        block->nextFree = NULL;
+        emh_tcache.cachedBytes -= ( sizeClass + 1 ) * EMH_MALLOC_TCACHE_STEP;
+        emh_tcache.heapBytes[heapId] -= ( sizeClass + 1 ) * EMH_MALLOC_TCACHE_STEP;
+    }
+    return block;
+}
+
+/**
+ * @brief Drops the bins of a heap from the calling thread cache when the heap was 
+ *        reset after they were filled, their blocks no longer exist.
+ * @param heapId Id number of the heap.
+ */
+static void emh_tcacheCheckGeneration(emh_heapId_t heapId)
+{
+    if( emh_tcache.generation[heapId] != emh_heapLinks[heapId].generation )
+    {
+        memset(emh_tcache.bins[heapId], 0x00, sizeof( emh_tcache.bins[heapId] ));
+        emh_tcache.cachedBytes -= emh_tcache.heapBytes[heapId];
+        emh_tcache.heapBytes[heapId]  = 0;
+        emh_tcache.generation[heapId] = emh_heapLinks[heapId].generation;
+    }
+    return;
+}
+
+/**
+ * @brief Returns up to n blocks of a bin of the calling thread cache to their heap,
+ *        taking the heap critical zone once.
+ * @param heapId    Id number of the heap.
+ * @param sizeClass Size class of the bin.
+ * @param n         Maximum number of blocks to be released.
+ */
+static void emh_tcacheFlushBin(emh_heapId_t heapId, size_t sizeClass, size_t n)
+{
+    emh_blockLink_t *block;
+
+    emh_tcacheCheckGeneration(heapId);
+    if( NULL != emh_tcache.bins[heapId][sizeClass] )
+    {
+        __emh_lock_heap_zone__(heapId);
+        while( ( 0 < n ) && ( NULL != ( block = emh_tcachePop(heapId, sizeClass) ) ) )
+        {
+            emh_heapFree(&emh_heapLinks[heapId], block);
+            n--;
+        }
+        __emh_unlock_heap_zone__(heapId);
+    }
+    return;
+}
+
+/**
+ * @brief Allocates a small block through the calling thread cache. When the bin
+ *        is empty it is refilled with a batch of blocks taken from the heap.
+ * @param heapId   Id number of the heap memory region to be used.
+ * @param emh_link Pointer to the heap link.
+ * @param size     Size of memory to be allocated, up to EMH_TCACHE_MAX_SIZE.
+ * @return void* 
+ */
+static void* emh_tcacheAlloc(emh_heapId_t heapId, emh_heapLink_t *emh_link, size_t size)
+{
+    size_t          sizeClass = ( size - 1 ) / EMH_MALLOC_TCACHE_STEP;
+    size_t          classSize = ( sizeClass + 1 ) * EMH_MALLOC_TCACHE_STEP;
+    emh_blockLink_t *block;
+    void            *addr;
+    void            *extra;
+    size_t          n;
+
+    emh_tcacheCheckGeneration(heapId);
+    block = emh_tcachePop(heapId, sizeClass);
+    if( NULL != block )
+    {
+        return ( void* )( ( ( uint8_t* ) block ) + emh_blockLinkSize );
+    }
+
+    __emh_lock_heap_zone__(heapId);
+    addr = emh_heapAlloc(heapId, emh_link, classSize, NULL);
+    for(n = 1; ( NULL != addr ) && ( n < EMH_MALLOC_TCACHE_BATCH ) && 
+               ( ( emh_tcache.cachedBytes + classSize ) <= emh_tcacheLimit ); n++)
+    {
+        extra = emh_heapAlloc(heapId, emh_link, classSize, NULL);
+        if( NULL == extra )
+        {
+            break;
+        }
+        emh_tcachePush(heapId, sizeClass, ( void* )( ( ( uint8_t* ) extra ) - emh_blockLinkSize ));
+    }
+    __emh_unlock_heap_zone__(heapId);
+
+    return addr;
+}
+
+/**
+ * @brief Keeps a small block on the calling thread cache, flushing a batch of
+ *        blocks of the same bin when the thread byte limit is exceeded.
+ * @param heapId    Id number of the heap the block belongs to.
+ * @param emh_block Pointer to the allocated block.
+ * @return int 1 if the block was cached, 0 if it must be released to the heap.
+ */
+static int emh_tcacheFree(emh_heapId_t heapId, emh_blockLink_t *emh_block)
+{
+    size_t capacity = ( emh_block->blockSize & emh_sizeMsk ) - emh_blockLinkSize;
+    size_t sizeClass;
+
+    if( ( capacity < EMH_MALLOC_TCACHE_STEP ) || ( 0 == emh_tcacheLimit ) || ( EMH_MALLOC_TCACHE_HEAPS <= heapId ) ||
+        ( EMH_HEAP_POOL == ( emh_heapLinks[heapId].flags & EMH_HEAP_ENGINE_MASK ) ) )
+    {
+        return 0;
+    }
+    emh_tcacheCheckGeneration(heapId);
+
+    /* Blocks are cached on the largest class they are able to serve. */
+    sizeClass = ( capacity / EMH_MALLOC_TCACHE_STEP ) - 1;
+    if( sizeClass >= EMH_MALLOC_TCACHE_CLASSES )
+    {
+        return 0;
+    }
+
+    if( ( emh_tcache.cachedBytes + ( ( sizeClass + 1 ) * EMH_MALLOC_TCACHE_STEP ) ) > emh_tcacheLimit )
+    {
+        emh_tcacheFlushBin(heapId, sizeClass, EMH_MALLOC_TCACHE_BATCH);
+        if( ( emh_tcache.cachedBytes + ( ( sizeClass + 1 ) * EMH_MALLOC_TCACHE_STEP ) ) > emh_tcacheLimit )
+        {
+            return 0;
+        }
+    }
+    emh_tcachePush(heapId, sizeClass, emh_block);
+    return 1;
+}
+
+/**
+ * @brief Returns every block held by the calling thread cache to its heap. Must
+ *        be called by a thread before it exits, otherwise its cached blocks are lost.
+ */
+void emh_tcache_flush(void)
+{
+    emh_heapId_t heapIdx;
+    size_t       sizeClass;
+
+    for(heapIdx = 0; heapIdx < EMH_MALLOC_TCACHE_HEAPS; heapIdx++)
+    {
+        for(sizeClass = 0; sizeClass < EMH_MALLOC_TCACHE_CLASSES; sizeClass++)
+        {
+            emh_tcacheFlushBin(heapIdx, sizeClass, (size_t) -1);
+        }
+    }
+    return;
+}
+
+/**
+ * @brief Sets the maximum amount of bytes the calling thread cache may hold. A
+ *        limit of zero disables the cache for the calling thread.
+ * @param limit Byte limit of the calling thread cache.
+ */
+void emh_tcache_set_limit(size_t limit)
+{
+    emh_tcacheLimit = limit;
+    if( emh_tcache.cachedBytes > limit )
+    {
+        emh_tcache_flush();
+    }
+    return;
+}
+#endif /* EMH_MALLOC_USE_TCACHE */
+
+#if defined(EMH_MALLOC_USE_TRACE)
+/*
+ * Trace recorder. Every thread records its events on a ring of its own, which
+ * it fills without any lock. A ring is written to the trace file by its thread
+ * when it fills up, or by emh_trace_flush and emh_trace_close, under the global
+ * critical zone. Rings are kept on a lock-free list once created and reused by
+ * later traces, so rings of threads that already exited are flushed as well.
+ */
+typedef struct emh_traceRing_t
+{
+    struct emh_traceRing_t* next;
+    _Atomic size_t          head;
+    _Atomic size_t          tail;
+    size_t                  session;
+    uint16_t                thread;
+    emh_traceEvent_t        events[EMH_MALLOC_TRACE_RING];
+}emh_traceRing_t;
+
+static FILE*                     emh_traceFile = NULL;
+static _Atomic size_t            emh_traceSession;
+static _Atomic size_t            emh_traceSessions;
+static _Atomic(emh_traceRing_t*) emh_traceRings;
+static _Atomic uint32_t          emh_traceThreads;
+static EMH_MALLOC_THREAD_LOCAL emh_traceRing_t* emh_traceRing = NULL;
+
+/**
+ * @brief Writes the pending events of a ring to the trace file, the global critical 
+ *        zone must be held.
+ * @param ring Pointer to the ring.
+ */
+static void emh_traceDrain(emh_traceRing_t *ring)
+{
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    size_t first, count;
+
+    while( tail != head )
+    {
+        first = tail % EMH_MALLOC_TRACE_RING;
+        count = head - tail;
+        if( count > ( EMH_MALLOC_TRACE_RING - first ) )
+        {
+            count = EMH_MALLOC_TRACE_RING - first;
+        }
+        if( NULL != emh_traceFile )
+        {
+            (void) fwrite(&ring->events[first], sizeof( emh_traceEvent_t ), count, emh_traceFile);
+        }
+        tail += count;
+    }
+    atomic_store_explicit(&ring->tail, tail, memory_order_release);
+    return;
+}
+
+/**
+ * @brief Returns the ring of the calling thread, creating it on the first event
+ *        and dropping the events left from a previous trace.
+ * @param session Current trace session.
+ * @return emh_traceRing_t* NULL if the ring could not be allocated.
+ */
+static emh_traceRing_t* emh_traceGetRing(size_t session)
+{
+    emh_traceRing_t *ring = emh_traceRing;
+
+    if( NULL == ring )
+    {
+        ring = calloc(1, sizeof( emh_traceRing_t ));
+        if( NULL == ring )
+        {
+            return NULL;
+        }
+        ring->thread = (uint16_t) atomic_fetch_add_explicit(&emh_traceThreads, 1, memory_order_relaxed);
+        ring->next   = atomic_load_explicit(&emh_traceRings, memory_order_relaxed);
+        while( !atomic_compare_exchange_weak_explicit(&emh_traceRings, &ring->next, ring, memory_order_release, memory_order_relaxed) );
+        emh_traceRing = ring;
+    }
+
+    if( session != ring->session )
+    {
+        __emh_lock_zone__();
+        atomic_store_explicit(&ring->tail, atomic_load_explicit(&ring->head, memory_order_relaxed), memory_order_relaxed);
+        ring->session = session;
+        __emh_unlock_zone__();
+    }
+    return ring;
+}
+
+/**
+ * @brief Takes the start time of a traced call.
+ * @return uint64_t start time, 0 when no trace is open.
+ */
+static uint64_t emh_traceStart(void)
+{
+    if( 0 == atomic_load_explicit(&emh_traceSession, memory_order_relaxed) )
+    {
+        return 0;
+    }
+    return __emh_clock_ns__();
+}
+
+/**
+ * @brief Records an event on the ring of the calling thread, writing the ring to the
+ *        trace file first when it is full.
+ * @param start  Start time of the call, as taken by emh_traceStart.
+ * @param op     Event type, EMH_TRACE_MALLOC, EMH_TRACE_CALLOC, EMH_TRACE_REALLOC or EMH_TRACE_FREE.
+ * @param heapId Heap requested, -1 when the call does not take one.
+ * @param addr   Block returned, or released for EMH_TRACE_FREE.
+ * @param prev   Block passed to emh_realloc.
+ * @param size   Requested size.
+ */
+static void emh_traceRecord(uint64_t start, uint8_t op, emh_heapId_t heapId, void *addr, void *prev, size_t size)
+{
+    size_t           session = atomic_load_explicit(&emh_traceSession, memory_order_acquire);
+    uint64_t         now;
+    emh_traceRing_t  *ring;
+    emh_traceEvent_t *event;
+    size_t           head;
+
+    /* Was the trace closed or reopened during the call? */
+    if( ( 0 == start ) || ( 0 == session ) )
+    {
+        return;
+    }
+    now  = __emh_clock_ns__();
+    ring = emh_traceGetRing(session);
+    if( NULL == ring )
+    {
+        return;
+    }
+
+    head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    if( ( head - atomic_load_explicit(&ring->tail, memory_order_acquire) ) >= EMH_MALLOC_TRACE_RING )
+    {
+        __emh_lock_zone__();
+        emh_traceDrain(ring);
+        __emh_unlock_zone__();
+    }
+
+    event = &ring->events[head % EMH_MALLOC_TRACE_RING];
+    event->time    = start;
+    event->addr    = (uint64_t)(uintptr_t) addr;
+    event->prev    = (uint64_t)(uintptr_t) prev;
+    event->size    = (uint64_t) size;
+    event->latency = ( ( now - start ) > UINT32_MAX ) ? UINT32_MAX : (uint32_t)( now - start );
+    event->thread  = ring->thread;
+    event->op      = op;
+    event->heapId  = heapId;
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+    return;
+}
+
+/**
+ * @brief Starts recording every emh_malloc, emh_calloc, emh_realloc and emh_free
+ *        call into the given file, see emh_traceHeader_t and emh_traceEvent_t.
+ *        Other entry points, such as emh_aligned_alloc or the batch calls, are not
+ *        recorded.
+ * @param path Path of the trace file, truncated if it exists.
+ * @return int 0 on success, -1 if a trace is already open or the file could not
+ *         be created.
+ */
+int emh_trace_open(const char *path)
+{
+    emh_traceHeader_t header;
+    FILE              *file;
+
+    if( NULL == path )
+    {
+        return -1;
+    }
+
+    __emh_lock_zone__();
+    if( NULL != emh_traceFile )
+    {
+        __emh_unlock_zone__();
+        return -1;
+    }
+    file = fopen(path, "wb");
+    if( NULL == file )
+    {
+        __emh_unlock_zone__();
+        return -1;
+    }
+
+    header.magic     = EMH_TRACE_MAGIC;
+    header.version   = EMH_TRACE_VERSION;
+    header.eventSize = (uint16_t) sizeof( emh_traceEvent_t );
+    if( 1 != fwrite(&header, sizeof( header ), 1, file) )
+    {
+        (void) fclose(file);
+        __emh_unlock_zone__();
+        return -1;
+    }
+    emh_traceFile = file;
+    atomic_store_explicit(&emh_traceSession, atomic_fetch_add(&emh_traceSessions, 1) + 1, memory_order_release);
+    __emh_unlock_zone__();
+    return 0;
+}
+
+/**
+ * @brief Writes the pending events of every ring recording the given trace to the
+ *        trace file, the global critical zone must be held.
+ * @param session Trace session.
+ */
+static void emh_traceDrainAll(size_t session)
+{
+    emh_traceRing_t *ring;
+
+    for(ring = atomic_load_explicit(&emh_traceRings, memory_order_acquire); NULL != ring; ring = ring->next)
+    {
+        if( session == ring->session )
+        {
+            emh_traceDrain(ring);
+        }
+    }
+    return;
+}
+
+/**
+ * @brief Writes the events recorded so far by every thread to the trace file.
+ */
+void emh_trace_flush(void)
+{
+    __emh_lock_zone__();
+    if( NULL != emh_traceFile )
+    {
+        emh_traceDrainAll(atomic_load_explicit(&emh_traceSession, memory_order_relaxed));
+        (void) fflush(emh_traceFile);
+    }
+    __emh_unlock_zone__();
+    return;
+}
+
+/**
+ * @brief Stops recording, writes the pending events and closes the trace file.
+ *        Calls in flight on other threads may be left out of the trace.
+ * @return int 0 on success, -1 if no trace is open or the file could not be written.
+ */
+int emh_trace_close(void)
+{
+    size_t session;
+    int    ret;
+
+    __emh_lock_zone__();
+    session = atomic_load_explicit(&emh_traceSession, memory_order_relaxed);
+    if( 0 == session )
+    {
+        __emh_unlock_zone__();
+        return -1;
+    }
+
+    atomic_store_explicit(&emh_traceSession, 0, memory_order_release);
+    emh_traceDrainAll(session);
+    ret = ( 0 == fclose(emh_traceFile) ) ? 0 : -1;
+    emh_traceFile = NULL;
+    __emh_unlock_zone__();
+    return ret;
+}
+#endif /* EMH_MALLOC_USE_TRACE */
+
+#if defined(EMH_MALLOC_USE_PROFILE)
+/*
+ * Heap profiler. Every thread counts down the bytes it allocates and samples the
+ * block that crosses zero, drawing the next countdown at random around the rate,
+ * so on average one block is sampled every rate bytes. Sampled blocks carry
+ * emh_sampledBit on their block link and are kept on a side table together with
+ * the call site that allocated them; emh_free only looks the table up for blocks
+ * carrying the bit. Both tables live under the global critical zone, which is
+ * never taken together with a heap critical zone.
+ */
+typedef struct emh_profileSlot_t
+{
+    void*           addr;
+    size_t          weight;
+    size_t          site;
+}emh_profileSlot_t;
+
+static _Atomic size_t     emh_profileRate;
+static size_t             emh_profileDropped = 0;
+static size_t             emh_profileNSites  = 0;
+static size_t             emh_profileNSlots  = 0;
+static size_t             emh_profileSiteHash[EMH_MALLOC_PROFILE_SITES];
+static emh_profileSite_t  emh_profileSites[EMH_MALLOC_PROFILE_SITES];
+static emh_profileSlot_t  emh_profileSlots[EMH_MALLOC_PROFILE_SAMPLES];
+static EMH_MALLOC_THREAD_LOCAL size_t   emh_profileCountdown = 0;
+static EMH_MALLOC_THREAD_LOCAL uint64_t emh_profileSeed = 0;
+
+/**
+ * @brief Draws the number of bytes to allocate before the next sample, uniformly
+ *        distributed between 1 and twice the rate.
+ * @param rate Average sampling interval in bytes.
+ * @return size_t 
+ */
+static size_t emh_profileNext(size_t rate)
+{
+    uint64_t x = emh_profileSeed;
+
+    if( 0 == x )
+    {
+        /* Thread local variables have a distinct address on every thread. */
+        x = (uint64_t)(uintptr_t) &emh_profileSeed | 1;
+    }
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    emh_profileSeed = x;
+    return 1 + (size_t)( ( x * 0x2545F4914F6CDD1DULL ) % ( (uint64_t) rate << 1 ) );
+}
+
+/**
+ * @brief Returns the block link of a block profiled by address, or NULL for the
+ *        blocks of pool, arena and compact heaps, which carry no block link.
+ * @param addr Address of the block.
+ * @return emh_blockLink_t* 
+ */
+static emh_blockLink_t* emh_profileBlockOf(void *addr)
+{
+    emh_blockLink_t *block;
+    emh_heapId_t    heapId;
+
+    if( ( NULL == addr ) || ( ( 0 != emh_nRangeHeaps ) && ( 0 <= emh_findRangeHeap(addr) ) ) )
+    {
+        return NULL;
+    }
+    block  = ( void* )( ( ( uint8_t* ) addr ) - emh_blockLinkSize );
+    heapId = emh_heapOfBlock(block);
+    return ( ( 0 <= heapId ) && ( EMH_MALLOC_N_HEAPS > heapId ) ) ? block : NULL;
+}
+
+static size_t emh_profileSlotOf(void *addr)
+{
+    uint64_t key = (uint64_t)(uintptr_t) addr;
+
+    key ^= key >> 29;
+    key *= 0xBF58476D1CE4E5B9ULL;
+    key ^= key >> 32;
+    return (size_t)( key % EMH_MALLOC_PROFILE_SAMPLES );
+}
+
+/**
+ * @brief Finds the call site of a stack on a heap, adding it if it is new, the
+ *        global critical zone must be held.
+ * @param heapId Id number of the heap.
+ * @param frames Return addresses of the stack.
+ * @param depth  Number of return addresses.
+ * @return size_t index of the call site, EMH_MALLOC_PROFILE_SITES if the table is full.
+ */
+static size_t emh_profileSiteOf(emh_heapId_t heapId, void **frames, size_t depth)
+{
+    size_t hash = (size_t) 0xCBF29CE484222325ULL ^ (size_t)(uint8_t) heapId;
+    size_t idx, probe;
+
+    for(idx = 0; idx < depth; idx++)
+    {
+        hash = ( hash ^ (size_t)(uintptr_t) frames[idx] ) * (size_t) 0x100000001B3ULL;
+    }
+    /* Zero marks the empty entries. */
+    hash |= 1;
+
+    idx = hash % EMH_MALLOC_PROFILE_SITES;
+    for(probe = 0; probe < EMH_MALLOC_PROFILE_SITES; probe++)
+    {
+        if( 0 == emh_profileSiteHash[idx] )
+        {
+            /* Keep a quarter of the table empty so the probe sequences stay short. */
+            if( ( emh_profileNSites << 2 ) >= ( (size_t) EMH_MALLOC_PROFILE_SITES * 3 ) )
+            {
+                break;
+            }
+            emh_profileSiteHash[idx] = hash;
+            memcpy(emh_profileSites[idx].frames, frames, depth * sizeof( void* ));
+            emh_profileSites[idx].depth  = depth;
+            emh_profileSites[idx].heapId = heapId;
+            emh_profileNSites++;
+            return idx;
+        }
+        if( ( hash == emh_profileSiteHash[idx] ) && ( heapId == emh_profileSites[idx].heapId ) && 
+            ( depth == emh_profileSites[idx].depth ) && ( 0 == memcmp(frames, emh_profileSites[idx].frames, depth * sizeof( void* )) ) )
+        {
+            return idx;
+        }
+        idx = ( idx + 1 ) % EMH_MALLOC_PROFILE_SITES;
+    }
+    return EMH_MALLOC_PROFILE_SITES;
+}
+
+/**
+ * @brief Removes a sampled block from the side table and takes its bytes off its
+ *        call site, the global critical zone must be held.
+ * @param idx Index of the table entry.
+ */
+static void emh_profileSlotRemove(size_t idx)
+{
+    emh_profileSite_t *site = &emh_profileSites[emh_profileSlots[idx].site];
+    size_t            next, home;
+
+    site->liveBytes -= emh_profileSlots[idx].weight;
+    site->liveSamples--;
+    emh_profileNSlots--;
+
+    /* Shift back the entries of the cluster that may no longer be reached. */
+    for(next = ( idx + 1 ) % EMH_MALLOC_PROFILE_SAMPLES; NULL != emh_profileSlots[next].addr; next = ( next + 1 ) % EMH_MALLOC_PROFILE_SAMPLES)
+    {
+        home = emh_profileSlotOf(emh_profileSlots[next].addr);
+        if( ( ( next + EMH_MALLOC_PROFILE_SAMPLES - home ) % EMH_MALLOC_PROFILE_SAMPLES ) >= 
+            ( ( next + EMH_MALLOC_PROFILE_SAMPLES - idx ) % EMH_MALLOC_PROFILE_SAMPLES ) )
+        {
+            emh_profileSlots[idx] = emh_profileSlots[next];
+            idx = next;
+        }
+    }
+    emh_profileSlots[idx].addr = NULL;
+    return;
+}
+
+/**
+ * @brief Samples an allocated block: records the stack of the calling thread and
+ *        adds the block to the side table under its call site.
+ * @param addr   Address of the block.
+ * @param weight Bytes the sample stands for.
+ */
+static void emh_profileRecord(void *addr, size_t weight)
+{
+    emh_blockLink_t *block = emh_profileBlockOf(addr);
+    void            *frames[EMH_MALLOC_PROFILE_DEPTH];
+    emh_heapId_t    heapId;
+    int             depth;
+    size_t          site, idx;
+    int             recorded = 0;
+
+    if( NULL == block )
+    {
+        return;
+    }
+    heapId = emh_heapOfBlock(block);
+    depth  = __emh_backtrace__(frames, EMH_MALLOC_PROFILE_DEPTH);
+    if( 0 > depth )
+    {
+        depth = 0;
+    }
+
+    __emh_lock_zone__();
+    site = emh_profileSiteOf(heapId, frames, (size_t) depth);
+    if( ( EMH_MALLOC_PROFILE_SITES > site ) && ( ( emh_profileNSlots << 2 ) < ( (size_t) EMH_MALLOC_PROFILE_SAMPLES * 3 ) ) )
+    {
+        for(idx = emh_profileSlotOf(addr); NULL != emh_profileSlots[idx].addr; idx = ( idx + 1 ) % EMH_MALLOC_PROFILE_SAMPLES);
+        emh_profileSlots[idx].addr   = addr;
+        emh_profileSlots[idx].weight = weight;
+        emh_profileSlots[idx].site   = site;
+        emh_profileSites[site].liveBytes += weight;
+        emh_profileSites[site].liveSamples++;
+        emh_profileNSlots++;
+        recorded = 1;
+    }
+    else
+    {
+        emh_profileDropped++;
+    }
+    __emh_unlock_zone__();
+
+    /* Neighbour blocks update the flags of the block link under the heap critical zone. */
+    if( 0 != recorded )
+    {
+        __emh_lock_heap_zone__(heapId);
+        block->blockSize |= emh_sampledBit;
+        __emh_unlock_heap_zone__(heapId);
+    }
+    return;
+}
+
+/**
+ * @brief Counts an allocation against the sampling countdown of the calling thread
+ *        and samples the block when the countdown runs out.
+ * @param addr Address of the allocated block, NULL if the allocation failed.
+ * @param size Requested size.
+ */
+static void emh_profileAccount(void *addr, size_t size)
+{
+    size_t rate = atomic_load_explicit(&emh_profileRate, memory_order_relaxed);
+
+    if( ( 0 == rate ) || ( NULL == addr ) )
+    {
+        return;
+    }
+    if( 0 == emh_profileSeed )
+    {
+        emh_profileCountdown = emh_profileNext(rate);
+    }
+    if( size < emh_profileCountdown )
+    {
+        emh_profileCountdown -= size;
+        return;
+    }
+
+    /* A sampled block stands for the rate bytes it was drawn from, large blocks for themselves. */
+    emh_profileCountdown = emh_profileNext(rate);
+    emh_profileRecord(addr, ( size < rate ) ? rate : size);
+    return;
+}
+
+/**
+ * @brief Removes a sampled block from the side table and clears its sampled bit,
+ *        called before the block is released or resized.
+ * @param heapId Id number of the heap.
+ * @param block  Pointer to the block link.
+ */
+static void emh_profileRelease(emh_heapId_t heapId, emh_blockLink_t *block)
+{
+    void   *addr = ( void* )( ( ( uint8_t* ) block ) + emh_blockLinkSize );
+    size_t idx;
+
+    __emh_lock_zone__();
+    for(idx = emh_profileSlotOf(addr); NULL != emh_profileSlots[idx].addr; idx = ( idx + 1 ) % EMH_MALLOC_PROFILE_SAMPLES)
+    {
+        if( addr == emh_profileSlots[idx].addr )
+        {
+            emh_profileSlotRemove(idx);
+            break;
+        }
+    }
+    __emh_unlock_zone__();
+
+    __emh_lock_heap_zone__(heapId);
+    block->blockSize &= ~emh_sampledBit;
+    __emh_unlock_heap_zone__(heapId);
+    return;
+}
+
+/**
+ * @brief Drops every sample of a heap, called once the heap is reset.
+ * @param heapId Id number of the heap.
+ */
+static void emh_profileDropHeap(emh_heapId_t heapId)
+{
+    size_t idx = 0;
+
+    __emh_lock_zone__();
+    while( idx < EMH_MALLOC_PROFILE_SAMPLES )
+    {
+        /* Removing an entry may shift the next one of its cluster in its place. */
+        if( ( NULL != emh_profileSlots[idx].addr ) && ( heapId == emh_profileSites[emh_profileSlots[idx].site].heapId ) )
+        {
+            emh_profileSlotRemove(idx);
+            continue;
+        }
+        idx++;
+    }
+    __emh_unlock_zone__();
+    return;
+}
+
+/**
+ * @brief Sets the average number of bytes allocated between two samples. Threads
+ *        pick the new rate up after their next sample.
+ * @param rate Sampling interval in bytes, 0 stops sampling. Blocks already sampled
+ *             are still tracked until they are freed.
+ */
+void emh_profile_set_rate(size_t rate)
+{
+    /* Countdowns are drawn up to twice the rate. */
+    if( rate > ( SIZE_MAX >> 1 ) )
+    {
+        rate = SIZE_MAX >> 1;
+    }
+    atomic_store_explicit(&emh_profileRate, rate, memory_order_relaxed);
+    return;
+}
+
+/**
+ * @brief Copies the call sites holding live sampled blocks.
+ * @param sites    Array receiving the call sites, may be NULL to count them.
+ * @param maxSites Number of entries of the array.
+ * @return size_t number of call sites copied, or holding live blocks when sites is NULL.
+ */
+size_t emh_profile_snapshot(emh_profileSite_t *sites, size_t maxSites)
+{
+    size_t idx, count = 0;
+
+    __emh_lock_zone__();
+    for(idx = 0; idx < EMH_MALLOC_PROFILE_SITES; idx++)
+    {
+        if( 0 == emh_profileSites[idx].liveSamples )
+        {
+            continue;
+        }
+        if( NULL != sites )
+        {
+            if( count == maxSites )
+            {
+                break;
+            }
+            sites[count] = emh_profileSites[idx];
+        }
+        count++;
+    }
+    __emh_unlock_zone__();
+    return count;
+}
+
+/**
+ * @brief Writes the live bytes of every call site of every heap to a text file,
+ *        one call site per line followed by its return addresses.
+ * @param path Path of the profile file, truncated if it exists.
+ * @return int 0 on success, -1 if the file could not be created.
+ */
+int emh_profile_dump(const char *path)
+{
+    FILE              *file = fopen(path, "w");
+    emh_profileSite_t *site;
+    size_t            idx, frame;
+
+    if( NULL == file )
+    {
+        return -1;
+    }
+
+    __emh_lock_zone__();
+    fprintf(file, "# emh_malloc heap profile: %zu byte sampling rate, %zu live samples, %zu dropped\n",
+            atomic_load_explicit(&emh_profileRate, memory_order_relaxed), emh_profileNSlots, emh_profileDropped);
+    for(idx = 0; idx < EMH_MALLOC_PROFILE_SITES; idx++)
+    {
+        site = &emh_profileSites[idx];
+        if( 0 == site->liveSamples )
+        {
+            continue;
+        }
+        fprintf(file, "heap %d: %zu bytes in %zu samples @", (int) site->heapId, site->liveBytes, site->liveSamples);
+        for(frame = 0; frame < site->depth; frame++)
+        {
+            fprintf(file, " %p", site->frames[frame]);
+        }
+        fputc('\n', file);
+    }
+    __emh_unlock_zone__();
+
+    return ( 0 == fclose(file) ) ? 0 : -1;
+}
+#endif /* EMH_MALLOC_USE_PROFILE */
+
+/**
+ * @brief Allocates memory region into designated heap space specified by heapId
+ *        and returns a memory aligned pointer to allocated memory area.
+ * 
+ * @param heapId Id number of the heap memory region to be used.
+ * @param size    Size of memory to be allocated from the heap.
+ * @return void* 
+ */
+static void* emh_mallocImpl(emh_heapId_t heapId, size_t size)
+{
+    void* addr = NULL;
+    emh_heapLink_t  *emh_link;
+
+    /* Is heap ID not valid? */
+    if( ( 0 > heapId ) || ( EMH_MALLOC_N_HEAPS <= heapId ) || ( NULL == emh_heapLinks[heapId].end ) )
+    {
+        return addr;
+    }
+
+    emh_link = &emh_heapLinks[heapId];
+
+    /* Pool heaps serve fixed size slots without taking the heap critical zone. */
+    if( EMH_HEAP_POOL == ( emh_link->flags & EMH_HEAP_ENGINE_MASK ) )
+    {
+        if( ( 0 < size ) && ( size <= ( (emh_pool_t*) emh_link->ctrl )->slotSize ) )
+        {
+            addr = emh_poolAlloc(heapId, emh_link->ctrl);
+        }
+        return addr;
+    }
+
+    if( EMH_HEAP_ARENA == ( emh_link->flags & EMH_HEAP_ENGINE_MASK ) )
+    {
+        __emh_lock_heap_zone__(heapId);
+        addr = emh_arenaAlloc(emh_link, size, EMH_MALLOC_BYTE_ALIGNMENT);
+        __emh_unlock_heap_zone__(heapId);
+        return addr;
+    }
+
+#if defined(EMH_MALLOC_USE_MMAP)
+    if( ( 0 != ( emh_link->flags & EMH_HEAP_DIRECT_MAP ) ) && ( size >= EMH_MALLOC_MMAP_THRESHOLD ) )
+    {
+        return emh_mapAlloc(heapId, emh_link, size);
+    }
+#endif /* EMH_MALLOC_USE_MMAP */
+
+    /* Compact blocks do not carry a block link, so they bypass the per-thread caches. */
+    if( EMH_HEAP_COMPACT == ( emh_link->flags & EMH_HEAP_ENGINE_MASK ) )
+    {
+        __emh_lock_heap_zone__(heapId);
+        addr = emh_compactAlloc(heapId, emh_link, size);
+        __emh_unlock_heap_zone__(heapId);
+        return addr;
+    }
+
+#if defined(EMH_MALLOC_USE_TCACHE)
+    if( ( 0 < size ) && ( size <= EMH_TCACHE_MAX_SIZE ) && ( 0 != emh_tcacheLimit ) && ( EMH_MALLOC_TCACHE_HEAPS > heapId ) )
+    {
+        return emh_tcacheAlloc(heapId, emh_link, size);
+    }
+#endif /* EMH_MALLOC_USE_TCACHE */
+
+    __emh_lock_heap_zone__(heapId);
+    addr = emh_heapAlloc(heapId, emh_link, size, NULL);
+    __emh_unlock_heap_zone__(heapId);
+    return addr;
+}
+
+/**
+ * @brief Allocates memory region into designated heap space specified by heapId
+ *        whose address is a multiple of the requested alignment. A larger block is
+ *        taken from the heap and the space before and after the aligned block is
+ *        returned to the free block list.
+ * 
+ * @param heapId    Id number of the heap memory region to be used.
+ * @param alignment Requested alignment, must be a power of two.
+ * @param size      Size of memory to be allocated from the heap.
+ * @return void* 
+ */
+void* emh_aligned_alloc(emh_heapId_t heapId, size_t alignment, size_t size)
+{
+    void            *addr = NULL;
+    emh_heapLink_t  *emh_link;
+    emh_blockLink_t *block, *gapBlock;
+    size_t          blockSize;
+    size_t          alignedAddr;
+    size_t          gap;
+
+    /* Is alignment a power of two? */
+    if( ( 0 == alignment ) || ( 0 != ( alignment & ( alignment - 1 ) ) ) )
+    {
+        return addr;
+    }
+
+    /* Every block is already aligned to the heap alignment. */
+    if( alignment <= EMH_MALLOC_BYTE_ALIGNMENT )
+    {
+        return emh_mallocImpl(heapId, size);
+    }
+
+    /* Is heap ID not valid? */
+    if( ( 0 > heapId ) || ( EMH_MALLOC_N_HEAPS <= heapId ) || ( NULL == emh_heapLinks[heapId].end ) )
+    {
+        return addr;
+    }
+
+    emh_link  = &emh_heapLinks[heapId];
+    if( EMH_HEAP_ARENA == ( emh_link->flags & EMH_HEAP_ENGINE_MASK ) )
+    {
+        __emh_lock_heap_zone__(heapId);
+        addr = emh_arenaAlloc(emh_link, size, alignment);
+        __emh_unlock_heap_zone__(heapId);
+        return addr;
+    }
+
+    blockSize = emh_blockSizeOf(emh_link, size);
+    if( ( EMH_HEAP_POOL == ( emh_link->flags & EMH_HEAP_ENGINE_MASK ) ) || ( EMH_HEAP_COMPACT == ( emh_link->flags & EMH_HEAP_ENGINE_MASK ) ) || ( 0 == blockSize ) ||
+        ( size > ( emh_sizeMsk - alignment - ( EMH_MALLOC_MIN_BLOCK_SIZE << 1 ) ) ) )
+    {
+        return addr;
+    }
+
+    __emh_lock_heap_zone__(heapId);
+    /* Leave room for a leading free block plus the alignment correction. */
+    addr = emh_heapAlloc(heapId, emh_link, size + alignment + EMH_MALLOC_MIN_BLOCK_SIZE, NULL);
+    if( NULL != addr )
+    {
+        block = ( void* )( ( ( uint8_t* ) addr ) - emh_blockLinkSize );
+
+        if( 0 != ( ( (size_t) addr ) & ( alignment - 1 ) ) )
+        {
+            alignedAddr = ( ( (size_t) addr ) + EMH_MALLOC_MIN_BLOCK_SIZE + alignment - 1 ) & ~( alignment - 1 );
+            gap         = alignedAddr - ( (size_t) addr );
+
+            /* The aligned block inherits the block link, the leading space becomes a free block. */
+            gapBlock = block;
+            block    = ( void* )( alignedAddr - emh_blockLinkSize );
+            block->blockSize = ( ( gapBlock->blockSize & emh_sizeMsk ) - gap ) | ( gapBlock->blockSize & ( emh_allocBit | emh_heapIdMsk ) );
+            block->nextFree  = NULL;
+            gapBlock->blockSize = gap | ( gapBlock->blockSize & emh_prevFreeBit );
+            emh_link->freeBytes += gap;
+
+            if( emh_isTagged(emh_link) )
+            {
+                emh_tagLinkFreeBlock(emh_link, gapBlock);
+            }
+            else
             {
-                prevBlock    = block;
-                block        = block->nextFree;
+                emh_linkFreeBlock(emh_link, gapBlock);
             }
+            addr = (void*) alignedAddr;
+        }
+
+        /* Return the trailing space. */
+        (void) emh_heapResize(emh_link, block, blockSize);
+    }
+    __emh_unlock_heap_zone__(heapId);
+
+    return addr;
+}
+
+/**
+ * @brief Frees a pool slot or a compact block, which carry no block link. Arena
+ *        objects are only released by emh_reset or emh_arena_rewind.
+ * 
+ * @param heapId Id number of the pool, arena or compact heap holding the address.
+ * @param addr   Address of the memory region to be freed.
+ */
+static void emh_freeRange(emh_heapId_t heapId, uint8_t *addr)
+{
+    emh_pool_t *pool;
+    size_t slotOffset;
+
+    if( EMH_HEAP_POOL == ( emh_heapLinks[heapId].flags & EMH_HEAP_ENGINE_MASK ) )
+    {
+        pool = emh_heapLinks[heapId].ctrl;
+        slotOffset = (size_t)( addr - pool->slots );
+        if( 0 == ( slotOffset % pool->slotSize ) )
+        {
+            emh_poolFree(heapId, pool, slotOffset / pool->slotSize);
+        }
+    }
+    else if( EMH_HEAP_COMPACT == ( emh_heapLinks[heapId].flags & EMH_HEAP_ENGINE_MASK ) )
+    {
+        emh_compactFree(heapId, addr);
+    }
+    return;
+}
+
+/**
+ * @brief Frees a block carrying a block link, the heap is read from the block link.
+ * 
+ * @param addr Address of the memory region to be freed.
+ */
+static void emh_freeLinked(void* addr)
+{
+    uint8_t *emh_addr = (uint8_t *) addr;
+    emh_blockLink_t *emh_block;
+    emh_heapId_t heapId;
+
+    emh_addr -= emh_blockLinkSize;
+    emh_block = (void *) emh_addr;
+    heapId = emh_heapOfBlock(emh_block);
+
+    /* Is the heapId valid? */
+    if( ( EMH_MALLOC_N_HEAPS > heapId ) && ( 0 <= heapId ) )
+    {
+#if defined(EMH_MALLOC_USE_PROFILE)
+        if( 0 != ( emh_block->blockSize & emh_sampledBit ) )
+        {
+            emh_profileRelease(heapId, emh_block);
+        }
+#endif /* EMH_MALLOC_USE_PROFILE */
+
+#if defined(EMH_MALLOC_USE_MMAP)
+        if( emh_isMapped(emh_block) )
+        {
+            emh_mapFree(heapId, emh_block);
+            return;
+        }
+#endif /* EMH_MALLOC_USE_MMAP */
+
+#if defined(EMH_MALLOC_REMOTE_FREE)
+        if( ( 0 != ( emh_block->blockSize & emh_allocBit ) ) &&
+            ( NULL == emh_block->nextFree ) &&
+            ( 0 != emh_remoteFreeBlock(heapId, emh_block) ) )
+        {
+            return;
+        }
+#endif /* EMH_MALLOC_REMOTE_FREE */
+
+#if defined(EMH_MALLOC_USE_TCACHE)
+        if( ( 0 != ( emh_block->blockSize & emh_allocBit ) ) &&
+            ( NULL == emh_block->nextFree ) &&
+            ( 0 != emh_tcacheFree(heapId, emh_block) ) )
+        {
+            return;
+        }
+#endif /* EMH_MALLOC_USE_TCACHE */
+
+        __emh_lock_heap_zone__(heapId);
+        /*
+         * [1.] Is the block allocated?
+         * [2.] Is the next block pointer NULL?
+         */
+        if( ( 0 != ( emh_block->blockSize & emh_allocBit ) ) &&
+            ( NULL == emh_block->nextFree ) )
+        {
+            emh_heapFree(&emh_heapLinks[heapId], emh_block);
+        }
+        __emh_unlock_heap_zone__(heapId);
+    }
+    return;
+}
+
+/**
+ * @brief Frees allocated memory region from heap and updates metadata.
+ * 
+ * @param addr Address of the memory region to be freed.
+ */
+static void emh_freeImpl(void* addr)
+{
+    emh_heapId_t heapId;
 
-            /* Have we cycled through the entire list? */
-            if( emh_link->end != block )
+    if( NULL != addr )
+    {
+        /* Pool slots, arena objects and compact blocks carry no block link, look them up by address first. */
+        if( 0 != emh_nRangeHeaps )
+        {
+            heapId = emh_findRangeHeap(addr);
+            if( 0 <= heapId )
             {
-                /* If we are here it means a suitable block has been found. */
-                addr = ( void* )( ( ( uint8_t* ) prevBlock->nextFree ) + emh_blockLinkSize );
-                prevBlock->nextFree = block->nextFree;
+                emh_freeRange(heapId, (uint8_t*) addr);
+                return;
+            }
+        }
+        emh_freeLinked(addr);
+    }
+    return;
+}
 
-                if(  EMH_MALLOC_MIN_BLOCK_SIZE < ( block->blockSize - size ) )
-                {
-                    newBlock = ( void* )( ( ( uint8_t* ) block ) + size );
-                    newBlock->blockSize = block->blockSize - size;
-                    block->blockSize = size;
+#if defined(EMH_MALLOC_USE_MMAP)
+/**
+ * @brief Releases the pages of every free block of the heap specified by heapId to
+ *        the OS, keeping the free block metadata in place. The pages are faulted
+ *        back in when the blocks are used again.
+ * @param heapId Id number of the heap.
+ * @return size_t number of bytes released, 0 if the heap id is not valid.
+ */
+size_t emh_purge(emh_heapId_t heapId)
+{
+    size_t purged;
 
-                    /* Insert block into list of free links */
-                    emh_linkFreeBlock(emh_link, newBlock);
-                }
+    /* Is heap ID not valid? */
+    if( ( 0 > heapId ) || ( EMH_MALLOC_N_HEAPS <= heapId ) || ( NULL == emh_heapLinks[heapId].end ) )
+    {
+        return 0;
+    }
 
-                emh_link->freeBytes -= block->blockSize;
-                if ( emh_link->freeBytes < emh_link->remainBytes )
-                {
-                    emh_link->remainBytes = emh_link->freeBytes;
-                }
+    __emh_lock_heap_zone__(heapId);
+#if defined(EMH_MALLOC_REMOTE_FREE)
+    emh_drainRemote(heapId, &emh_heapLinks[heapId]);
+#endif /* EMH_MALLOC_REMOTE_FREE */
+    purged = emh_purgeHeap(&emh_heapLinks[heapId]);
+    __emh_unlock_heap_zone__(heapId);
+    return purged;
+}
+#endif /* EMH_MALLOC_USE_MMAP */
+
+/**
+ * @brief Changes the placement policy of the first-fit heap specified by heapId,
+ *        blocks already allocated are left where they are.
+ * 
+ * @param heapId Id number of the heap.
+ * @param policy EMH_HEAP_POLICY_FIRST, EMH_HEAP_POLICY_NEXT, EMH_HEAP_POLICY_BEST
+ *               or EMH_HEAP_POLICY_SPLIT.
+ * @return int 0 on success, -1 if the heap id is not valid or the heap is not a
+ *         first-fit heap.
+ */
+int emh_set_policy(emh_heapId_t heapId, unsigned int policy)
+{
+    emh_heapLink_t *emh_link;
+
+    /* Is heap ID not valid? */
+    if( ( 0 > heapId ) || ( EMH_MALLOC_N_HEAPS <= heapId ) || ( NULL == emh_heapLinks[heapId].end ) || 
+        ( 0 != ( policy & ~( (unsigned int) EMH_HEAP_POLICY_MASK ) ) ) )
+    {
+        return -1;
+    }
+
+    emh_link = &emh_heapLinks[heapId];
+    if( EMH_HEAP_FIRST_FIT != ( emh_link->flags & EMH_HEAP_ENGINE_MASK ) )
+    {
+        return ( EMH_HEAP_POLICY_FIRST == policy ) ? 0 : -1;
+    }
+
+    __emh_lock_heap_zone__(heapId);
+    emh_link->flags = ( emh_link->flags & ~( (unsigned int) EMH_HEAP_POLICY_MASK ) ) | policy;
+    emh_link->rover = &emh_link->start;
+    __emh_unlock_heap_zone__(heapId);
+    return 0;
+}
+
+/**
+ * @brief Makes the calling thread the owner of the heap specified by heapId. When
+ *        remote free lists are enabled, blocks of the heap freed by any other thread
+ *        are pushed on the heap remote free list without taking the heap critical
+ *        zone, and returned to the heap on its next allocation.
+ * 
+ * @param heapId Id number of the heap.
+ * @return int 0 on success, -1 if the heap id is not valid or remote free lists
+ *         are not available on this port.
+ */
+int emh_set_owner(emh_heapId_t heapId)
+{
+#if defined(EMH_MALLOC_REMOTE_FREE)
+    /* Is heap ID not valid? */
+    if( ( 0 > heapId ) || ( EMH_MALLOC_N_HEAPS <= heapId ) || ( NULL == emh_heapLinks[heapId].end ) )
+    {
+        return -1;
+    }
+    atomic_store(&emh_heapOwner[heapId], (size_t) __emh_thread_id__());
+    return 0;
+#else
+    (void) heapId;
+    return -1;
+#endif /* EMH_MALLOC_REMOTE_FREE */
+}
+
+/**
+ * @brief Registers the heap served by emh_malloc_local to threads running on the
+ *        given CPU. Heaps are meant to be registered at start up, one per CPU or
+ *        one per memory node for every CPU of the node, see emh_create_node. 
+ * @param cpu    Index of the CPU, negative for the default heap, served to CPUs 
+ *               without a heap of their own.
+ * @param heapId Id number of the heap, negative to remove the registration.
+ * @return int 0 on success, -1 if the CPU index or the heap id is not valid.
+ */
+int emh_set_local(int cpu, emh_heapId_t heapId)
+{
+    if( ( EMH_MALLOC_MAX_CPUS <= cpu ) || ( EMH_MALLOC_N_HEAPS <= heapId ) ||
+        ( ( 0 <= heapId ) && ( NULL == emh_heapLinks[heapId].end ) ) )
+    {
+        return -1;
+    }
+
+    __emh_lock_zone__();
+    emh_localHeaps[( 0 > cpu ) ? EMH_MALLOC_MAX_CPUS : cpu] = ( 0 > heapId ) ? 0 : (emh_heapId_t)( heapId + 1 );
+    __emh_unlock_zone__();
+    return 0;
+}
+
+/**
+ * @brief Compares two addresses, used to sort pointers on emh_free_batch.
+ * @param a Pointer to the first address.
+ * @param b Pointer to the second address.
+ * @return int 
+ */
+static int emh_cmpAddr(const void *a, const void *b)
+{
+    uintptr_t addrA = (uintptr_t)( *(void* const*) a );
+    uintptr_t addrB = (uintptr_t)( *(void* const*) b );
+
+    return ( addrA > addrB ) - ( addrA < addrB );
+}
+
+/**
+ * @brief Allocates up to n blocks of the same size from the heap specified by heapId,
+ *        taking the heap critical zone once. On first-fit heaps placing blocks at the
+ *        lowest address that fits all the blocks are carved during a single pass over
+ *        the free list, other placement policies place every block on its own.
+ * 
+ * @param heapId Id number of the heap memory region to be used.
+ * @param size   Size of each block.
+ * @param n      Number of blocks to be allocated.
+ * @param out    Array receiving the address of the allocated blocks.
+ * @return size_t number of blocks actually allocated, the first entries of out.
+ */
+size_t emh_malloc_batch(emh_heapId_t heapId, size_t size, size_t n, void **out)
+{
+    emh_heapLink_t  *emh_link;
+    emh_blockLink_t *block, *prevBlock, *newBlock;
+    size_t          count   = 0;
+    size_t          scanned = 0;
+    size_t          blockSize;
+    unsigned int    policy;
+
+    /* Is heap ID not valid? */
+    if( ( 0 > heapId ) || ( EMH_MALLOC_N_HEAPS <= heapId ) || ( NULL == emh_heapLinks[heapId].end ) || ( NULL == out ) )
+    {
+        return count;
+    }
+
+    emh_link = &emh_heapLinks[heapId];
+
+    if( ( EMH_HEAP_POOL == ( emh_link->flags & EMH_HEAP_ENGINE_MASK ) ) || ( EMH_HEAP_ARENA == ( emh_link->flags & EMH_HEAP_ENGINE_MASK ) ) ||
+        ( EMH_HEAP_COMPACT == ( emh_link->flags & EMH_HEAP_ENGINE_MASK ) ) )
+    {
+        for(count = 0; ( count < n ) && ( NULL != ( out[count] = emh_mallocImpl(heapId, size) ) ); count++ );
+        return count;
+    }
+
+    blockSize = emh_blockSizeOf(emh_link, size);
+    if( 0 == blockSize )
+    {
+        return count;
+    }
+
+    /* The split policy places small blocks as first-fit does. */
+    policy = emh_link->flags & EMH_HEAP_POLICY_MASK;
+    policy = ( ( EMH_HEAP_POLICY_SPLIT == policy ) && ( blockSize < EMH_MALLOC_SPLIT_THRESHOLD ) ) ? EMH_HEAP_POLICY_FIRST : policy;
+
+    __emh_lock_heap_zone__(heapId);
+    if( emh_isTagged(emh_link) || ( EMH_HEAP_POLICY_FIRST != policy ) )
+    {
+        for( ; ( count < n ) && ( NULL != ( out[count] = emh_heapAlloc(heapId, emh_link, size, NULL) ) ); count++ );
+    }
+    else
+    {
+#if defined(EMH_MALLOC_REMOTE_FREE)
+        emh_drainRemote(heapId, emh_link);
+#endif /* EMH_MALLOC_REMOTE_FREE */
+        prevBlock = &emh_link->start;
+        block     = emh_link->start.nextFree;
+
+        /* The heap end has a size of zero, so it never fits. */
+        while( ( count < n ) && ( NULL != block ) && ( blockSize <= emh_link->freeBytes ) )
+        {
+            if( 0 != ( block->blockSize & emh_sizeMsk ) )
+            {
+                scanned++;
+            }
+            if( block->blockSize < blockSize )
+            {
+                prevBlock = block;
+                block     = block->nextFree;
+            }
+            else if( EMH_MALLOC_MIN_BLOCK_SIZE < ( block->blockSize - blockSize ) )
+            {
+                /* Carve from the front, the remaining space takes the block place on the list. */
+                newBlock = ( void* )( ( ( uint8_t* ) block ) + blockSize );
+                newBlock->blockSize = block->blockSize - blockSize;
+                newBlock->nextFree  = block->nextFree;
+                emh_roverReplace(emh_link, block, newBlock);
+                prevBlock->nextFree = newBlock;
+                block->blockSize    = blockSize;
+                out[count++] = emh_markAllocated(heapId, emh_link, block);
+                emh_countScanned(emh_link, &scanned);
+                block = newBlock;
+            }
+            else
+            {
+                emh_roverReplace(emh_link, block, prevBlock);
+                prevBlock->nextFree = block->nextFree;
+                out[count++] = emh_markAllocated(heapId, emh_link, block);
+                emh_countScanned(emh_link, &scanned);
+                block = prevBlock->nextFree;
+            }
+        }
+        emh_countScanned(emh_link, &scanned);
 
-                block->blockSize |= emh_allocBit;
-                block->blockSize |= emh_packHeapId(heapId);
-                block->nextFree = NULL;
-            }
+        /* Growable heaps map the blocks still missing, other heaps count the batch as failed. */
+        if( 0 != ( emh_link->flags & EMH_HEAP_GROWABLE ) )
+        {
+            for( ; ( count < n ) && ( NULL != ( out[count] = emh_heapAlloc(heapId, emh_link, size, NULL) ) ); count++ );
+        }
+        else if( count < n )
+        {
+            emh_link->nFailures++;
         }
     }
-    __emh_unlock_zone__();
-    return addr;
+    __emh_unlock_heap_zone__(heapId);
+
+    return count;
 }
 
 /**
- * @brief Frees allocated memory region from heap and updates metadata.
+ * @brief Frees n allocated memory regions. The pointers are sorted by address, so 
+ *        blocks of the same heap are freed taking the heap critical zone once and,
+ *        on first-fit heaps, linked during a single walk over the free list. 
  * 
- * @param addr Address of the memory region to be freed.
+ * @param ptrs Array of addresses to be freed, it is reordered by this function.
+ * @param n    Number of addresses.
  */
-void emh_free(void* addr)
+void emh_free_batch(void **ptrs, size_t n)
 {
-    uint8_t *emh_addr = (uint8_t *) addr;
-    emh_blockLink_t *emh_block;
-    emh_heapId_t heapId;
-    emh_heapLink_t *emh_link;
+    emh_blockLink_t *emh_block, *iterator = NULL;
+    emh_heapLink_t  *emh_link;
+    emh_heapId_t    heapId, lockedId = -1;
+    size_t          idx;
 
-    if( NULL != addr )
+    if( NULL == ptrs )
     {
-        emh_addr -= emh_blockLinkSize;
-        emh_block = (void *) emh_addr;
-        heapId = emh_unpackHeapId(emh_block->blockSize);
-      
-        __emh_lock_zone__();
+        return;
+    }
+
+    qsort(ptrs, n, sizeof( void* ), emh_cmpAddr);
+
+    for(idx = 0; idx < n; idx++)
+    {
+        if( NULL == ptrs[idx] )
+        {
+            continue;
+        }
+
+        if( ( 0 != emh_nRangeHeaps ) && ( 0 <= emh_findRangeHeap(ptrs[idx]) ) )
+        {
+            if( 0 <= lockedId )
+            {
+                __emh_unlock_heap_zone__(lockedId);
+                lockedId = -1;
+            }
+            emh_freeImpl(ptrs[idx]);
+            continue;
+        }
+
+        emh_block = ( void* )( ( ( uint8_t* ) ptrs[idx] ) - emh_blockLinkSize );
+        heapId = emh_heapOfBlock(emh_block);
+        if( ( 0 > heapId ) || ( EMH_MALLOC_N_HEAPS <= heapId ) )
+        {
+            continue;
+        }
+
+#if defined(EMH_MALLOC_USE_PROFILE)
+        /* Sampled blocks leave the profiler table through emh_freeImpl. */
+        if( 0 != ( emh_block->blockSize & emh_sampledBit ) )
+        {
+            if( 0 <= lockedId )
+            {
+                __emh_unlock_heap_zone__(lockedId);
+                lockedId = -1;
+            }
+            emh_freeImpl(ptrs[idx]);
+            continue;
+        }
+#endif /* EMH_MALLOC_USE_PROFILE */
+
+#if defined(EMH_MALLOC_USE_MMAP)
+        if( emh_isMapped(emh_block) )
+        {
+            if( 0 <= lockedId )
+            {
+                __emh_unlock_heap_zone__(lockedId);
+                lockedId = -1;
+            }
+            emh_mapFree(heapId, emh_block);
+            continue;
+        }
+#endif /* EMH_MALLOC_USE_MMAP */
+
+        if( heapId != lockedId )
+        {
+            if( 0 <= lockedId )
+            {
+                __emh_unlock_heap_zone__(lockedId);
+            }
+            __emh_lock_heap_zone__(heapId);
+            lockedId = heapId;
+            iterator = &emh_heapLinks[heapId].start;
+        }
+
         /*
          * [1.] Is the block allocated?
          * [2.] Is the next block pointer NULL?
-         * [3.] Is the heapId valid? 
          */
         if( ( 0 != ( emh_block->blockSize & emh_allocBit ) ) &&
-            ( NULL == emh_block->nextFree ) &&
-            ( EMH_MALLOC_N_HEAPS > heapId) &&
-            ( 0 <= heapId ) )
+            ( NULL == emh_block->nextFree ) )
         {
             emh_link = &emh_heapLinks[heapId];
-            emh_block->blockSize &= ~(emh_allocBit | emh_heapIdMsk);
-            emh_link->freeBytes += emh_block->blockSize;
-            emh_linkFreeBlock(emh_link, emh_block);
+            if( emh_isTagged(emh_link) )
+            {
+                emh_heapFree(emh_link, emh_block);
+            }
+            else
+            {
+                emh_block->blockSize &= ~(emh_allocBit | emh_heapIdMsk);
+                emh_link->freeBytes += emh_block->blockSize;
+                emh_link->nFrees++;
+                iterator = emh_linkFreeBlockFrom(emh_link, iterator, emh_block);
+                emh_markDirty(emh_link, emh_block->blockSize);
+            }
         }
-        __emh_unlock_zone__();
+    }
+
+    if( 0 <= lockedId )
+    {
+        __emh_unlock_heap_zone__(lockedId);
+    }
+    return;
+}
+
+/**
+ * @brief Accounts a free block into the heap statistics.
+ * @param stats     Pointer to the statistics being gathered.
+ * @param blockSize Size of the free block.
+ */
+static void emh_statFreeBlock(emh_heapStats_t *stats, size_t blockSize)
+{
+    unsigned int bin = emh_fls(blockSize);
+
+    bin = ( bin > 4 ) ? ( bin - 4 ) : 0;
+    if( bin >= EMH_STATS_HIST_BINS )
+    {
+        bin = EMH_STATS_HIST_BINS - 1;
+    }
+
+    stats->freeBlocks++;
+    stats->freeHist[bin]++;
+    if( blockSize > stats->largestFree )
+    {
+        stats->largestFree = blockSize;
     }
     return;
 }
 
+/**
+ * @brief Gathers the statistics of the heap specified by heapId. Counters are kept 
+ *        on every allocation and free, the free block figures are gathered by 
+ *        walking the free lists while holding the heap critical zone.
+ * 
+ * @param heapId Id number of the heap.
+ * @param stats  Pointer to the structure receiving the statistics.
+ * @return int 0 on success, -1 if the heap id is not valid.
+ */
+int emh_get_stats(emh_heapId_t heapId, emh_heapStats_t *stats)
+{
+    emh_heapLink_t  *emh_link;
+    emh_blockLink_t *block;
+    emh_tlsf_t      *tlsf;
+    emh_pool_t      *pool;
+    size_t          nFrees;
+    size_t          fl, sl;
+    uint32_t        offset;
+#if defined(EMH_MALLOC_USE_MMAP)
+    emh_mapped_t    *mapped;
+#endif /* EMH_MALLOC_USE_MMAP */
+
+    /* Is heap ID not valid? */
+    if( ( 0 > heapId ) || ( EMH_MALLOC_N_HEAPS <= heapId ) || ( NULL == emh_heapLinks[heapId].end ) || ( NULL == stats ) )
+    {
+        return -1;
+    }
+
+    emh_link = &emh_heapLinks[heapId];
+    memset(stats, 0x00, sizeof( emh_heapStats_t ));
+
+    /* 
+     * Pool slots are counted through the pool counters, with atomics those are not
+     * guarded by the heap lock so the figures are only a snapshot.
+     */
+    __emh_lock_heap_zone__(heapId);
+#if defined(EMH_MALLOC_REMOTE_FREE)
+    emh_drainRemote(heapId, emh_link);
+#endif /* EMH_MALLOC_REMOTE_FREE */
+    if( EMH_HEAP_POOL == ( emh_link->flags & EMH_HEAP_ENGINE_MASK ) )
+    {
+        pool   = emh_link->ctrl;
+        nFrees = pool->nFrees;
+        /* Frees are read first, a slot allocated and freed in between is counted as allocated. */
+        stats->allocBlocks = (size_t)( pool->nMallocs - nFrees );
+        stats->allocBlocks = ( stats->allocBlocks > pool->nSlots ) ? pool->nSlots : stats->allocBlocks;
+        stats->freeBlocks  = pool->nSlots - stats->allocBlocks;
+        stats->freeBytes   = stats->freeBlocks * pool->slotSize;
+        stats->nMallocs    = pool->nMallocs;
+        stats->nFrees      = nFrees;
+        stats->nFailures   = emh_link->nFailures;
+        emh_link->nMallocs  = stats->nMallocs;
+        emh_link->nFrees    = stats->nFrees;
+        emh_link->freeBytes = stats->freeBytes;
+        stats->allocBytes  = stats->allocBlocks * pool->slotSize;
+        stats->largestFree = ( 0 != stats->freeBlocks ) ? pool->slotSize : 0;
+        stats->remainBytes = stats->freeBytes;
+        __emh_unlock_heap_zone__(heapId);
+        return 0;
+    }
+
+    /* Arena heaps hold a single free block, above the top. */
+    if( EMH_HEAP_ARENA == ( emh_link->flags & EMH_HEAP_ENGINE_MASK ) )
+    {
+        if( 0 != emh_link->freeBytes )
+        {
+            emh_statFreeBlock(stats, emh_link->freeBytes);
+        }
+        stats->freeBytes   = emh_link->freeBytes;
+        stats->allocBytes  = emh_link->totalBytes - emh_link->freeBytes;
+        stats->remainBytes = emh_link->remainBytes;
+        stats->nMallocs    = emh_link->nMallocs;
+        stats->nFailures   = emh_link->nFailures;
+        __emh_unlock_heap_zone__(heapId);
+        return 0;
+    }
+
+    if( EMH_HEAP_TLSF == ( emh_link->flags & EMH_HEAP_ENGINE_MASK ) )
+    {
+        tlsf = emh_link->ctrl;
+        for(fl = 0; fl < EMH_TLSF_FL_COUNT; fl++)
+        {
+            for(sl = 0; sl < EMH_TLSF_SL_COUNT; sl++)
+            {
+                for(block = tlsf->heads[fl][sl]; NULL != block; block = block->nextFree)
+                {
+                    emh_statFreeBlock(stats, block->blockSize & emh_sizeMsk);
+                }
+            }
+        }
+    }
+    else if( EMH_HEAP_COMPACT == ( emh_link->flags & EMH_HEAP_ENGINE_MASK ) )
+    {
+        offset = ( (emh_compact_t*) emh_link->ctrl )->head;
+        while( emh_compactOffset(emh_link, emh_link->end) != offset )
+        {
+            emh_statFreeBlock(stats, emh_compactHdr(emh_link, offset)[0] * EMH_COMPACT_UNIT);
+            offset = emh_compactHdr(emh_link, offset)[1];
+        }
+    }
+    else
+    {
+        for(block = emh_link->start.nextFree; emh_link->end != block; block = block->nextFree)
+        {
+            emh_statFreeBlock(stats, block->blockSize & emh_sizeMsk);
+        }
+    }
+
+    stats->freeBytes   = emh_link->freeBytes;
+    stats->allocBytes  = emh_link->totalBytes - emh_link->freeBytes;
+    stats->allocBlocks = emh_link->nMallocs - emh_link->nFrees;
+    stats->remainBytes = emh_link->remainBytes;
+    stats->nMallocs    = emh_link->nMallocs;
+    stats->nFrees      = emh_link->nFrees;
+    stats->nFailures   = emh_link->nFailures;
+    stats->maxScanned  = emh_link->maxScanned;
+#if defined(EMH_MALLOC_USE_MMAP)
+    stats->mappedBytes = emh_link->mappedBytes;
+    for(mapped = emh_link->mapped; NULL != mapped; mapped = mapped->next)
+    {
+        stats->mappedBlocks++;
+    }
+#endif /* EMH_MALLOC_USE_MMAP */
+    if( 0 != ( emh_link->nMallocs + emh_link->nFailures ) )
+    {
+        stats->avgScanned = ( emh_link->nScanned + ( ( emh_link->nMallocs + emh_link->nFailures ) >> 1 ) ) / ( emh_link->nMallocs + emh_link->nFailures );
+    }
+    __emh_unlock_heap_zone__(heapId);
+
+    /* Share of the free space that can not be served by a single allocation. */
+    if( 0 != stats->freeBytes )
+    {
+        stats->fragmentation = (unsigned int)( 1000 - ( ( stats->largestFree * 1000 ) / stats->freeBytes ) );
+    }
+    return 0;
+}
+
 /**
  * @brief   Allocates memory for an array of *n* elements with given
  *          *size* and initializes all bytes in the allocated storage to 
- *          zero. 
+ *          zero. Blocks of first-fit and TLSF heaps lying on zero filled
+ *          memory never handed out before (see EMH_HEAP_ZEROED and the 
+ *          regions mapped by growable heaps), as well as blocks mapped on
+ *          their own, are not cleared again.
  * 
  * @param heapId   Id number of the heap memory region to be used.
  * @param n         Number of elements.
  * @param size      Individual element size.
- * @return void* 
+ * @return void* NULL if n * size overflows or the heap has no room for it.
  */
-void* emh_calloc(emh_heapId_t heapId, size_t n, size_t size)
+static void* emh_callocImpl(emh_heapId_t heapId, size_t n, size_t size)
 {
-    void *addr = NULL;
-    size_t totSize = (size_t)( n * size );
+    void            *addr = NULL;
+    uint8_t         *footer;
+    emh_heapLink_t  *emh_link;
+    size_t          totSize;
+    unsigned int    engine;
+    int             lazy;
+    int             fresh = 0;
+
+    /* Does the array size overflow? */
+    if( ( 0 != n ) && ( size > ( SIZE_MAX / n ) ) )
+    {
+        return addr;
+    }
+    totSize = n * size;
 
-    totSize += emh_blockLinkSize;
-    if( 0 != ( totSize & EMH_MALLOC_BYTE_ALIGN_MASK ) )
+    /* Is heap ID not valid? */
+    if( ( 0 > heapId ) || ( EMH_MALLOC_N_HEAPS <= heapId ) || ( NULL == emh_heapLinks[heapId].end ) )
     {
-        totSize += ( EMH_MALLOC_BYTE_ALIGNMENT - ( totSize & EMH_MALLOC_BYTE_ALIGN_MASK ) );
+        return addr;
     }
 
-    addr = emh_malloc(heapId, totSize);
+    emh_link = &emh_heapLinks[heapId];
+    engine   = emh_link->flags & EMH_HEAP_ENGINE_MASK;
 
-    if( NULL != addr )
+#if defined(EMH_MALLOC_USE_MMAP)
+    /* New mappings are zero filled. */
+    if( ( EMH_HEAP_POOL != engine ) && ( EMH_HEAP_ARENA != engine ) && 
+        ( 0 != ( emh_link->flags & EMH_HEAP_DIRECT_MAP ) ) && ( totSize >= EMH_MALLOC_MMAP_THRESHOLD ) )
+    {
+        return emh_mapAlloc(heapId, emh_link, totSize);
+    }
+#endif /* EMH_MALLOC_USE_MMAP */
+
+    /* Only first-fit and TLSF heaps track the memory never handed out. */
+    lazy = ( EMH_HEAP_FIRST_FIT == engine ) || ( EMH_HEAP_TLSF == engine );
+#if defined(EMH_MALLOC_USE_TCACHE)
+    /* Blocks small enough for the per-thread caches are served by the caches. */
+    if( ( totSize <= EMH_TCACHE_MAX_SIZE ) && ( 0 != emh_tcacheLimit ) )
+    {
+        lazy = 0;
+    }
+#endif /* EMH_MALLOC_USE_TCACHE */
+
+    if( 0 != lazy )
+    {
+        __emh_lock_heap_zone__(heapId);
+        addr = emh_heapAlloc(heapId, emh_link, totSize, &fresh);
+        __emh_unlock_heap_zone__(heapId);
+    }
+    else
+    {
+        addr = emh_mallocImpl(heapId, totSize);
+    }
+
+    if( NULL == addr )
+    {
+        return addr;
+    }
+
+    if( 0 == fresh )
     {
         memset(addr, 0x00, totSize);
+        return addr;
     }
 
+    /* Fresh blocks only hold the previous free link and the footer of boundary tagged heaps. */
+    memset(addr, 0x00, ( totSize < sizeof( emh_blockLink_t* ) ) ? totSize : sizeof( emh_blockLink_t* ));
+    footer = ( (uint8_t*) emh_nextPhysBlock((void*)( ( (uint8_t*) addr ) - emh_blockLinkSize )) ) - sizeof( size_t );
+    if( footer < ( ( (uint8_t*) addr ) + totSize ) )
+    {
+        memset(footer, 0x00, (size_t)( ( ( (uint8_t*) addr ) + totSize ) - footer ));
+    }
     return addr;
 }
 
 /**
  * @brief   Reallocates given address memory to a different size.
  *          If there is no sufficient space on the heap for specified
- *          size emh_realloc will return a NULL pointer. There is no con-
- *          -traction nor expansion of a memory region, instead emh_realloc
- *          looks in the free block list the requested memory size and if
- *          successful it will copy the information from the given address
- *          to the newly allocated one, free the given address and then 
- *          return a pointer to the memory region.
- *          
- *          If the requested size is smaller than the given block information 
- *          will be truncated during copy. Otherwise the information will be 
- *          fully copied.
+ *          size emh_realloc will return a NULL pointer and the given
+ *          memory region is left untouched.
+ * 
+ *          When shrinking, the tail of the block is split off and linked
+ *          back to the heap as a free block. When growing, the block is
+ *          expanded in place if the next block is free and large enough.
+ *          Otherwise emh_realloc looks in the free block list the requested
+ *          memory size and if successful it will copy the information from
+ *          the given address to the newly allocated one, free the given
+ *          address and then return a pointer to the memory region.
  * 
  * @param addr Address of the memory region to be reallocated.
  * @param size Requested size of new memory region.
  * @return void* 
  */
-void* emh_realloc(void *addr, size_t size)
+static void* emh_reallocImpl(void *addr, size_t size)
 {
     void *emh_addr = NULL;
     uint8_t *byteAddr = (uint8_t *) addr;
     size_t blockSize = 0;
+    size_t newSize = 0;
     emh_blockLink_t *block;
     emh_heapId_t heapId;   
+    int resized = 0;
 
     /* Is given pointer valid? */
     if( NULL != addr )
@@ -382,49 +5752,264 @@ void* emh_realloc(void *addr, size_t size)
          */
         if( 0 == size )
         {
-            emh_free(addr);
+            emh_freeImpl(addr);
+            return emh_addr;
+        }
+
+        /* 
+         * Pool slots have a fixed size, they can only be
+         * reallocated to a size that fits the slot.
+         */
+        heapId = ( 0 != emh_nRangeHeaps ) ? emh_findRangeHeap(addr) : -1;
+        if( 0 <= heapId )
+        {
+            if( EMH_HEAP_ARENA == ( emh_heapLinks[heapId].flags & EMH_HEAP_ENGINE_MASK ) )
+            {
+                __emh_lock_heap_zone__(heapId);
+                emh_addr = emh_arenaResize(&emh_heapLinks[heapId], byteAddr, size);
+                __emh_unlock_heap_zone__(heapId);
+            }
+            else if( EMH_HEAP_COMPACT == ( emh_heapLinks[heapId].flags & EMH_HEAP_ENGINE_MASK ) )
+            {
+                emh_addr = emh_compactRealloc(heapId, byteAddr, size);
+            }
+            else if( size <= ( (emh_pool_t*) emh_heapLinks[heapId].ctrl )->slotSize )
+            {
+                emh_addr = addr;
+            }
             return emh_addr;
         }
 
         /* Extract heap block information */
         byteAddr -= emh_blockLinkSize;
         block = (void *) byteAddr;
-        heapId = emh_unpackHeapId(block->blockSize);
-        blockSize =  ( block->blockSize & ~(emh_allocBit | emh_heapIdMsk) );
+        heapId = emh_heapOfBlock(block);
 
-        /* Align requested size before allocating */
-        if( 0 != ( size & EMH_MALLOC_BYTE_ALIGN_MASK ) )
+        if( ( 0 > heapId ) || ( EMH_MALLOC_N_HEAPS <= heapId ) )
         {
-            size += ( EMH_MALLOC_BYTE_ALIGNMENT - ( size & EMH_MALLOC_BYTE_ALIGN_MASK ) );
-        }           
+            return emh_addr;
+        }
 
-        /*
-         * If requested size is the same as target block's 
-         * No need to reallocate, just return given address.
-         */
-        if( size == blockSize )
+#if defined(EMH_MALLOC_USE_MMAP)
+        if( emh_isMapped(block) )
+        {
+            return emh_mapRealloc(heapId, block, size);
+        }
+#endif /* EMH_MALLOC_USE_MMAP */
+
+        /* Try to shrink or grow the block in place. */
+        __emh_lock_heap_zone__(heapId);
+        if( ( 0 != ( block->blockSize & emh_allocBit ) ) && ( NULL == block->nextFree ) )
+        {
+            blockSize = block->blockSize & emh_sizeMsk;
+            newSize   = emh_blockSizeOf(&emh_heapLinks[heapId], size);
+            if( 0 != newSize )
+            {
+                resized = emh_heapResize(&emh_heapLinks[heapId], block, newSize);
+            }
+        }
+        __emh_unlock_heap_zone__(heapId);
+
+        if( 0 == newSize )
+        {
+            return emh_addr;
+        }
+
+        if( 0 != resized )
         {
             emh_addr = addr;
             return emh_addr;
         }
 
-        emh_addr = emh_malloc(heapId, size);
+        emh_addr = emh_mallocImpl(heapId, size);
 
         /* Was allocation successful? */
         if( NULL != emh_addr )
         {
-            /* is new allocated area greater or smaller than previous? */
-            if( size > blockSize )
-            {
-                memcpy(emh_addr, addr, blockSize);
-                emh_free(addr);
-            }
-            else
-            {
-                memcpy(emh_addr, addr, size);
-                emh_free(addr);
-            }
+            /* Only growing reaches this point, copy the whole previous block. */
+            memcpy(emh_addr, addr, blockSize - emh_blockLinkSize);
+            emh_freeImpl(addr);
         }
     }
     return emh_addr;
 }
+
+/**
+ * @brief Allocates memory region into designated heap space specified by heapId
+ *        and returns a memory aligned pointer to allocated memory area, see
+ *        emh_mallocImpl. The call is recorded when a trace is open and counted
+ *        by the heap profiler.
+ * 
+ * @param heapId Id number of the heap memory region to be used.
+ * @param size   Size of memory to be allocated from the heap.
+ * @return void* 
+ */
+void* emh_malloc(emh_heapId_t heapId, size_t size)
+{
+    void *addr;
+#if defined(EMH_MALLOC_USE_TRACE)
+    uint64_t start = emh_traceStart();
+#endif /* EMH_MALLOC_USE_TRACE */
+
+    addr = emh_mallocImpl(heapId, size);
+#if defined(EMH_MALLOC_USE_PROFILE)
+    emh_profileAccount(addr, size);
+#endif /* EMH_MALLOC_USE_PROFILE */
+#if defined(EMH_MALLOC_USE_TRACE)
+    emh_traceRecord(start, EMH_TRACE_MALLOC, heapId, addr, NULL, size);
+#endif /* EMH_MALLOC_USE_TRACE */
+    return addr;
+}
+
+/**
+ * @brief Returns the heap registered for the CPU running the calling thread, or
+ *        the default heap when the CPU has none, see emh_set_local.
+ * @return emh_heapId_t heap identifier or -1 if no heap is registered.
+ */
+emh_heapId_t emh_local_heap(void)
+{
+    size_t       cpu    = (size_t) __emh_cpu_id__();
+    emh_heapId_t heapId = 0;
+
+    if( cpu < EMH_MALLOC_MAX_CPUS )
+    {
+        heapId = emh_localHeaps[cpu];
+    }
+    if( 0 == heapId )
+    {
+        heapId = emh_localHeaps[EMH_MALLOC_MAX_CPUS];
+    }
+    return (emh_heapId_t)( heapId - 1 );
+}
+
+/**
+ * @brief Allocates from the heap registered for the CPU running the calling thread,
+ *        see emh_local_heap. Threads moved to another CPU keep freeing their blocks
+ *        through emh_free, which finds the heap of each block on its own.
+ * @param size Size of memory to be allocated.
+ * @return void* memory aligned pointer to the allocated memory area or NULL.
+ */
+void* emh_malloc_local(size_t size)
+{
+    return emh_malloc(emh_local_heap(), size);
+}
+
+/**
+ * @brief Frees allocated memory region from heap, see emh_freeImpl. The call is
+ *        recorded when a trace is open.
+ * 
+ * @param addr Address of the memory region to be freed.
+ */
+void emh_free(void* addr)
+{
+#if defined(EMH_MALLOC_USE_TRACE)
+    uint64_t start = emh_traceStart();
+
+    emh_freeImpl(addr);
+    emh_traceRecord(start, EMH_TRACE_FREE, -1, addr, NULL, 0);
+#else
+    emh_freeImpl(addr);
+#endif /* EMH_MALLOC_USE_TRACE */
+    return;
+}
+
+/**
+ * @brief Frees allocated memory region from the heap it was allocated from. Knowing
+ *        the heap spares the address lookup emh_free runs when pool, arena or compact
+ *        heaps exist. The call is recorded as an emh_free when a trace is open.
+ * 
+ * @param heapId Id number of the heap the memory region was allocated from.
+ * @param addr   Address of the memory region to be freed.
+ */
+void emh_heap_free(emh_heapId_t heapId, void *addr)
+{
+    unsigned int engine;
+#if defined(EMH_MALLOC_USE_TRACE)
+    uint64_t start = emh_traceStart();
+#endif /* EMH_MALLOC_USE_TRACE */
+
+    /* Is heap ID not valid? */
+    if( ( NULL == addr ) || ( 0 > heapId ) || ( EMH_MALLOC_N_HEAPS <= heapId ) || ( NULL == emh_heapLinks[heapId].end ) )
+    {
+        return;
+    }
+
+    /* Blocks compact heaps map on their own lie outside the region and carry a block link. */
+    engine = emh_heapLinks[heapId].flags & EMH_HEAP_ENGINE_MASK;
+    if( ( ( EMH_HEAP_POOL == engine ) || ( EMH_HEAP_ARENA == engine ) || ( EMH_HEAP_COMPACT == engine ) ) &&
+        ( (uint8_t*) emh_heapLinks[heapId].base <= (uint8_t*) addr ) && ( (uint8_t*) emh_heapLinks[heapId].end > (uint8_t*) addr ) )
+    {
+        emh_freeRange(heapId, (uint8_t*) addr);
+    }
+    else
+    {
+        emh_freeLinked(addr);
+    }
+#if defined(EMH_MALLOC_USE_TRACE)
+    emh_traceRecord(start, EMH_TRACE_FREE, -1, addr, NULL, 0);
+#endif /* EMH_MALLOC_USE_TRACE */
+    return;
+}
+
+/**
+ * @brief Allocates zero filled memory for an array of *n* elements of given 
+ *        *size*, see emh_callocImpl. The call is recorded when a trace is open
+ *        and counted by the heap profiler.
+ * 
+ * @param heapId Id number of the heap memory region to be used.
+ * @param n      Number of elements.
+ * @param size   Individual element size.
+ * @return void* 
+ */
+void* emh_calloc(emh_heapId_t heapId, size_t n, size_t size)
+{
+    void *addr;
+#if defined(EMH_MALLOC_USE_TRACE)
+    uint64_t start = emh_traceStart();
+#endif /* EMH_MALLOC_USE_TRACE */
+
+    addr = emh_callocImpl(heapId, n, size);
+#if defined(EMH_MALLOC_USE_PROFILE)
+    /* A block is only returned when n * size does not overflow. */
+    emh_profileAccount(addr, n * size);
+#endif /* EMH_MALLOC_USE_PROFILE */
+#if defined(EMH_MALLOC_USE_TRACE)
+    emh_traceRecord(start, EMH_TRACE_CALLOC, heapId, addr, NULL, ( ( 0 != n ) && ( size > ( SIZE_MAX / n ) ) ) ? SIZE_MAX : n * size);
+#endif /* EMH_MALLOC_USE_TRACE */
+    return addr;
+}
+
+/**
+ * @brief Reallocates given address memory to a different size, see emh_reallocImpl.
+ *        The call is recorded when a trace is open and counted by the heap profiler
+ *        as a new allocation, a sampled block losing its sample.
+ * 
+ * @param addr Address of the memory region to be reallocated.
+ * @param size Requested size of new memory region.
+ * @return void* 
+ */
+void* emh_realloc(void *addr, size_t size)
+{
+    void *newAddr;
+#if defined(EMH_MALLOC_USE_PROFILE)
+    emh_blockLink_t *block = emh_profileBlockOf(addr);
+#endif /* EMH_MALLOC_USE_PROFILE */
+#if defined(EMH_MALLOC_USE_TRACE)
+    uint64_t start = emh_traceStart();
+#endif /* EMH_MALLOC_USE_TRACE */
+
+#if defined(EMH_MALLOC_USE_PROFILE)
+    if( ( NULL != block ) && ( 0 != ( block->blockSize & emh_sampledBit ) ) )
+    {
+        emh_profileRelease(emh_heapOfBlock(block), block);
+    }
+#endif /* EMH_MALLOC_USE_PROFILE */
+    newAddr = emh_reallocImpl(addr, size);
+#if defined(EMH_MALLOC_USE_PROFILE)
+    emh_profileAccount(newAddr, size);
+#endif /* EMH_MALLOC_USE_PROFILE */
+#if defined(EMH_MALLOC_USE_TRACE)
+    emh_traceRecord(start, EMH_TRACE_REALLOC, -1, newAddr, addr, size);
+#endif /* EMH_MALLOC_USE_TRACE */
+    return newAddr;
+}
@@ -28,11 +28,26 @@
 #ifndef EMH_MALLOC_H
 #define EMH_MALLOC_H
 
+#include <stdint.h>
+
+/* The port header is a C header as well, its objects are shared with emh_malloc.c. */
+#if defined(__cplusplus)
+extern "C" {
+#endif /* __cplusplus */
+
 #include <emh_portenv.h>
 
+/*
+ * Block links keep the lowest bits of the heap id, EMH_MALLOC_HEAP_ID_BITMASK. Builds
+ * with more than EMH_MALLOC_TAGGED_HEAPS heaps find the heap of a block through a
+ * page map instead, see EMH_MALLOC_MAP_SHIFT, and take up to EMH_MALLOC_MAX_HEAPS.
+ * Ids ending with the bits of EMH_MALLOC_HEAP_ID_BITMASK are never handed out, that
+ * tag marks blocks belonging to no heap.
+ */
 #define EMH_MALLOC_HEAP_ID_BITMASK 0x7F
 #define EMH_MALLOC_BITS_PER_BYTE   8
-#define EMH_MALLOC_MAX_HEAPS       127
+#define EMH_MALLOC_TAGGED_HEAPS    127
+#define EMH_MALLOC_MAX_HEAPS       32767
 
 #if !defined(EMH_MALLOC_N_HEAPS)
 #define EMH_MALLOC_N_HEAPS 2
@@ -42,7 +57,159 @@
 #warning "emh_malloc: EMH_MALLOC_N_HEAPS exceeds the limit, macro redefined to 2"
 #endif /* !defined(EMH_MALLOC_N_HEAPS) */
 
-typedef signed char emh_heapId_t;
+/* 
+ * Heap flags accepted by emh_create_ex. The lowest nibble selects
+ * the allocation engine used by the heap.
+ */
+#define EMH_HEAP_ENGINE_MASK       0x000F
+#define EMH_HEAP_FIRST_FIT         0x0000  /* Address ordered free list, first-fit search (default). */
+#define EMH_HEAP_TLSF              0x0001  /* Two-level segregated fit, O(1) allocation and free. */
+#define EMH_HEAP_POOL              0x0002  /* Fixed size slots, see emh_create_pool. */
+#define EMH_HEAP_ARENA             0x0003  /* Bump allocation released at once, see emh_create_arena. */
+#define EMH_HEAP_COMPACT           0x0004  /* Address ordered first-fit with 32-bit block headers, heaps under 4 GiB. */
+#define EMH_HEAP_BOUNDARY_TAGS     0x0010  /* First-fit heaps: O(1) coalescing through boundary tags. */
+#define EMH_HEAP_GROWABLE          0x0020  /* First-fit and TLSF heaps: map a new region when full, see EMH_MALLOC_USE_MMAP. */
+#define EMH_HEAP_PURGE             0x0040  /* Return the pages of free blocks to the OS as they pile up, see emh_purge. */
+#define EMH_HEAP_DIRECT_MAP        0x0080  /* Serve requests above EMH_MALLOC_MMAP_THRESHOLD bytes with their own mapping. */
+#define EMH_HEAP_HUGE_PAGES        0x1000  /* Backed by huge pages, set by emh_create_huge. */
+#define EMH_HEAP_ZEROED            0x2000  /* The heap region is zero filled, emh_calloc skips clearing memory never handed out. */
+#define EMH_HEAP_PERSISTENT        0x4000  /* Compact heaps: position independent, may be attached again at any address, see emh_attach. */
+#define EMH_HEAP_MAPPED            0x8000  /* The region was mapped with mmap, emh_destroy unmaps it. */
+
+/*
+ * A persistent heap may be attached by a single process at a time: the free list
+ * lives on the region but the counters and the critical zone guarding it belong to
+ * the process that attached it. Regions mapped shared, such as the files opened by
+ * emh_open_file, must not be used by several processes at once.
+ */
+
+/*
+ * Placement policies of first-fit heaps, accepted by emh_create_ex and
+ * emh_set_policy. The split policy serves requests of at least
+ * EMH_MALLOC_SPLIT_THRESHOLD bytes from the high end of the heap.
+ */
+#define EMH_HEAP_POLICY_MASK       0x0F00
+#define EMH_HEAP_POLICY_FIRST      0x0000  /* Lowest block that fits (default). */
+#define EMH_HEAP_POLICY_NEXT       0x0100  /* First block that fits after the last allocation. */
+#define EMH_HEAP_POLICY_BEST       0x0200  /* Smallest block that fits. */
+#define EMH_HEAP_POLICY_SPLIT      0x0300  /* Small blocks from the low end, large blocks from the high end. */
+
+#if !defined(EMH_MALLOC_SPLIT_THRESHOLD)
+#define EMH_MALLOC_SPLIT_THRESHOLD 1024
+#endif /* EMH_MALLOC_SPLIT_THRESHOLD */
+
+/*
+ * Size of the regions mapped by growable heaps, only used when EMH_MALLOC_USE_MMAP
+ * is defined. Requests that do not fit a region get a region rounded up to a 
+ * multiple of EMH_MALLOC_GROW_CHUNK. Must be a multiple of the page size.
+ */
+#if !defined(EMH_MALLOC_GROW_CHUNK)
+#define EMH_MALLOC_GROW_CHUNK      ( (size_t) 1 << 20 )
+#endif /* EMH_MALLOC_GROW_CHUNK */
+
+/*
+ * Page release parameters, only used when EMH_MALLOC_USE_MMAP is defined. Heaps
+ * created with EMH_HEAP_PURGE release the pages of their free blocks every time
+ * EMH_MALLOC_PURGE_THRESHOLD bytes have been freed, through madvise with 
+ * EMH_MALLOC_PURGE_ADVICE (MADV_DONTNEED by default, MADV_FREE may be used 
+ * instead). Heaps created with EMH_HEAP_DIRECT_MAP map requests of at least
+ * EMH_MALLOC_MMAP_THRESHOLD bytes on their own.
+ */
+#if !defined(EMH_MALLOC_PURGE_THRESHOLD)
+#define EMH_MALLOC_PURGE_THRESHOLD ( (size_t) 4 << 20 )
+#endif /* EMH_MALLOC_PURGE_THRESHOLD */
+
+#if !defined(EMH_MALLOC_PURGE_ADVICE)
+#define EMH_MALLOC_PURGE_ADVICE    MADV_DONTNEED
+#endif /* EMH_MALLOC_PURGE_ADVICE */
+
+#if !defined(EMH_MALLOC_MMAP_THRESHOLD)
+#define EMH_MALLOC_MMAP_THRESHOLD  ( (size_t) 256 << 10 )
+#endif /* EMH_MALLOC_MMAP_THRESHOLD */
+
+/*
+ * Huge page size used by emh_create_huge, only used when EMH_MALLOC_USE_MMAP is
+ * defined. Heaps backed by huge pages grow and release their pages in multiples
+ * of EMH_MALLOC_HUGE_PAGE_SIZE, so purging never splits a huge page.
+ */
+#if !defined(EMH_MALLOC_HUGE_PAGE_SIZE)
+#define EMH_MALLOC_HUGE_PAGE_SIZE  ( (size_t) 2 << 20 )
+#endif /* EMH_MALLOC_HUGE_PAGE_SIZE */
+
+/*
+ * Number of CPUs served by emh_malloc_local, see emh_set_local. CPUs at or above
+ * this index take the default local heap.
+ */
+#if !defined(EMH_MALLOC_MAX_CPUS)
+#define EMH_MALLOC_MAX_CPUS        256
+#endif /* EMH_MALLOC_MAX_CPUS */
+
+/*
+ * Page map granularity, only used when EMH_MALLOC_N_HEAPS exceeds EMH_MALLOC_TAGGED_HEAPS.
+ * The page map records the heap of every 1 << EMH_MALLOC_MAP_SHIFT bytes of address
+ * space holding heap regions, pages shared by several heaps, such as a heap created
+ * within a block of another heap, are resolved to the innermost heap by address range.
+ * Should not exceed the system page size, so mapped blocks never share a page.
+ */
+#if !defined(EMH_MALLOC_MAP_SHIFT)
+#define EMH_MALLOC_MAP_SHIFT       12
+#endif /* EMH_MALLOC_MAP_SHIFT */
+
+/*
+ * Per-thread cache parameters, only used when EMH_MALLOC_USE_TCACHE is defined.
+ * Allocations up to EMH_MALLOC_TCACHE_STEP * EMH_MALLOC_TCACHE_CLASSES bytes are
+ * served by the cache, which holds up to EMH_MALLOC_TCACHE_LIMIT bytes per thread
+ * and exchanges blocks with the heaps in batches of EMH_MALLOC_TCACHE_BATCH.
+ */
+#if !defined(EMH_MALLOC_TCACHE_STEP)
+#define EMH_MALLOC_TCACHE_STEP     16
+#endif /* EMH_MALLOC_TCACHE_STEP */
+
+#if !defined(EMH_MALLOC_TCACHE_CLASSES)
+#define EMH_MALLOC_TCACHE_CLASSES  16
+#endif /* EMH_MALLOC_TCACHE_CLASSES */
+
+#if !defined(EMH_MALLOC_TCACHE_LIMIT)
+#define EMH_MALLOC_TCACHE_LIMIT    32768
+#endif /* EMH_MALLOC_TCACHE_LIMIT */
+
+#if !defined(EMH_MALLOC_TCACHE_BATCH)
+#define EMH_MALLOC_TCACHE_BATCH    8
+#endif /* EMH_MALLOC_TCACHE_BATCH */
+
+/* Every thread keeps bins for the heaps below EMH_MALLOC_TCACHE_HEAPS, higher heap ids bypass the cache. */
+#if !defined(EMH_MALLOC_TCACHE_HEAPS)
+#define EMH_MALLOC_TCACHE_HEAPS    ( ( EMH_MALLOC_N_HEAPS < 128 ) ? EMH_MALLOC_N_HEAPS : 128 )
+#endif /* EMH_MALLOC_TCACHE_HEAPS */
+
+/*
+ * Trace recorder parameters, only used when EMH_MALLOC_USE_TRACE is defined.
+ * Every thread records its events on a ring of EMH_MALLOC_TRACE_RING events,
+ * which is written to the trace file whenever it fills up.
+ */
+#if !defined(EMH_MALLOC_TRACE_RING)
+#define EMH_MALLOC_TRACE_RING      4096
+#endif /* EMH_MALLOC_TRACE_RING */
+
+/*
+ * Heap profiler parameters, only used when EMH_MALLOC_USE_PROFILE is defined.
+ * Sampled blocks keep up to EMH_MALLOC_PROFILE_DEPTH return addresses, the
+ * side tables hold up to EMH_MALLOC_PROFILE_SITES call sites (per heap) and
+ * EMH_MALLOC_PROFILE_SAMPLES live sampled blocks, samples beyond are dropped.
+ */
+#if !defined(EMH_MALLOC_PROFILE_DEPTH)
+#define EMH_MALLOC_PROFILE_DEPTH   16
+#endif /* EMH_MALLOC_PROFILE_DEPTH */
+
+#if !defined(EMH_MALLOC_PROFILE_SITES)
+#define EMH_MALLOC_PROFILE_SITES   1024
+#endif /* EMH_MALLOC_PROFILE_SITES */
+
+#if !defined(EMH_MALLOC_PROFILE_SAMPLES)
+#define EMH_MALLOC_PROFILE_SAMPLES 8192
+#endif /* EMH_MALLOC_PROFILE_SAMPLES */
+
+typedef int16_t emh_heapId_t;
 
 typedef struct emh_blockLink_t
 {
@@ -50,18 +217,194 @@ typedef struct emh_blockLink_t
     struct emh_blockLink_t* nextFree;
 }emh_blockLink_t;
 
+/*
+ * Additional heap region, see emh_extend. Placed at the beginning of the region,
+ * the blocks of the region lie between the region header and end. Blocks placed
+ * at or above fresh lie on zero filled memory never handed out before.
+ */
+typedef struct emh_region_t
+{
+    struct emh_region_t* next;
+    emh_blockLink_t*     end;
+    void*                fresh;
+    size_t               mapSize;
+}emh_region_t;
+
+/*
+ * Header of a block mapped on its own, see EMH_HEAP_DIRECT_MAP. Placed at the
+ * beginning of the mapping, right before the block link. Mapped blocks of a heap
+ * are kept on a doubly linked list so emh_reset can unmap them.
+ */
+typedef struct emh_mapped_t
+{
+    struct emh_mapped_t* prev;
+    struct emh_mapped_t* next;
+    size_t               mapSize;
+}emh_mapped_t;
+
 typedef struct emh_heapLink_t
 {
     emh_blockLink_t  start;
     emh_blockLink_t* end;
     size_t           freeBytes;
     size_t           remainBytes;   
+    unsigned int     flags;
+    void*            ctrl;
+    size_t           totalBytes;
+    size_t           nMallocs;
+    size_t           nFrees;
+    size_t           nFailures;
+    size_t           nScanned;
+    size_t           maxScanned;
+    void*            base;
+    size_t           generation;
+    emh_blockLink_t* rover;
+    emh_blockLink_t* firstEnd;
+    emh_region_t*    regions;
+    size_t           dirtyBytes;
+    size_t           mappedBytes;
+    emh_mapped_t*    mapped;
+    void*            fresh;
+    void*            heapAddr;
+    size_t           heapSize;
 }emh_heapLink_t;
 
+/*
+ * Heap statistics, see emh_get_stats. Byte counts include the block links.
+ * freeHist[i] counts the free blocks smaller than 2^(i + 5) bytes and not
+ * counted on a previous bin, the last bin counts every larger free block.
+ * fragmentation is given per mille: 0 means all the free space lies on a
+ * single block, values close to 1000 mean the free space is spread over
+ * blocks too small to serve a large allocation.
+ */
+#define EMH_STATS_HIST_BINS 16
+
+typedef struct emh_heapStats_t
+{
+    size_t       freeBytes;
+    size_t       allocBytes;
+    size_t       freeBlocks;
+    size_t       allocBlocks;
+    size_t       largestFree;
+    size_t       remainBytes;
+    size_t       freeHist[EMH_STATS_HIST_BINS];
+    unsigned int fragmentation;
+    size_t       nMallocs;
+    size_t       nFrees;
+    size_t       nFailures;
+    size_t       avgScanned;
+    size_t       maxScanned;
+    size_t       mappedBytes;
+    size_t       mappedBlocks;
+}emh_heapStats_t;
+
+/*
+ * Trace file layout, see emh_trace_open. The file starts with an emh_traceHeader_t
+ * followed by fixed size events in host byte order. Events are written in chunks
+ * per thread, so they must be sorted by time to follow the allocation order. 
+ * addr is the block returned (the block released for EMH_TRACE_FREE), prev the 
+ * block passed to emh_realloc, size the requested size (n * size for emh_calloc),
+ * heapId the heap requested (-1 for frees and reallocs) and latency the time spent
+ * in the call. Times are given in nanoseconds.
+ */
+#define EMH_TRACE_MAGIC            0x43525445UL  /* "ETRC" */
+#define EMH_TRACE_VERSION          2
+
+enum
+{
+    EMH_TRACE_MALLOC = 0,
+    EMH_TRACE_CALLOC,
+    EMH_TRACE_REALLOC,
+    EMH_TRACE_FREE
+};
+
+typedef struct emh_traceHeader_t
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t eventSize;
+}emh_traceHeader_t;
+
+typedef struct emh_traceEvent_t
+{
+    uint64_t time;
+    uint64_t addr;
+    uint64_t prev;
+    uint64_t size;
+    uint32_t latency;
+    uint16_t thread;
+    int16_t  heapId;
+    uint8_t  op;
+}emh_traceEvent_t;
+
+/*
+ * Call site of the heap profiler, see emh_profile_snapshot. liveBytes estimates
+ * the bytes held by blocks allocated from the call site that are still live,
+ * liveSamples is the number of sampled blocks the estimate is made of.
+ */
+typedef struct emh_profileSite_t
+{
+    void*        frames[EMH_MALLOC_PROFILE_DEPTH];
+    size_t       depth;
+    size_t       liveBytes;
+    size_t       liveSamples;
+    emh_heapId_t heapId;
+}emh_profileSite_t;
+
 extern emh_heapId_t emh_create(void *heapAddr, size_t heapSize);
+extern emh_heapId_t emh_create_ex(void *heapAddr, size_t heapSize, unsigned int heapFlags);
+extern emh_heapId_t emh_create_pool(void *heapAddr, size_t heapSize, size_t objSize);
+extern emh_heapId_t emh_create_arena(void *heapAddr, size_t heapSize);
+extern int          emh_extend(emh_heapId_t heapId, void *addr, size_t size);
+extern int          emh_reset(emh_heapId_t heapId);
+extern int          emh_destroy(emh_heapId_t heapId);
+extern size_t       emh_arena_mark(emh_heapId_t heapId);
+extern int          emh_arena_rewind(emh_heapId_t heapId, size_t mark);
 extern void*        emh_malloc(emh_heapId_t heapId, size_t size);
 extern void         emh_free(void *addr);
+extern void         emh_heap_free(emh_heapId_t heapId, void *addr);
 extern void*        emh_calloc(emh_heapId_t heapId, size_t n, size_t size);
 extern void*        emh_realloc(void *addr, size_t size);
+extern void*        emh_aligned_alloc(emh_heapId_t heapId, size_t alignment, size_t size);
+extern size_t       emh_malloc_batch(emh_heapId_t heapId, size_t size, size_t n, void **out);
+extern void         emh_free_batch(void **ptrs, size_t n);
+extern int          emh_get_stats(emh_heapId_t heapId, emh_heapStats_t *stats);
+extern int          emh_set_policy(emh_heapId_t heapId, unsigned int policy);
+extern int          emh_set_owner(emh_heapId_t heapId);
+extern emh_heapId_t emh_attach(void *heapAddr, size_t heapSize);
+extern int          emh_set_root(emh_heapId_t heapId, void *addr);
+extern void*        emh_get_root(emh_heapId_t heapId);
+extern int          emh_set_local(int cpu, emh_heapId_t heapId);
+extern emh_heapId_t emh_local_heap(void);
+extern void*        emh_malloc_local(size_t size);
+
+#if defined(EMH_MALLOC_USE_MMAP)
+extern size_t       emh_purge(emh_heapId_t heapId);
+extern emh_heapId_t emh_create_huge(size_t heapSize, unsigned int heapFlags);
+extern emh_heapId_t emh_open_file(const char *path, size_t heapSize);
+extern int          emh_sync(emh_heapId_t heapId);
+extern emh_heapId_t emh_create_node(size_t heapSize, unsigned int heapFlags, unsigned int node);
+#endif /* EMH_MALLOC_USE_MMAP */
+
+#if defined(EMH_MALLOC_USE_TRACE)
+extern int          emh_trace_open(const char *path);
+extern void         emh_trace_flush(void);
+extern int          emh_trace_close(void);
+#endif /* EMH_MALLOC_USE_TRACE */
+
+#if defined(EMH_MALLOC_USE_PROFILE)
+extern void         emh_profile_set_rate(size_t rate);
+extern size_t       emh_profile_snapshot(emh_profileSite_t *sites, size_t maxSites);
+extern int          emh_profile_dump(const char *path);
+#endif /* EMH_MALLOC_USE_PROFILE */
+
+#if defined(EMH_MALLOC_USE_TCACHE)
+extern void         emh_tcache_flush(void);
+extern void         emh_tcache_set_limit(size_t limit);
+#endif /* EMH_MALLOC_USE_TCACHE */
+
+#if defined(__cplusplus)
+}
+#endif /* __cplusplus */
 
 #endif /* EMH_MALLOC_H */
@@ -0,0 +1,316 @@
+/**
+ *  emh_malloc
+ *  Copyright (C) 2022, Antonio Vitor Grossi Bassi
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * @file    emh_malloc.hpp
+ * @author  Antonio Vitor Grossi Bassi (antoniovitor.gb@gmail.com)
+ * @brief   C++ bindings. emh::heap owns a heap id, emh::allocator places
+ *          the objects of a standard container on a heap chosen at compile
+ *          time and, from C++17 on, emh::memory_resource places the objects
+ *          of std::pmr containers on a heap chosen at run time.
+ *
+ * @version 1.6
+ * @date    2022-10-12
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#ifndef EMH_MALLOC_HPP
+#define EMH_MALLOC_HPP
+
+#include <cstddef>
+#include <limits>
+#include <new>
+#include <type_traits>
+
+#if ( __cplusplus >= 201703L ) && defined(__has_include)
+#if __has_include(<memory_resource>)
+#include <memory_resource>
+#define EMH_MALLOC_HAS_PMR
+#endif /* __has_include */
+#endif /* __cplusplus */
+
+#include "emh_malloc.h"
+
+namespace emh
+{
+
+namespace detail
+{
+
+/**
+ * @brief Allocates bytes from a heap with the given alignment, blocks stricter
+ *        than EMH_MALLOC_BYTE_ALIGNMENT are taken with emh_aligned_alloc.
+ * @param heapId    Id number of the heap.
+ * @param bytes     Size of memory to be allocated, zero is served as a single byte.
+ * @param alignment Requested alignment, a power of two.
+ * @return void* never NULL, throws std::bad_alloc when the heap is exhausted.
+ */
+inline void* allocate(emh_heapId_t heapId, std::size_t bytes, std::size_t alignment)
+{
+    void *addr;
+
+    if( 0 == bytes )
+    {
+        bytes = 1;
+    }
+    if( alignment <= EMH_MALLOC_BYTE_ALIGNMENT )
+    {
+        addr = emh_malloc(heapId, bytes);
+    }
+    else
+    {
+        addr = emh_aligned_alloc(heapId, alignment, bytes);
+    }
+    if( nullptr == addr )
+    {
+        throw std::bad_alloc();
+    }
+    return addr;
+}
+
+} /* namespace detail */
+
+/**
+ * @brief Owner of a heap id. The heap is destroyed along with its owner, see emh_destroy,
+ *        so every container placed on it must be destroyed first. Its id goes back to
+ *        the registry and may be handed out to the next heap created. Owners can be
+ *        moved but not copied.
+ */
+class heap
+{
+public:
+    heap() noexcept : heapId_(-1) {}
+
+    /**
+     * @brief Adopts a heap created through the C API, e.g. by emh_create_pool.
+     * @param heapId Id number of the heap, negative for no heap.
+     */
+    explicit heap(emh_heapId_t heapId) noexcept : heapId_(heapId) {}
+
+    /**
+     * @brief Creates a heap on the given region, see emh_create_ex.
+     * @param heapAddr  Start address of the heap region.
+     * @param heapSize  Size of the heap region.
+     * @param heapFlags Engine, policy and behaviour flags.
+     */
+    heap(void *heapAddr, std::size_t heapSize, unsigned int heapFlags = EMH_HEAP_FIRST_FIT)
+        : heapId_(emh_create_ex(heapAddr, heapSize, heapFlags))
+    {
+        if( 0 > heapId_ )
+        {
+            throw std::bad_alloc();
+        }
+    }
+
+    heap(const heap&) = delete;
+    heap& operator=(const heap&) = delete;
+
+    heap(heap &&other) noexcept : heapId_(other.release()) {}
+
+    heap& operator=(heap &&other) noexcept
+    {
+        if( this != &other )
+        {
+            reset();
+            heapId_ = other.release();
+        }
+        return *this;
+    }
+
+    ~heap()
+    {
+        reset();
+    }
+
+    /**
+     * @brief Creates a pool heap of objSize slots, see emh_create_pool.
+     */
+    static heap pool(void *heapAddr, std::size_t heapSize, std::size_t objSize)
+    {
+        return created(emh_create_pool(heapAddr, heapSize, objSize));
+    }
+
+    /**
+     * @brief Creates an arena heap, see emh_create_arena.
+     */
+    static heap arena(void *heapAddr, std::size_t heapSize)
+    {
+        return created(emh_create_arena(heapAddr, heapSize));
+    }
+
+#if defined(EMH_MALLOC_USE_MMAP)
+    /**
+     * @brief Creates a heap on a region backed by huge pages, see emh_create_huge.
+     */
+    static heap huge(std::size_t heapSize, unsigned int heapFlags = EMH_HEAP_FIRST_FIT)
+    {
+        return created(emh_create_huge(heapSize, heapFlags));
+    }
+#endif /* EMH_MALLOC_USE_MMAP */
+
+    emh_heapId_t id() const noexcept
+    {
+        return heapId_;
+    }
+
+    explicit operator bool() const noexcept
+    {
+        return 0 <= heapId_;
+    }
+
+    /**
+     * @brief Gives up the ownership of the heap without destroying it.
+     * @return emh_heapId_t id number of the heap.
+     */
+    emh_heapId_t release() noexcept
+    {
+        emh_heapId_t heapId = heapId_;
+
+        heapId_ = -1;
+        return heapId;
+    }
+
+    /**
+     * @brief Destroys the owned heap, see emh_destroy, and gives up its ownership.
+     */
+    void reset() noexcept
+    {
+        if( 0 <= heapId_ )
+        {
+            (void) emh_destroy(heapId_);
+        }
+        heapId_ = -1;
+        return;
+    }
+
+private:
+    static heap created(emh_heapId_t heapId)
+    {
+        if( 0 > heapId )
+        {
+            throw std::bad_alloc();
+        }
+        return heap(heapId);
+    }
+
+    emh_heapId_t heapId_;
+};
+
+/**
+ * @brief Stateless allocator placing the objects of a container on the heap HeapId.
+ *        emh_create hands out heap ids in creation order, so the ids of the heaps
+ *        created at start up are known at compile time. Every allocator of a heap
+ *        compares equal, containers of the same heap swap and move in constant time.
+ * @tparam T      Type of the allocated objects.
+ * @tparam HeapId Id number of the heap.
+ */
+template <class T, emh_heapId_t HeapId>
+class allocator
+{
+public:
+    typedef T                 value_type;
+    typedef std::size_t       size_type;
+    typedef std::ptrdiff_t    difference_type;
+    typedef std::true_type    is_always_equal;
+    typedef std::true_type    propagate_on_container_move_assignment;
+
+    static constexpr emh_heapId_t heap_id = HeapId;
+
+    template <class U>
+    struct rebind
+    {
+        typedef allocator<U, HeapId> other;
+    };
+
+    allocator() noexcept = default;
+
+    template <class U>
+    allocator(const allocator<U, HeapId>&) noexcept {}
+
+    T* allocate(std::size_t n)
+    {
+        if( n > ( std::numeric_limits<std::size_t>::max() / sizeof( T ) ) )
+        {
+            throw std::bad_array_new_length();
+        }
+        return static_cast<T*>(detail::allocate(HeapId, n * sizeof( T ), alignof( T )));
+    }
+
+    void deallocate(T *addr, std::size_t) noexcept
+    {
+        emh_heap_free(HeapId, addr);
+    }
+};
+
+template <class T, class U, emh_heapId_t HeapId>
+inline bool operator==(const allocator<T, HeapId>&, const allocator<U, HeapId>&) noexcept
+{
+    return true;
+}
+
+template <class T, class U, emh_heapId_t HeapId>
+inline bool operator!=(const allocator<T, HeapId>&, const allocator<U, HeapId>&) noexcept
+{
+    return false;
+}
+
+#if defined(EMH_MALLOC_HAS_PMR)
+/**
+ * @brief Memory resource placing the objects of std::pmr containers on a heap chosen
+ *        at run time. Two resources are equal when they allocate from the same heap,
+ *        so blocks may be released through either of them.
+ */
+class memory_resource : public std::pmr::memory_resource
+{
+public:
+    explicit memory_resource(emh_heapId_t heapId) noexcept : heapId_(heapId) {}
+
+    explicit memory_resource(const heap &owner) noexcept : heapId_(owner.id()) {}
+
+    emh_heapId_t heap_id() const noexcept
+    {
+        return heapId_;
+    }
+
+protected:
+    void* do_allocate(std::size_t bytes, std::size_t alignment) override
+    {
+        return detail::allocate(heapId_, bytes, alignment);
+    }
+
+    /* Block sizes are kept on the heap, only the heap id is needed to release a block. */
+    void do_deallocate(void *addr, std::size_t, std::size_t) override
+    {
+        emh_heap_free(heapId_, addr);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override
+    {
+        const memory_resource *resource = dynamic_cast<const memory_resource*>(&other);
+
+        return ( nullptr != resource ) && ( heapId_ == resource->heapId_ );
+    }
+
+private:
+    emh_heapId_t heapId_;
+};
+#endif /* EMH_MALLOC_HAS_PMR */
+
+} /* namespace emh */
+
+#endif /* EMH_MALLOC_HPP */
@@ -54,4 +54,120 @@
 #error emh_malloc: ERROR! No semaphore or mutex realeasing function was defined. Check emh_malloc/emh_port.h
 #endif /* __emh_unlock_zone__ */ 
 
+/*
+ * Optional per-heap critical zone hooks. Each of these macros receives
+ * the heap id of the heap link being accessed, so every heap may be
+ * guarded by its own semaphore or mutex and allocations performed on
+ * different heaps do not block each other. The global critical zone
+ * above is still used to protect the heap links array on emh_create.
+ * If none of the hooks are defined every heap falls back to the global
+ * critical zone.
+ */
+#if !defined(__emh_create_heap_zone__) && !defined(__emh_lock_heap_zone__) && !defined(__emh_unlock_heap_zone__)
+#define __emh_create_heap_zone__(heapId) do{ (void)(heapId); }while(0)
+#define __emh_lock_heap_zone__(heapId)   __emh_lock_zone__()
+#define __emh_unlock_heap_zone__(heapId) __emh_unlock_zone__()
+#elif !defined(__emh_create_heap_zone__) || !defined(__emh_lock_heap_zone__) || !defined(__emh_unlock_heap_zone__)
+#error emh_malloc: ERROR! Per-heap zone hooks must be defined together. Check emh_malloc/emh_port.h
+#endif /* __emh_create_heap_zone__ */
+
+/*
+ * Lock-free paths, such as the pool heaps free stack, rely on C11 atomics.
+ * They are used whenever the compiler provides them, unless the user defines
+ * EMH_MALLOC_NO_ATOMICS, in which case those paths take the heap critical
+ * zone instead.
+ */
+#if !defined(EMH_MALLOC_NO_ATOMICS) && defined(__STDC_VERSION__) && ( __STDC_VERSION__ >= 201112L ) && !defined(__STDC_NO_ATOMICS__)
+#define EMH_MALLOC_HAS_ATOMICS
+#endif /* EMH_MALLOC_NO_ATOMICS */
+
+/*
+ * The per-thread cache (EMH_MALLOC_USE_TCACHE), the trace recorder
+ * (EMH_MALLOC_USE_TRACE) and the heap profiler (EMH_MALLOC_USE_PROFILE) 
+ * require thread local storage. The storage class specifier may be provided
+ * through EMH_MALLOC_THREAD_LOCAL, otherwise the C11 or GNU specifier is used.
+ */
+#if ( defined(EMH_MALLOC_USE_TCACHE) || defined(EMH_MALLOC_USE_TRACE) || defined(EMH_MALLOC_USE_PROFILE) ) && !defined(EMH_MALLOC_THREAD_LOCAL)
+#if defined(__STDC_VERSION__) && ( __STDC_VERSION__ >= 201112L )
+#define EMH_MALLOC_THREAD_LOCAL _Thread_local
+#elif defined(__GNUC__)
+#define EMH_MALLOC_THREAD_LOCAL __thread
+#else
+#error emh_malloc: ERROR! No thread local storage specifier was defined. Check emh_malloc/emh_port.h
+#endif /* __STDC_VERSION__ */
+#endif /* EMH_MALLOC_USE_TCACHE */
+
+/*
+ * Optional thread id hook. When defined, __emh_thread_id__() must return a
+ * non-zero integer that identifies the calling thread, e.g. the value of
+ * pthread_self() or the task handle. Together with C11 atomics it enables
+ * the remote free lists: blocks freed by a thread other than the owner of
+ * their heap (see emh_set_owner) are pushed on a lock-free list, which the
+ * heap drains on its next allocation.
+ */
+#if defined(__emh_thread_id__) && defined(EMH_MALLOC_HAS_ATOMICS)
+#define EMH_MALLOC_REMOTE_FREE
+#endif /* __emh_thread_id__ */
+
+/*
+ * Optional CPU id hook. __emh_cpu_id__() must return the index of the CPU
+ * running the calling thread as an unsigned integer, e.g. sched_getcpu(), and
+ * is used by emh_malloc_local to pick the heap registered for that CPU through
+ * emh_set_local. Without it every thread takes the heap of CPU 0.
+ */
+#if !defined(__emh_cpu_id__)
+#define __emh_cpu_id__() 0U
+#endif /* __emh_cpu_id__ */
+
+/*
+ * Optional NUMA hook, only used when EMH_MALLOC_USE_MMAP is defined.
+ * __emh_bind_node__(addr, size, node) must place the pages of the given range
+ * on the given memory node, e.g. through mbind(), and return 0 on success.
+ * Without it the regions of emh_create_node are placed on first touch.
+ */
+
+/*
+ * Builds with more than EMH_MALLOC_TAGGED_HEAPS heaps resolve the heap of a block
+ * through a page map, whose nodes are mapped on demand and published with C11
+ * atomics, so they need EMH_MALLOC_USE_MMAP and atomics.
+ */
+#if ( EMH_MALLOC_N_HEAPS > EMH_MALLOC_TAGGED_HEAPS )
+#if !defined(EMH_MALLOC_USE_MMAP)
+#error emh_malloc: ERROR! More than EMH_MALLOC_TAGGED_HEAPS heaps require EMH_MALLOC_USE_MMAP. Check emh_malloc/emh_port.h
+#endif /* EMH_MALLOC_USE_MMAP */
+#if !defined(EMH_MALLOC_HAS_ATOMICS)
+#error emh_malloc: ERROR! More than EMH_MALLOC_TAGGED_HEAPS heaps require C11 atomics. Check emh_malloc/emh_port.h
+#endif /* EMH_MALLOC_HAS_ATOMICS */
+#define EMH_MALLOC_PAGE_MAP
+#endif /* EMH_MALLOC_N_HEAPS */
+
+/*
+ * The trace recorder (EMH_MALLOC_USE_TRACE) needs C11 atomics, the C library 
+ * stdio and a clock hook: __emh_clock_ns__() must return a monotonic time in
+ * nanoseconds as an unsigned 64-bit integer.
+ */
+#if defined(EMH_MALLOC_USE_TRACE)
+#if !defined(__emh_clock_ns__)
+#error emh_malloc: ERROR! The trace recorder requires the __emh_clock_ns__ hook. Check emh_malloc/emh_port.h
+#endif /* __emh_clock_ns__ */
+#if !defined(EMH_MALLOC_HAS_ATOMICS)
+#error emh_malloc: ERROR! The trace recorder requires C11 atomics. Check emh_malloc/emh_port.h
+#endif /* EMH_MALLOC_HAS_ATOMICS */
+#endif /* EMH_MALLOC_USE_TRACE */
+
+/*
+ * The heap profiler (EMH_MALLOC_USE_PROFILE) needs C11 atomics and a stack
+ * walker hook: __emh_backtrace__(frames, depth) must store up to depth return
+ * addresses of the calling thread on the frames array of void pointers and
+ * return how many were stored, e.g. backtrace() from execinfo.h.
+ */
+#if defined(EMH_MALLOC_USE_PROFILE)
+#if !defined(__emh_backtrace__)
+#error emh_malloc: ERROR! The heap profiler requires the __emh_backtrace__ hook. Check emh_malloc/emh_port.h
+#endif /* __emh_backtrace__ */
+#if !defined(EMH_MALLOC_HAS_ATOMICS)
+#error emh_malloc: ERROR! The heap profiler requires C11 atomics. Check emh_malloc/emh_port.h
+#endif /* EMH_MALLOC_HAS_ATOMICS */
+#endif /* EMH_MALLOC_USE_PROFILE */
+
 #endif /* EMH_PORT_H */